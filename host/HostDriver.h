@@ -0,0 +1,243 @@
+/*
+ *
+ * Copyright (c) 2021 Goldfish64
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef __HOST_DRIVER_H__
+#define __HOST_DRIVER_H__
+
+#include "HostPlatform.h"
+
+//
+// Host build of the driver's ring setup, TX and RX paths and interrupt pass. The doorbells, consumer index
+// reads, RX harvest and interrupt mask/ack come from the ring engine and are the ones the kext calls;
+// only the glue around them differs, with mbufs replaced by pool packets and the network stack replaced
+// by the rxInput callback. Bar is nx2_host_bar_t or the device simulator.
+//
+// TX packets are single segment. RX packets carry the rx_l2_header_t and pad in front of the frame,
+// as the controller writes them.
+//
+#define HOST_TX_POOL_COUNT        (TX_USABLE_BD_COUNT * 2)
+#define HOST_RX_POOL_COUNT        (RX_USABLE_BD_COUNT * 2)
+#define HOST_PACKET_SIZE          2048
+
+typedef void (*nx2_host_rx_input_t)(void *context, nx2_packet_t packet, UInt16 packetLength);
+
+template <typename Bar>
+class NX2HostDriver {
+public:
+  Bar                       *bar;
+  status_block_t            *statusBlock;
+  tx_bd_t                   *txChain;
+  rx_bd_t                   *rxChain;
+  
+  azul_nx2_tx_ring_t        txRing CACHE_LINE_ALIGNED;
+  azul_nx2_rx_ring_t        rxRing CACHE_LINE_ALIGNED;
+  
+  nx2_host_packet_pool_t    txPool;
+  nx2_host_packet_pool_t    rxPool;
+  nx2_host_rx_input_t       rxInput;
+  void                      *rxInputContext;
+  
+  UInt16                    lastStatusIndex;
+  azul_nx2_work_stats_t     interruptWork;
+  UInt64                    txPackets;
+  UInt64                    txStalls;
+  UInt64                    rxPackets;
+  UInt64                    rxErrors;
+  
+  //
+  // Sets up the status block, coalescing parameters and both rings, with interrupts left masked.
+  //
+  bool init(Bar *bar, status_block_t *statusBlock) {
+    memset(this, 0, sizeof (*this));
+    this->bar         = bar;
+    this->statusBlock = statusBlock;
+    
+    txChain = (tx_bd_t*) nx2HostAllocDma(TX_PAGE_SIZE);
+    rxChain = (rx_bd_t*) nx2HostAllocDma(RX_PAGE_SIZE);
+    if (txChain == NULL || rxChain == NULL) {
+      return false;
+    }
+    if (!nx2HostPoolInit(&txPool, HOST_TX_POOL_COUNT, HOST_PACKET_SIZE) ||
+        !nx2HostPoolInit(&rxPool, HOST_RX_POOL_COUNT, HOST_PACKET_SIZE)) {
+      return false;
+    }
+    
+    bar->writeReg32(NX2_HC_STATUS_ADDR_H, ADDR_HI(nx2HostPhysAddr(statusBlock)));
+    bar->writeReg32(NX2_HC_STATUS_ADDR_L, ADDR_LO(nx2HostPhysAddr(statusBlock)));
+    initTxRxRegs(TX_INT_TICKS, TX_QUICK_CONS_TRIP, RX_INT_TICKS, RX_QUICK_CONS_TRIP);
+    
+    initTxRing();
+    return initRxRing();
+  }
+  
+  void free() {
+    ::free(txChain);
+    ::free(rxChain);
+    nx2HostPoolFree(&txPool);
+    nx2HostPoolFree(&rxPool);
+  }
+  
+  //
+  // Programs interrupt coalescing, using the same values in and out of the interrupt handler.
+  //
+  void initTxRxRegs(UInt32 txTicks, UInt32 txTrip, UInt32 rxTicks, UInt32 rxTrip) {
+    bar->writeReg32(NX2_HC_TX_TICKS, (txTicks << 16) | txTicks);
+    bar->writeReg32(NX2_HC_TX_QUICK_CONS_TRIP, (txTrip << 16) | txTrip);
+    bar->writeReg32(NX2_HC_RX_TICKS, (rxTicks << 16) | rxTicks);
+    bar->writeReg32(NX2_HC_RX_QUICK_CONS_TRIP, (rxTrip << 16) | rxTrip);
+  }
+  
+  //
+  // Context writes use the 5706/5708 window.
+  //
+  void writeContext32(UInt32 cid, UInt32 offset, UInt32 value) {
+    bar->writeReg32(NX2_CTX_DATA_ADR, cid + offset);
+    bar->writeReg32(NX2_CTX_DATA, value);
+  }
+  
+  void enableInterrupts(bool coalNow) {
+    nx2InterruptAck(bar, lastStatusIndex);
+    
+    if (coalNow) {
+      bar->writeReg32(NX2_HC_COMMAND, NX2_HC_COMMAND_ENABLE | NX2_HC_COMMAND_COAL_NOW);
+    }
+  }
+  
+  //
+  // One interrupt pass, as interruptOccurred() does without the link handling and handler timing.
+  //
+  void interruptOccurred() {
+    UInt16 statusIndex;
+    UInt32 txReclaimed = 0;
+    UInt32 rxPackets = 0;
+    
+    nx2InterruptMask(bar);
+    statusIndex = __atomic_load_n(&statusBlock->index, __ATOMIC_ACQUIRE);
+    
+    nx2InterruptService(statusBlock, &txRing, &rxRing, [&](UInt16 txConsNew) {
+      txReclaimed = handleTxInterrupt(txConsNew);
+    }, [&](UInt16 rxConsNew) {
+      rxPackets = handleRxInterrupt(rxConsNew);
+    });
+    
+    nx2WorkRecordPass(&interruptWork, false, txReclaimed, rxPackets, statusIndex, lastStatusIndex);
+    lastStatusIndex = statusIndex;
+    enableInterrupts(false);
+  }
+  
+  //
+  // Posts a packet of length bytes and rings the TX doorbell. Returns false if the ring is full.
+  //
+  bool sendTxPacket(nx2_packet_t packet, UInt32 length) {
+    nx2_host_segment_t segment = { packet->physAddr, length };
+    
+    if (!nx2TxRingHasRoom(&txRing, 1)) {
+      txStalls++;
+      return false;
+    }
+    
+    nx2TxRingPost(&txRing, &segment, 1, 0, 0, packet);
+    nx2TxRingDoorbell(bar, &txRing);
+    txPackets++;
+    return true;
+  }
+  
+  UInt32 handleTxInterrupt(UInt16 txConsNew) {
+    return nx2TxRingReclaim(&txRing, txConsNew, [this](nx2_packet_t packet, UInt16 txIndex) {
+      nx2HostPoolRelease(&txPool, packet);
+    });
+  }
+  
+  void initTxRing() {
+    nx2TxRingInit(&txRing, txChain, nx2HostPhysAddr(txChain));
+    
+    writeContext32(GET_CID_ADDR(TX_CID), NX2_L2CTX_TX_TYPE, NX2_L2CTX_TX_TYPE_TYPE_L2 | NX2_L2CTX_TX_TYPE_SIZE_L2);
+    writeContext32(GET_CID_ADDR(TX_CID), NX2_L2CTX_TX_CMD_TYPE, NX2_L2CTX_TX_CMD_TYPE_TYPE_L2 | (8 << 16));
+    writeContext32(GET_CID_ADDR(TX_CID), NX2_L2CTX_TX_TBDR_BHADDR_HI, ADDR_HI(nx2HostPhysAddr(txChain)));
+    writeContext32(GET_CID_ADDR(TX_CID), NX2_L2CTX_TX_TBDR_BHADDR_LO, ADDR_LO(nx2HostPhysAddr(txChain)));
+  }
+  
+  bool initRxRing() {
+    nx2RxRingInit(&rxRing, rxChain, nx2HostPhysAddr(rxChain));
+    for (UInt16 i = 0; i < RX_USABLE_BD_COUNT; i++) {
+      if (!initRxDescriptor(i, true)) {
+        return false;
+      }
+    }
+    
+    writeContext32(GET_CID_ADDR(RX_CID), NX2_L2CTX_RX_CTX_TYPE,
+                   NX2_L2CTX_RX_CTX_TYPE_CTX_BD_CHN_TYPE_VALUE | NX2_L2CTX_RX_CTX_TYPE_SIZE_L2 | (0x02 << NX2_L2CTX_RX_BD_PRE_READ_SHIFT));
+    writeContext32(GET_CID_ADDR(RX_CID), NX2_L2CTX_RX_NX_BDHADDR_HI, ADDR_HI(nx2HostPhysAddr(rxChain)));
+    writeContext32(GET_CID_ADDR(RX_CID), NX2_L2CTX_RX_NX_BDHADDR_LO, ADDR_LO(nx2HostPhysAddr(rxChain)));
+    
+    nx2RxRingDoorbell(bar, &rxRing);
+    return true;
+  }
+  
+  //
+  // Posts a BD, with a new pool packet if forceAllocate is set or the existing one otherwise.
+  //
+  inline bool initRxDescriptor(UInt16 index, bool forceAllocate) {
+    if (forceAllocate) {
+    rxRing.packets[index] = nx2HostPoolAlloc(&rxPool);
+    if (rxRing.packets[index] == NULL) {
+      return false;
+    }
+    }
+    
+    nx2RxRingPost(&rxRing, index, rxRing.packets[index]->physAddr, HOST_PACKET_SIZE);
+    return true;
+  }
+  
+  //
+  // Harvests received packets up to rxConsNew through the same loop as the kext. Packets with errors
+  // keep their buffer; good packets are handed to rxInput and their buffer goes back to the pool.
+  //
+  UInt32 handleRxInterrupt(UInt16 rxConsNew) {
+    UInt32 count;
+    
+    count = nx2RxRingHarvest(&rxRing, rxConsNew, [this](UInt16 rxIndex) {
+      return (rx_l2_header_t*) rxRing.packets[rxIndex]->data;
+    }, [this](UInt16 rxIndex, rx_l2_header_t *l2Header, UInt16 packetLength, bool valid) {
+      if (!valid) {
+        rxErrors++;
+        return false;
+      }
+      
+      rxPackets++;
+      if (rxInput != NULL) {
+        rxInput(rxInputContext, rxRing.packets[rxIndex], packetLength);
+    }
+      nx2HostPoolRelease(&rxPool, rxRing.packets[rxIndex]);
+      return true;
+    }, [this](UInt16 rxIndex, bool reuse) {
+      initRxDescriptor(rxIndex, !reuse);
+    });
+    
+    nx2RxRingDoorbell(bar, &rxRing);
+    return count;
+  }
+};
+
+#endif
@@ -0,0 +1,165 @@
+/*
+ *
+ * Copyright (c) 2021 Goldfish64
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef __HOST_PLATFORM_H__
+#define __HOST_PLATFORM_H__
+
+//
+// Linux userspace platform layer for the OS-independent parts of the driver, standing in for IOKit
+// in the host build. Provides what RingEngine.h and UserQueue.h expect from the platform:
+//   - MMIO: register writes go to a BAR object supplied by the caller, either nx2_host_bar_t below
+//     or the device simulator. Both provide readReg32(), writeReg16() and writeReg32().
+//   - DMA mapping: host memory is identity mapped, the physical address of a buffer is its virtual address.
+//   - Packet buffers: fixed-size buffers from a preallocated pool in place of mbufs.
+//
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef uint8_t   UInt8;
+typedef uint16_t  UInt16;
+typedef uint32_t  UInt32;
+typedef uint64_t  UInt64;
+typedef int32_t   SInt32;
+typedef int64_t   SInt64;
+
+#define BIT(x)                    (1 << (x))
+
+#define kIOEthernetAddressSize    6
+#define kIOEthernetCRCSize        4
+#define kIOEthernetMinPacketSize  64
+#define kIOEthernetMaxPacketSize  1518
+
+#if defined(__x86_64__) || defined(__i386__)
+#define DMA_WRITE_BARRIER()       __asm__ volatile ("sfence" ::: "memory")
+#else
+#define DMA_WRITE_BARRIER()       __sync_synchronize()
+#endif
+
+//
+// Packet buffer, the host equivalent of an mbuf with a single segment.
+//
+typedef struct {
+  UInt64                    physAddr;
+  UInt8                     *data;
+  UInt32                    length;
+} nx2_host_packet_t;
+
+typedef nx2_host_packet_t *nx2_packet_t;
+
+typedef struct {
+  UInt64                    location;
+  UInt32                    length;
+} nx2_host_segment_t;
+
+#include "Registers.h"
+#include "RingEngine.h"
+#include "UserQueue.h"
+#include "RegisterTrace.h"
+#include "Histogram.h"
+
+static inline void *nx2HostAllocDma(size_t size) {
+  void *buffer = aligned_alloc(PAGESIZE_4K, (size + PAGESIZE_4K - 1) & ~((size_t) PAGESIZE_4K - 1));
+  if (buffer != NULL) {
+    memset(buffer, 0, size);
+  }
+  return buffer;
+}
+
+static inline UInt64 nx2HostPhysAddr(const void *buffer) {
+  return (UInt64) (uintptr_t) buffer;
+}
+
+//
+// Packet pool. Buffers are allocated up front and handed out from a free stack.
+//
+typedef struct {
+  nx2_host_packet_t         *packets;
+  UInt8                     *memory;
+  nx2_packet_t              *freeStack;
+  UInt32                    freeCount;
+  UInt32                    count;
+  UInt32                    bufferSize;
+} nx2_host_packet_pool_t;
+
+static inline bool nx2HostPoolInit(nx2_host_packet_pool_t *pool, UInt32 count, UInt32 bufferSize) {
+  pool->count       = count;
+  pool->bufferSize  = bufferSize;
+  pool->packets     = (nx2_host_packet_t*) calloc(count, sizeof (nx2_host_packet_t));
+  pool->freeStack   = (nx2_packet_t*) calloc(count, sizeof (nx2_packet_t));
+  pool->memory      = (UInt8*) nx2HostAllocDma((size_t) count * bufferSize);
+  if (pool->packets == NULL || pool->freeStack == NULL || pool->memory == NULL) {
+    return false;
+  }
+  
+  for (UInt32 i = 0; i < count; i++) {
+    pool->packets[i].data     = pool->memory + (size_t) i * bufferSize;
+    pool->packets[i].physAddr = nx2HostPhysAddr(pool->packets[i].data);
+    pool->packets[i].length   = bufferSize;
+    pool->freeStack[i]        = &pool->packets[i];
+  }
+  pool->freeCount = count;
+  return true;
+}
+
+static inline void nx2HostPoolFree(nx2_host_packet_pool_t *pool) {
+  free(pool->packets);
+  free(pool->freeStack);
+  free(pool->memory);
+  memset(pool, 0, sizeof (*pool));
+}
+
+static inline nx2_packet_t nx2HostPoolAlloc(nx2_host_packet_pool_t *pool) {
+  if (pool->freeCount == 0) {
+    return NULL;
+  }
+  return pool->freeStack[--pool->freeCount];
+}
+
+static inline void nx2HostPoolRelease(nx2_host_packet_pool_t *pool, nx2_packet_t packet) {
+  pool->freeStack[pool->freeCount++] = packet;
+}
+
+//
+// BAR that only stores register writes, for measuring driver-side cost without a device model.
+// Register offsets are limited to those below the kernel mailbox window used by the TX and RX rings.
+//
+#define NX2_HOST_BAR_SIZE         (MB_GET_CID_ADDR(TX_CID + 1))
+
+typedef struct {
+  UInt8                     regs[NX2_HOST_BAR_SIZE];
+  
+  UInt32 readReg32(UInt32 offset) {
+    return *(volatile UInt32*) &regs[offset];
+  }
+  void writeReg16(UInt32 offset, UInt16 value) {
+    *(volatile UInt16*) &regs[offset] = value;
+  }
+  void writeReg32(UInt32 offset, UInt32 value) {
+    *(volatile UInt32*) &regs[offset] = value;
+  }
+} nx2_host_bar_t;
+
+#endif
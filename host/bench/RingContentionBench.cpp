@@ -0,0 +1,181 @@
+/*
+ *
+ * Copyright (c) 2021 Goldfish64
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+//
+// Two-thread TX ring contention benchmark. One thread posts packets as the output thread does,
+// the other reclaims them as the work loop does, each on its own core where available.
+// The doorbell stands in for the device: every posted BD is treated as complete once the doorbell is seen.
+//
+// The cache-line-aligned azul_nx2_tx_ring_t, driven by the ring engine, is compared against the previous
+// flat layout, where the producer and consumer fields and the packet array share cache lines.
+// The flat layout is driven by copies of the engine's post and reclaim loops.
+//
+#include <benchmark/benchmark.h>
+#include <sched.h>
+
+#include "HostPlatform.h"
+
+#define CONTENTION_FRAME_LENGTH   64
+#define CONTENTION_SPIN_YIELD     0x3FF
+
+typedef struct {
+  tx_bd_t                   *chain;
+  UInt16                    prod;
+  UInt16                    cons;
+  UInt32                    prodBufferSize;
+  UInt32                    prodCount;
+  UInt32                    consCount;
+  nx2_packet_t              packets[TX_USABLE_BD_COUNT];
+} nx2_bench_flat_tx_ring_t;
+
+static_assert(offsetof(nx2_bench_flat_tx_ring_t, consCount) < CACHE_LINE_SIZE, "Flat layout must share the index cache line");
+
+static inline void ringInit(azul_nx2_tx_ring_t *ring, tx_bd_t *chain) {
+  nx2TxRingInit(ring, chain, nx2HostPhysAddr(chain));
+}
+
+static inline void ringInit(nx2_bench_flat_tx_ring_t *ring, tx_bd_t *chain) {
+  memset(ring, 0, sizeof (*ring));
+  ring->chain = chain;
+}
+
+static inline UInt16 ringFreeCount(const azul_nx2_tx_ring_t *ring) {
+  return nx2TxRingFreeCount(ring);
+}
+
+static inline UInt16 ringFreeCount(const nx2_bench_flat_tx_ring_t *ring) {
+  return (TX_USABLE_BD_COUNT - 1) - (ring->prodCount - ring->consCount);
+}
+
+static inline void ringPost(azul_nx2_tx_ring_t *ring, const nx2_host_segment_t *segment, nx2_packet_t packet) {
+  nx2TxRingPost(ring, segment, 1, 0, 0, packet);
+}
+
+static inline void ringPost(nx2_bench_flat_tx_ring_t *ring, const nx2_host_segment_t *segment, nx2_packet_t packet) {
+  UInt16 txIndex = TX_BD_INDEX(ring->prod);
+  
+  ring->chain[txIndex].addrHi   = ADDR_HI(segment->location);
+  ring->chain[txIndex].addrLo   = ADDR_LO(segment->location);
+  ring->chain[txIndex].length   = segment->length;
+  ring->chain[txIndex].flags    = TX_BD_FLAGS_START | TX_BD_FLAGS_END;
+  ring->chain[txIndex].vlanTag  = 0;
+  
+  ring->prodBufferSize += segment->length;
+  ring->prod            = TX_NEXT_BD(ring->prod);
+  ring->packets[txIndex] = packet;
+  ring->prodCount++;
+}
+
+template <typename FreePacket>
+static inline UInt32 ringReclaim(azul_nx2_tx_ring_t *ring, UInt16 consNew, FreePacket freePacket) {
+  return nx2TxRingReclaim(ring, consNew, freePacket);
+}
+
+template <typename FreePacket>
+static inline UInt32 ringReclaim(nx2_bench_flat_tx_ring_t *ring, UInt16 consNew, FreePacket freePacket) {
+  UInt16 txIndex;
+  UInt32 count = 0;
+  
+  while (ring->cons != consNew) {
+    txIndex = TX_BD_INDEX(ring->cons);
+    if (ring->packets[txIndex] != NULL) {
+      freePacket(ring->packets[txIndex], txIndex);
+      ring->packets[txIndex] = NULL;
+    }
+    count++;
+    ring->cons = TX_NEXT_BD(ring->cons);
+  }
+  ring->consCount += count;
+  return count;
+}
+
+template <typename Ring>
+struct ContentionPort {
+  Ring                      ring CACHE_LINE_ALIGNED;
+  UInt16                    doorbell CACHE_LINE_ALIGNED;
+  nx2_host_packet_t         packet CACHE_LINE_ALIGNED;
+  tx_bd_t                   *chain;
+};
+
+//
+// Spins with a compiler barrier so fields written by the other thread are reloaded,
+// yielding now and then in case both threads share a core.
+//
+static inline void spinWait(UInt32 *spins) {
+  __asm__ volatile ("" ::: "memory");
+  if ((++*spins & CONTENTION_SPIN_YIELD) == 0) {
+    sched_yield();
+  }
+}
+
+template <typename Ring>
+static void BM_TxContention(benchmark::State &state) {
+  static ContentionPort<Ring> *port;
+  nx2_host_segment_t          segment;
+  UInt32                      spins = 0;
+  UInt64                      reclaimed = 0;
+  
+  if (state.thread_index() == 0) {
+    //
+    // Output thread: set up the port before the loop start barrier, then post one packet per iteration
+    // and ring the doorbell.
+    //
+    port        = (ContentionPort<Ring>*) nx2HostAllocDma(sizeof (ContentionPort<Ring>));
+    port->chain = (tx_bd_t*) nx2HostAllocDma(TX_PAGE_SIZE);
+    ringInit(&port->ring, port->chain);
+    
+    segment.location  = nx2HostPhysAddr(port->chain);
+    segment.length    = CONTENTION_FRAME_LENGTH;
+    for (auto _ : state) {
+      while (ringFreeCount(&port->ring) <= 1) {
+        spinWait(&spins);
+      }
+      ringPost(&port->ring, &segment, &port->packet);
+      __atomic_store_n(&port->doorbell, port->ring.prod, __ATOMIC_RELEASE);
+    }
+  } else {
+    //
+    // Work loop: reclaim one completed packet per iteration.
+    //
+    for (auto _ : state) {
+      while (port->ring.cons == __atomic_load_n(&port->doorbell, __ATOMIC_ACQUIRE)) {
+        spinWait(&spins);
+      }
+      reclaimed += ringReclaim(&port->ring, TX_NEXT_BD(port->ring.cons), [](nx2_packet_t packet, UInt16 txIndex) {
+        benchmark::DoNotOptimize(packet);
+      });
+    }
+  }
+  
+  if (state.thread_index() == 0) {
+    free(port->chain);
+    free(port);
+  }
+  state.SetItemsProcessed(state.iterations());
+  state.counters["spins"] = benchmark::Counter(spins, benchmark::Counter::kAvgIterations);
+}
+BENCHMARK_TEMPLATE(BM_TxContention, azul_nx2_tx_ring_t)->Threads(2)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_TxContention, nx2_bench_flat_tx_ring_t)->Threads(2)->UseRealTime();
+
+BENCHMARK_MAIN();
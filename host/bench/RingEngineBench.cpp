@@ -0,0 +1,151 @@
+/*
+ *
+ * Copyright (c) 2021 Goldfish64
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+//
+// Ring engine benchmarks, in ns per packet for TX fill, TX reclaim and RX harvest with refill.
+// The driver side runs against nx2_host_bar_t, so doorbells are plain stores rather than posted MMIO writes,
+// and the device side is emulated by moving the consumer indexes directly.
+//
+#include <benchmark/benchmark.h>
+
+#include "HostDriver.h"
+
+#define BENCH_BATCH_DEFAULT       256
+#define BENCH_FRAME_LENGTH        64
+
+typedef NX2HostDriver<nx2_host_bar_t> nx2_bench_driver_t;
+
+struct BenchPort {
+  nx2_host_bar_t            *bar;
+  status_block_t            *statusBlock;
+  nx2_bench_driver_t        *driver;
+  
+  BenchPort() {
+    bar         = (nx2_host_bar_t*) nx2HostAllocDma(sizeof (nx2_host_bar_t));
+    statusBlock = (status_block_t*) nx2HostAllocDma(STATUS_BLOCK_SIZE);
+    driver      = (nx2_bench_driver_t*) nx2HostAllocDma(sizeof (nx2_bench_driver_t));
+    if (bar == NULL || statusBlock == NULL || driver == NULL || !driver->init(bar, statusBlock)) {
+      abort();
+    }
+    
+    //
+    // Every RX buffer holds a good frame, as the controller would have written it.
+    //
+    for (UInt32 i = 0; i < driver->rxPool.count; i++) {
+      rx_l2_header_t *l2Header = (rx_l2_header_t*) driver->rxPool.packets[i].data;
+      l2Header->packetLength = BENCH_FRAME_LENGTH + kIOEthernetCRCSize;
+    }
+  }
+  
+  ~BenchPort() {
+    driver->free();
+    free(driver);
+    free(statusBlock);
+    free(bar);
+  }
+  
+  //
+  // Completes all posted RX BDs except count, as if count frames were outstanding in the ring.
+  //
+  UInt16 receive(UInt32 count) {
+    UInt16 cons = driver->rxRing.cons;
+    for (UInt32 i = 0; i < count; i++) {
+      cons = RX_NEXT_BD(cons);
+    }
+    return cons;
+  }
+};
+
+static void setPacketCounter(benchmark::State &state, UInt32 batch) {
+  state.SetItemsProcessed(state.iterations() * batch);
+  state.counters["time/packet"] = benchmark::Counter(state.iterations() * batch,
+                                                     benchmark::Counter::kIsRate | benchmark::Counter::kInvert);
+}
+
+static void postTxBatch(BenchPort &port, UInt32 batch) {
+  for (UInt32 i = 0; i < batch; i++) {
+    port.driver->sendTxPacket(nx2HostPoolAlloc(&port.driver->txPool), BENCH_FRAME_LENGTH);
+  }
+}
+
+//
+// BD fill, barrier and doorbell for each packet, as sendTxPacket() does.
+//
+static void BM_TxFill(benchmark::State &state) {
+  BenchPort     port;
+  UInt32        batch = (UInt32) state.range(0);
+  nx2_packet_t  packets[TX_USABLE_BD_COUNT];
+  
+  for (auto _ : state) {
+    state.PauseTiming();
+    for (UInt32 i = 0; i < batch; i++) {
+      packets[i] = nx2HostPoolAlloc(&port.driver->txPool);
+    }
+    state.ResumeTiming();
+    
+    for (UInt32 i = 0; i < batch; i++) {
+      port.driver->sendTxPacket(packets[i], BENCH_FRAME_LENGTH);
+    }
+    
+    state.PauseTiming();
+    port.driver->handleTxInterrupt(port.driver->txRing.prod);
+    state.ResumeTiming();
+  }
+  setPacketCounter(state, batch);
+}
+BENCHMARK(BM_TxFill)->Arg(32)->Arg(BENCH_BATCH_DEFAULT)->Arg(512);
+
+//
+// Reclaim of a batch of completed single BD packets, as handleTxInterrupt() does.
+//
+static void BM_TxReclaim(benchmark::State &state) {
+  BenchPort     port;
+  UInt32        batch = (UInt32) state.range(0);
+  
+  for (auto _ : state) {
+    state.PauseTiming();
+    postTxBatch(port, batch);
+    state.ResumeTiming();
+    
+    benchmark::DoNotOptimize(port.driver->handleTxInterrupt(port.driver->txRing.prod));
+  }
+  setPacketCounter(state, batch);
+}
+BENCHMARK(BM_TxReclaim)->Arg(32)->Arg(BENCH_BATCH_DEFAULT)->Arg(512);
+
+//
+// Harvest of a batch of received frames, refilling each BD in turn, and the RX doorbell, as handleRxInterrupt() does.
+//
+static void BM_RxHarvest(benchmark::State &state) {
+  BenchPort     port;
+  UInt32        batch = (UInt32) state.range(0);
+  
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(port.driver->handleRxInterrupt(port.receive(batch)));
+  }
+  setPacketCounter(state, batch);
+}
+BENCHMARK(BM_RxHarvest)->Arg(32)->Arg(BENCH_BATCH_DEFAULT)->Arg(512);
+
+BENCHMARK_MAIN();
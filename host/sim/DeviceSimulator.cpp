@@ -0,0 +1,374 @@
+/*
+ *
+ * Copyright (c) 2021 Goldfish64
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include "DeviceSimulator.h"
+
+#define SIM_NO_EVENT    UINT64_MAX
+
+bool NX2DeviceSimulator::init(const nx2_sim_config_t *config) {
+  memset(this, 0, sizeof (*this));
+  this->config  = *config;
+  rxWire        = (nx2_sim_frame_t*) calloc(SIM_WIRE_SLOTS, sizeof (nx2_sim_frame_t));
+  intMasked     = true;
+  return rxWire != NULL && config->lineRateMbps > 0;
+}
+
+void NX2DeviceSimulator::free() {
+  ::free(rxWire);
+  rxWire = NULL;
+}
+
+UInt32 NX2DeviceSimulator::readReg32(UInt32 offset) {
+  if (offset == MB_GET_CID_ADDR(TX_CID) + NX2_L2MQ_TX_HOST_BSEQ) {
+    return txHostBseq;
+  }
+  if (offset == MB_GET_CID_ADDR(RX_CID) + NX2_L2MQ_RX_HOST_BSEQ) {
+    return rxHostBseq;
+  }
+  if (offset == NX2_CTX_DATA) {
+    return contextAddr < SIM_CONTEXT_SIZE ? context[contextAddr / 4] : 0;
+  }
+  return offset < SIM_REG_SIZE ? regs[offset / 4] : 0;
+}
+
+void NX2DeviceSimulator::writeReg16(UInt32 offset, UInt16 value) {
+  if (offset == MB_GET_CID_ADDR(TX_CID) + NX2_L2MQ_TX_HOST_BIDX) {
+    //
+    // BDs up to the new producer are fetched once the doorbell has propagated.
+    //
+    txHostProd  = value;
+    txFetchTime = now + config.dmaLatencyNs;
+  } else if (offset == MB_GET_CID_ADDR(RX_CID) + NX2_L2MQ_RX_HOST_BDIDX) {
+    rxHostProd  = value;
+  }
+}
+
+void NX2DeviceSimulator::writeReg32(UInt32 offset, UInt32 value) {
+  switch (offset) {
+    case MB_GET_CID_ADDR(TX_CID) + NX2_L2MQ_TX_HOST_BSEQ:
+      txHostBseq = value;
+      return;
+      
+    case MB_GET_CID_ADDR(RX_CID) + NX2_L2MQ_RX_HOST_BSEQ:
+      rxHostBseq = value;
+      return;
+      
+    case NX2_CTX_DATA_ADR:
+      contextAddr = value;
+      return;
+      
+    case NX2_CTX_DATA:
+      if (contextAddr < SIM_CONTEXT_SIZE) {
+        context[contextAddr / 4] = value;
+      }
+      return;
+      
+    case NX2_HC_COMMAND:
+      //
+      // Command bits are self-clearing.
+      //
+      if (value & NX2_HC_COMMAND_COAL_NOW) {
+        updateStatusBlock(true);
+      } else if (value & NX2_HC_COMMAND_COAL_NOW_WO_INT) {
+        updateStatusBlock(false);
+      }
+      regs[offset / 4] = value & ~(NX2_HC_COMMAND_COAL_NOW | NX2_HC_COMMAND_COAL_NOW_WO_INT);
+      return;
+      
+    case NX2_HC_STATUS_ADDR_L:
+    case NX2_HC_STATUS_ADDR_H:
+      regs[offset / 4] = value;
+      statusBlock = (status_block_t*) (uintptr_t) (((UInt64) regs[NX2_HC_STATUS_ADDR_H / 4] << 32) |
+                                                   regs[NX2_HC_STATUS_ADDR_L / 4]);
+      return;
+      
+    case NX2_PCICFG_INT_ACK_CMD:
+      if (value & NX2_PCICFG_INT_ACK_CMD_INDEX_VALID) {
+        ackIndex = value & NX2_PCICFG_INT_ACK_CMD_INDEX;
+      }
+      intMasked       = (value & NX2_PCICFG_INT_ACK_CMD_MASK_INT) != 0;
+      intUseIntParams = (value & NX2_PCICFG_INT_ACK_CMD_USE_INT_HC_PARAM) != 0;
+      checkInterrupt();
+      return;
+      
+    default:
+      if (offset < SIM_REG_SIZE) {
+        regs[offset / 4] = value;
+      }
+      return;
+  }
+}
+
+UInt64 NX2DeviceSimulator::getHcDeadline() {
+  UInt64 deadline = SIM_NO_EVENT;
+  UInt32 ticks;
+  
+  if (pendingTx > 0) {
+    ticks = getHcParam(NX2_HC_TX_TICKS);
+    if (ticks > 0) {
+      deadline = pendingTxSince + ticks * 1000ULL;
+    }
+  }
+  if (pendingRx > 0) {
+    ticks = getHcParam(NX2_HC_RX_TICKS);
+    if (ticks > 0 && pendingRxSince + ticks * 1000ULL < deadline) {
+      deadline = pendingRxSince + ticks * 1000ULL;
+    }
+  }
+  return deadline;
+}
+
+UInt64 NX2DeviceSimulator::getNextEventTime() {
+  UInt64 next = SIM_NO_EVENT;
+  UInt64 time;
+  
+  if (txFrameActive) {
+    next = txFrameEnd;
+  } else if (isTxPending()) {
+    next = txFetchTime > now ? txFetchTime : now;
+  }
+  
+  //
+  // Generated frames are queued one at a time so the wire queue stays short.
+  //
+  if (rxWireCount == 0 && rxGenRemaining > 0) {
+    queueRxFrame(NULL, rxGenLength);
+    rxGenRemaining--;
+  }
+  if (rxWireCount > 0 && rxWire[rxWireHead].time < next) {
+    next = rxWire[rxWireHead].time;
+  }
+  
+  time = getHcDeadline();
+  if (time < next) {
+    next = time;
+  }
+  if (intPending && intTime < next) {
+    next = intTime;
+  }
+  return next;
+}
+
+bool NX2DeviceSimulator::step() {
+  UInt64 next = getNextEventTime();
+  if (next == SIM_NO_EVENT) {
+    return false;
+  }
+  if (next > now) {
+    now = next;
+  }
+  
+  if (txFrameActive && txFrameEnd <= now) {
+    completeTxFrame();
+  } else if (!txFrameActive && isTxPending() && txFetchTime <= now) {
+    startTxFrame();
+  } else if (rxWireCount > 0 && rxWire[rxWireHead].time <= now) {
+    deliverRxFrame();
+  } else if (getHcDeadline() <= now) {
+    updateStatusBlock(true);
+  } else if (intPending && intTime <= now) {
+    intPending = false;
+    if (!intMasked && statusIndex != ackIndex && interrupt != NULL) {
+      stats.interrupts++;
+      interrupt(interruptContext);
+    }
+  }
+  return true;
+}
+
+void NX2DeviceSimulator::advance(UInt64 ns) {
+  UInt64 target = now + ns;
+  
+  while (getNextEventTime() <= target) {
+    step();
+  }
+  now = target;
+}
+
+bool NX2DeviceSimulator::receiveFrame(const UInt8 *data, UInt16 length) {
+  return queueRxFrame(data, length);
+}
+
+void NX2DeviceSimulator::generateRxFrames(UInt16 length, UInt64 count) {
+  rxGenLength     = length;
+  rxGenRemaining  = count;
+}
+
+/**
+ Reads the BDs of the next frame and puts it on the wire.
+ */
+void NX2DeviceSimulator::startTxFrame() {
+  tx_bd_t *chain = (tx_bd_t*) getContextAddr(TX_CID, NX2_L2CTX_TX_TBDR_BHADDR_HI, NX2_L2CTX_TX_TBDR_BHADDR_LO);
+  UInt32  length = 0;
+  UInt16  cons   = txCons;
+  UInt16  flags;
+  
+  do {
+    flags   = chain[TX_BD_INDEX(cons)].flags;
+    length += chain[TX_BD_INDEX(cons)].length;
+    cons    = TX_NEXT_BD(cons);
+  } while (!(flags & TX_BD_FLAGS_END) && cons != txHostProd);
+  
+  txFrameCons   = cons;
+  txFrameEnd    = (txFrameEnd > now ? txFrameEnd : now) + getWireTime(length);
+  txFrameActive = true;
+}
+
+void NX2DeviceSimulator::completeTxFrame() {
+  tx_bd_t *chain  = (tx_bd_t*) getContextAddr(TX_CID, NX2_L2CTX_TX_TBDR_BHADDR_HI, NX2_L2CTX_TX_TBDR_BHADDR_LO);
+  tx_bd_t *bd     = &chain[TX_BD_INDEX(txCons)];
+  UInt32  bds     = 0;
+  UInt32  length  = 0;
+  
+  //
+  // Frames are looped back from their first BD, which holds the whole frame for single BD packets.
+  //
+  if (config.loopback) {
+    queueRxFrame((const UInt8*) (uintptr_t) (((UInt64) bd->addrHi << 32) | bd->addrLo), bd->length);
+  }
+  
+  while (txCons != txFrameCons) {
+    length += chain[TX_BD_INDEX(txCons)].length;
+    txCons = TX_NEXT_BD(txCons);
+    bds++;
+  }
+  
+  txFrameActive = false;
+  stats.txFrames++;
+  stats.txBytes += length;
+  
+  if (pendingTx == 0) {
+    pendingTxSince = now;
+  }
+  pendingTx += bds;
+  checkHcTrip();
+}
+
+bool NX2DeviceSimulator::queueRxFrame(const UInt8 *data, UInt16 length) {
+  nx2_sim_frame_t *frame;
+  
+  if (rxWireCount == SIM_WIRE_SLOTS || length > MAX_PACKET_SIZE) {
+    return false;
+  }
+  
+  if (rxWireFree < now) {
+    rxWireFree = now;
+  }
+  rxWireFree += getWireTime(length);
+  
+  frame         = &rxWire[(rxWireHead + rxWireCount) % SIM_WIRE_SLOTS];
+  frame->time   = rxWireFree + config.dmaLatencyNs;
+  frame->length = length;
+  if (data != NULL) {
+    memcpy(frame->data, data, length);
+  } else {
+    memset(frame->data, 0xFF, kIOEthernetAddressSize * 2);
+  }
+  rxWireCount++;
+  return true;
+}
+
+/**
+ Writes the frame at the head of the wire into the next posted RX BD.
+ */
+void NX2DeviceSimulator::deliverRxFrame() {
+  nx2_sim_frame_t *frame  = &rxWire[rxWireHead];
+  rx_bd_t         *chain  = (rx_bd_t*) getContextAddr(RX_CID, NX2_L2CTX_RX_NX_BDHADDR_HI, NX2_L2CTX_RX_NX_BDHADDR_LO);
+  rx_bd_t         *bd;
+  UInt8           *buffer;
+  rx_l2_header_t  *l2Header;
+  
+  rxWireHead = (rxWireHead + 1) % SIM_WIRE_SLOTS;
+  rxWireCount--;
+  
+  if (chain == NULL || rxCons == rxHostProd) {
+    stats.rxNoBuffer++;
+    return;
+  }
+  
+  bd      = &chain[RX_BD_INDEX(rxCons)];
+  buffer  = (UInt8*) (uintptr_t) (((UInt64) bd->addrHi << 32) | bd->addrLo);
+  if (bd->length < sizeof (rx_l2_header_t) + RX_HEADER_PAD + frame->length + kIOEthernetCRCSize) {
+    stats.rxNoBuffer++;
+    return;
+  }
+  
+  l2Header                  = (rx_l2_header_t*) buffer;
+  memset(l2Header, 0, sizeof (*l2Header));
+  l2Header->packetLength    = frame->length + kIOEthernetCRCSize;
+  if (config.rxErrorInterval != 0 && (stats.rxFrames + 1) % config.rxErrorInterval == 0) {
+    l2Header->errors        = L2_FHDR_ERRORS_BAD_CRC;
+    stats.rxErrors++;
+  }
+  memcpy(buffer + sizeof (rx_l2_header_t) + RX_HEADER_PAD, frame->data, frame->length);
+  
+  rxCons = RX_NEXT_BD(rxCons);
+  stats.rxFrames++;
+  stats.rxBytes += frame->length;
+  
+  if (pendingRx == 0) {
+    pendingRxSince = now;
+  }
+  pendingRx++;
+  checkHcTrip();
+}
+
+/**
+ Updates the status block once either quick consumer trip count is reached.
+ With neither ticks nor trips set, every completion is reported immediately.
+ */
+void NX2DeviceSimulator::checkHcTrip() {
+  UInt32 txTrip   = getHcParam(NX2_HC_TX_QUICK_CONS_TRIP);
+  UInt32 rxTrip   = getHcParam(NX2_HC_RX_QUICK_CONS_TRIP);
+  bool   txUpdate = pendingTx > 0 && (txTrip > 0 ? pendingTx >= txTrip : getHcParam(NX2_HC_TX_TICKS) == 0);
+  bool   rxUpdate = pendingRx > 0 && (rxTrip > 0 ? pendingRx >= rxTrip : getHcParam(NX2_HC_RX_TICKS) == 0);
+  
+  if (txUpdate || rxUpdate) {
+    updateStatusBlock(true);
+  }
+}
+
+void NX2DeviceSimulator::updateStatusBlock(bool raiseInterrupt) {
+  statusIndex++;
+  if (statusBlock != NULL) {
+    __atomic_store_n(&statusBlock->txConsumer0, txCons, __ATOMIC_RELAXED);
+    __atomic_store_n(&statusBlock->rxConsumer0, rxCons, __ATOMIC_RELAXED);
+    __atomic_store_n(&statusBlock->index, statusIndex, __ATOMIC_RELEASE);
+  }
+  
+  pendingTx = 0;
+  pendingRx = 0;
+  stats.statusUpdates++;
+  
+  if (raiseInterrupt) {
+    checkInterrupt();
+  }
+}
+
+void NX2DeviceSimulator::checkInterrupt() {
+  if (!intMasked && !intPending && statusIndex != ackIndex) {
+    intPending  = true;
+    intTime     = now + config.interruptLatencyNs;
+  }
+}
@@ -0,0 +1,183 @@
+/*
+ *
+ * Copyright (c) 2021 Goldfish64
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef __DEVICE_SIMULATOR_H__
+#define __DEVICE_SIMULATOR_H__
+
+#include "HostPlatform.h"
+
+//
+// Behavioral model of the NetXtreme II device side, for running the driver's TX and RX paths on Linux.
+// NX2HostDriver drives it through the ring engine's doorbells, consumer index reads, RX harvest and
+// interrupt mask/ack, the same code the kext runs.
+// Implements the contract described in RingEngine.h on a virtual nanosecond clock, so simulated time
+// only advances when the caller asks and the driver code runs at full speed between steps:
+//   - BAR0 writes: kernel mailboxes (NX2_L2MQ_TX_HOST_BIDX/BSEQ, NX2_L2MQ_RX_HOST_BDIDX/BSEQ),
+//     the 5706/5708 context window (NX2_CTX_DATA_ADR/NX2_CTX_DATA), NX2_HC_* coalescing registers,
+//     NX2_HC_COMMAND coalesce-now and NX2_PCICFG_INT_ACK_CMD.
+//   - TX: once a doorbell is seen, BDs are fetched after dmaLatencyNs and each frame occupies the wire
+//     for its length plus CRC, preamble and inter-frame gap at lineRateMbps. The consumer index moves
+//     past the frame's BDs when it leaves the wire.
+//   - RX: frames arrive at line rate from the receive generator or from TX in loopback mode, and are
+//     written to the next posted BD after dmaLatencyNs with an rx_l2_header_t and pad in front.
+//     A frame arriving with no posted BD is dropped. With rxErrorInterval set, every rxErrorInterval'th
+//     frame delivered is written with L2_FHDR_ERRORS_BAD_CRC.
+//   - Status block: host coalescing writes txConsumer0, rxConsumer0 and an incremented index to the
+//     address in NX2_HC_STATUS_ADDR once the TX or RX quick consumer trip count is reached, or the
+//     tick count in microseconds has passed since the first unreported completion.
+//     The _INT halves of the tick and trip registers apply while the interrupt handler has USE_INT_HC_PARAM set.
+//   - Interrupts: raised interruptLatencyNs after a status block update if not masked. Acking with
+//     an index older than the status block raises another, as the hardware does.
+//
+#define SIM_REG_SIZE              0x7000
+#define SIM_CONTEXT_SIZE          GET_CID_ADDR(96)
+#define SIM_WIRE_SLOTS            1024
+#define SIM_WIRE_OVERHEAD         (kIOEthernetCRCSize + 8 + 12)
+
+typedef struct {
+  UInt32                    lineRateMbps;
+  UInt64                    dmaLatencyNs;
+  UInt64                    interruptLatencyNs;
+  bool                      loopback;
+  UInt32                    rxErrorInterval;
+} nx2_sim_config_t;
+
+typedef struct {
+  UInt64                    txFrames;
+  UInt64                    txBytes;
+  UInt64                    rxFrames;
+  UInt64                    rxBytes;
+  UInt64                    rxNoBuffer;
+  UInt64                    rxErrors;
+  UInt64                    statusUpdates;
+  UInt64                    interrupts;
+} nx2_sim_stats_t;
+
+typedef void (*nx2_sim_interrupt_t)(void *context);
+
+typedef struct {
+  UInt64                    time;
+  UInt16                    length;
+  UInt8                     data[MAX_PACKET_SIZE];
+} nx2_sim_frame_t;
+
+class NX2DeviceSimulator {
+public:
+  nx2_sim_config_t          config;
+  nx2_sim_stats_t           stats;
+  
+  nx2_sim_interrupt_t       interrupt;
+  void                      *interruptContext;
+  
+  bool init(const nx2_sim_config_t *config);
+  void free();
+  
+  //
+  // BAR0.
+  //
+  UInt32 readReg32(UInt32 offset);
+  void writeReg16(UInt32 offset, UInt16 value);
+  void writeReg32(UInt32 offset, UInt32 value);
+  
+  //
+  // Simulated time. Events due within the step are processed in order,
+  // including interrupts, which call the interrupt handler synchronously.
+  //
+  inline UInt64 getTime() const {
+    return now;
+  }
+  UInt64 getNextEventTime();
+  void advance(UInt64 ns);
+  bool step();
+  
+  //
+  // Receive traffic. Frames are queued on the wire back to back at line rate.
+  //
+  bool receiveFrame(const UInt8 *data, UInt16 length);
+  void generateRxFrames(UInt16 length, UInt64 count);
+  
+private:
+  UInt64                    now;
+  UInt32                    regs[SIM_REG_SIZE / 4];
+  UInt32                    context[SIM_CONTEXT_SIZE / 4];
+  UInt32                    contextAddr;
+  
+  UInt16                    txHostProd;
+  UInt32                    txHostBseq;
+  UInt64                    txFetchTime;
+  UInt16                    txCons;
+  UInt16                    txFrameCons;
+  UInt64                    txFrameEnd;
+  bool                      txFrameActive;
+  
+  UInt16                    rxHostProd;
+  UInt32                    rxHostBseq;
+  UInt16                    rxCons;
+  nx2_sim_frame_t           *rxWire;
+  UInt32                    rxWireHead;
+  UInt32                    rxWireCount;
+  UInt64                    rxWireFree;
+  UInt16                    rxGenLength;
+  UInt64                    rxGenRemaining;
+  
+  status_block_t            *statusBlock;
+  UInt16                    statusIndex;
+  UInt32                    pendingTx;
+  UInt32                    pendingRx;
+  UInt64                    pendingTxSince;
+  UInt64                    pendingRxSince;
+  
+  UInt16                    ackIndex;
+  bool                      intMasked;
+  bool                      intUseIntParams;
+  bool                      intPending;
+  UInt64                    intTime;
+  
+  inline UInt32 getHcParam(UInt32 offset) {
+    UInt32 reg = regs[offset / 4];
+    return intUseIntParams ? (reg >> 16) & 0x3FF : reg & 0x3FF;
+  }
+  inline UInt64 getWireTime(UInt32 length) {
+    return ((UInt64) (length + SIM_WIRE_OVERHEAD) * 8000) / config.lineRateMbps;
+  }
+  inline void *getContextAddr(UInt32 cid, UInt32 hiOffset, UInt32 loOffset) {
+    UInt64 addr = ((UInt64) context[(GET_CID_ADDR(cid) + hiOffset) / 4] << 32) | context[(GET_CID_ADDR(cid) + loOffset) / 4];
+    return (void*) (uintptr_t) addr;
+  }
+  
+  inline bool isTxPending() {
+    return txCons != txHostProd && getContextAddr(TX_CID, NX2_L2CTX_TX_TBDR_BHADDR_HI, NX2_L2CTX_TX_TBDR_BHADDR_LO) != NULL;
+  }
+  
+  UInt64 getHcDeadline();
+  void startTxFrame();
+  void completeTxFrame();
+  void deliverRxFrame();
+  bool queueRxFrame(const UInt8 *data, UInt16 length);
+  void checkHcTrip();
+  void updateStatusBlock(bool raiseInterrupt);
+  void checkInterrupt();
+};
+
+#endif
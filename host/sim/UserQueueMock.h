@@ -0,0 +1,357 @@
+/*
+ *
+ * Copyright (c) 2021 Goldfish64
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __USER_QUEUE_MOCK_H__
+#define __USER_QUEUE_MOCK_H__
+
+//
+// Mock of both ends of the bypass shared-queue protocol in UserQueue.h, so it can be tested without the kext.
+//   - NX2UserDriverMock runs the driver end through the same UserQueue.h helpers as Bypass.cpp, on real
+//     ring engine rings. A minimal device stands in for the controller: it writes received frames into
+//     posted RX BDs and completes TX BDs on request, moving its consumer indexes as the hardware would.
+//   - NX2UserProcessMock is a well-behaved process. It tracks which side owns each buffer, and counts
+//     any buffer handed back that it already owned as a protocol error.
+// Frames carry a sequence number in their first four bytes, so each side can check order and contents.
+//
+#include <vector>
+
+#include "HostPlatform.h"
+
+//
+// Every frame takes one BD, and one BD is always left free.
+//
+#define NX2_USER_MOCK_TX_CAPACITY   (TX_USABLE_BD_COUNT - 2)
+
+static inline UInt8 *nx2UserMockBuffer(UInt8 *buffers, UInt32 buffer) {
+  return buffers + (size_t) buffer * NX2_USER_BUFFER_SIZE;
+}
+
+template <typename Bd>
+static inline UInt8 *nx2UserMockBdBuffer(const Bd *bd) {
+  return (UInt8*) (uintptr_t) (((UInt64) bd->addrHi << 32) | bd->addrLo);
+}
+
+class NX2UserDriverMock {
+public:
+  nx2_user_shared_t         *shared;
+  nx2_host_bar_t            *bar;
+  tx_bd_t                   *txChain;
+  rx_bd_t                   *rxChain;
+  azul_nx2_tx_ring_t        *txRing;
+  azul_nx2_rx_ring_t        *rxRing;
+  nx2_user_rings_t          rings;
+  
+  UInt16                    hwTxCons;
+  UInt16                    hwRxCons;
+  UInt32                    rxSequence;
+  UInt32                    txSequence;
+  UInt64                    txOutOfOrder;
+  
+  NX2UserDriverMock(nx2_user_shared_t *shared, UInt8 *buffers) : shared(shared) {
+    bar     = (nx2_host_bar_t*) nx2HostAllocDma(sizeof (nx2_host_bar_t));
+    txChain = (tx_bd_t*) nx2HostAllocDma(TX_PAGE_SIZE);
+    rxChain = (rx_bd_t*) nx2HostAllocDma(RX_PAGE_SIZE);
+    txRing  = (azul_nx2_tx_ring_t*) nx2HostAllocDma(sizeof (azul_nx2_tx_ring_t));
+    rxRing  = (azul_nx2_rx_ring_t*) nx2HostAllocDma(sizeof (azul_nx2_rx_ring_t));
+    if (bar == NULL || txChain == NULL || rxChain == NULL || txRing == NULL || rxRing == NULL) {
+      abort();
+    }
+    
+    memset(&rings, 0, sizeof (rings));
+    rings.buffers         = buffers;
+    rings.buffersPhysAddr = nx2HostPhysAddr(buffers);
+    reset(0);
+  }
+  
+  ~NX2UserDriverMock() {
+    ::free(rxRing);
+    ::free(txRing);
+    ::free(rxChain);
+    ::free(txChain);
+    ::free(bar);
+  }
+  
+  //
+  // Empties all queues and rings as resetBypassQueues() and a controller reset do.
+  // Indexes start at start, so tests can run them across the 32-bit wrap.
+  //
+  void reset(UInt32 start) {
+    memset(shared, 0, sizeof (*shared));
+    shared->version       = NX2_USER_QUEUE_VERSION;
+    shared->bufferCount   = NX2_USER_BUFFER_COUNT;
+    shared->bufferSize    = NX2_USER_BUFFER_SIZE;
+    shared->rxDataOffset  = sizeof (rx_l2_header_t) + RX_HEADER_PAD;
+    
+    shared->rxFill.prod     = shared->rxFill.cons     = start;
+    shared->rxComplete.prod = shared->rxComplete.cons = start;
+    shared->txSubmit.prod   = shared->txSubmit.cons   = start;
+    shared->txComplete.prod = shared->txComplete.cons = start;
+    rings.rxFillCons      = start;
+    rings.rxCompleteProd  = start;
+    rings.txSubmitCons    = start;
+    rings.txCompleteProd  = start;
+    rings.rxPosted        = 0;
+    
+    rings.rxFrames    = 0;
+    rings.rxDropped   = 0;
+    rings.rxRejected  = 0;
+    rings.txFrames    = 0;
+    rings.txRejected  = 0;
+    
+    nx2TxRingInit(txRing, txChain, nx2HostPhysAddr(txChain));
+    nx2RxRingInit(rxRing, rxChain, nx2HostPhysAddr(rxChain));
+    hwTxCons      = 0;
+    hwRxCons      = 0;
+    rxSequence    = 0;
+    txSequence    = 0;
+    txOutOfOrder  = 0;
+  }
+  
+  //
+  // Moves rxFill entries to the RX ring, as kickBypass() does.
+  //
+  UInt32 fillRx() {
+    UInt32 posted = nx2UserFillRx(shared, &rings, rxRing);
+    if (posted > 0) {
+      nx2RxRingDoorbell(bar, rxRing);
+    }
+    return posted;
+  }
+  
+  //
+  // Receives up to count frames of length into posted BDs, then harvests them as handleBypassRxInterrupt() does.
+  // Reposted and refilled BDs are used as they appear, until count frames are received or none are posted.
+  //
+  UInt32 receive(UInt32 count, UInt16 length) {
+    UInt32          received = 0;
+    UInt32          batch;
+    UInt8           *buffer;
+    rx_l2_header_t  *l2Header;
+    
+    while (received < count) {
+      for (batch = 0; received + batch < count && hwRxCons != rxRing->prod; batch++) {
+        buffer    = nx2UserMockBdBuffer(&rxChain[RX_BD_INDEX(hwRxCons)]);
+        l2Header  = (rx_l2_header_t*) buffer;
+        memset(l2Header, 0, sizeof (*l2Header));
+        l2Header->packetLength = length + kIOEthernetCRCSize;
+        memcpy(buffer + shared->rxDataOffset, &rxSequence, sizeof (rxSequence));
+        rxSequence++;
+        hwRxCons = RX_NEXT_BD(hwRxCons);
+      }
+      if (batch == 0) {
+        break;
+      }
+      received += batch;
+      
+      nx2UserHarvestRx(shared, &rings, rxRing, hwRxCons, [](UInt16 rxIndex, rx_l2_header_t *l2Header) { });
+      nx2RxRingDoorbell(bar, rxRing);
+    }
+    return received;
+  }
+  
+  //
+  // Moves txSubmit entries to the TX ring, as postBypassTxFrames() does.
+  //
+  UInt32 postTx() {
+    UInt32 posted = nx2UserPostTx(shared, &rings, txRing, [](UInt16 txIndex, UInt32 buffer) { });
+    if (posted > 0) {
+      nx2TxRingDoorbell(bar, txRing);
+    }
+    return posted;
+  }
+  
+  //
+  // Sends up to count posted frames, checking their contents, then reclaims them as handleBypassTxInterrupt() does.
+  //
+  UInt32 completeTx(UInt32 count) {
+    UInt32 completed = 0;
+    UInt32 sequence;
+    
+    while (completed < count && hwTxCons != txRing->prod) {
+      memcpy(&sequence, nx2UserMockBdBuffer(&txChain[TX_BD_INDEX(hwTxCons)]), sizeof (sequence));
+      if (sequence != txSequence) {
+        txOutOfOrder++;
+      }
+      txSequence = sequence + 1;
+      hwTxCons = TX_NEXT_BD(hwTxCons);
+      completed++;
+    }
+    
+    nx2UserReclaimTx(shared, &rings, txRing, hwTxCons, [](UInt16 txIndex) { });
+    return completed;
+  }
+};
+
+class NX2UserProcessMock {
+public:
+  nx2_user_shared_t         *shared;
+  UInt8                     *buffers;
+  
+  UInt32                    rxFillProd;
+  UInt32                    rxCompleteCons;
+  UInt32                    txSubmitProd;
+  UInt32                    txCompleteCons;
+  std::vector<UInt32>       freeBuffers;
+  std::vector<bool>         owned;
+  
+  UInt32                    rxSequence;
+  UInt32                    txSequence;
+  UInt64                    rxFrames;
+  UInt64                    rxOutOfOrder;
+  UInt64                    txCompleted;
+  UInt64                    txErrors;
+  UInt64                    protocolErrors;
+  
+  NX2UserProcessMock(nx2_user_shared_t *shared, UInt8 *buffers) : shared(shared), buffers(buffers) {
+    reset();
+  }
+  
+  //
+  // Takes the indexes from the shared region and reclaims every buffer, as after a detach.
+  //
+  void reset() {
+    rxFillProd      = shared->rxFill.prod;
+    rxCompleteCons  = shared->rxComplete.cons;
+    txSubmitProd    = shared->txSubmit.prod;
+    txCompleteCons  = shared->txComplete.cons;
+    
+    freeBuffers.clear();
+    for (UInt32 i = NX2_USER_BUFFER_COUNT; i > 0; i--) {
+      freeBuffers.push_back(i - 1);
+    }
+    owned.assign(NX2_USER_BUFFER_COUNT, true);
+    
+    rxSequence      = 0;
+    txSequence      = 0;
+    rxFrames        = 0;
+    rxOutOfOrder    = 0;
+    txCompleted     = 0;
+    txErrors        = 0;
+    protocolErrors  = 0;
+  }
+  
+  UInt32 ownedCount() const {
+    return (UInt32) freeBuffers.size();
+  }
+  
+  //
+  // Takes back a buffer from the driver. Returns false if the buffer could not have been handed out.
+  //
+  bool reclaim(UInt32 buffer) {
+    if (buffer >= NX2_USER_BUFFER_COUNT || owned[buffer]) {
+      protocolErrors++;
+      return false;
+    }
+    owned[buffer] = true;
+    freeBuffers.push_back(buffer);
+    return true;
+  }
+  
+  UInt32 fillRx(UInt32 count) {
+    UInt32 filled = 0;
+    
+    while (filled < count && !freeBuffers.empty() &&
+           nx2UserQueuePush(&shared->rxFill, &rxFillProd, freeBuffers.back(), 0, 0)) {
+      owned[freeBuffers.back()] = false;
+      freeBuffers.pop_back();
+      filled++;
+    }
+    nx2UserQueueReleaseProd(&shared->rxFill, rxFillProd);
+    return filled;
+  }
+  
+  UInt32 receive() {
+    nx2_user_desc_t desc;
+    UInt32          available;
+    UInt32          sequence;
+    UInt32          received = 0;
+    
+    available = nx2UserQueueAvailable(&shared->rxComplete, rxCompleteCons);
+    while (available > 0) {
+      desc = nx2UserQueueRead(&shared->rxComplete, rxCompleteCons);
+      rxCompleteCons++;
+      available--;
+      
+      if (!reclaim(desc.buffer)) {
+        continue;
+      }
+      memcpy(&sequence, nx2UserMockBuffer(buffers, desc.buffer) + shared->rxDataOffset, sizeof (sequence));
+      if (sequence != rxSequence) {
+        rxOutOfOrder++;
+      }
+      rxSequence = sequence + 1;
+      rxFrames++;
+      received++;
+    }
+    
+    nx2UserQueueReleaseCons(&shared->rxComplete, rxCompleteCons);
+    return received;
+  }
+  
+  //
+  // Submits up to count frames of length. Frames carry the next sequence number.
+  //
+  UInt32 submitTx(UInt32 count, UInt16 length) {
+    UInt32 submitted = 0;
+    UInt32 buffer;
+    
+    while (submitted < count && !freeBuffers.empty() && nx2UserQueueSpace(&shared->txSubmit, txSubmitProd) > 0) {
+      buffer = freeBuffers.back();
+      freeBuffers.pop_back();
+      owned[buffer] = false;
+      
+      memcpy(nx2UserMockBuffer(buffers, buffer), &txSequence, sizeof (txSequence));
+      txSequence++;
+      nx2UserQueuePush(&shared->txSubmit, &txSubmitProd, buffer, length, 0);
+      submitted++;
+    }
+    nx2UserQueueReleaseProd(&shared->txSubmit, txSubmitProd);
+    return submitted;
+  }
+  
+  UInt32 reapTx() {
+    nx2_user_desc_t desc;
+    UInt32          available;
+    UInt32          reaped = 0;
+    
+    available = nx2UserQueueAvailable(&shared->txComplete, txCompleteCons);
+    while (available > 0) {
+      desc = nx2UserQueueRead(&shared->txComplete, txCompleteCons);
+      txCompleteCons++;
+      available--;
+      
+      if (desc.flags & NX2_USER_DESC_FLAG_ERROR) {
+        txErrors++;
+      }
+      if (reclaim(desc.buffer)) {
+        txCompleted++;
+        reaped++;
+      }
+    }
+    
+    nx2UserQueueReleaseCons(&shared->txComplete, txCompleteCons);
+    return reaped;
+  }
+};
+
+#endif
@@ -0,0 +1,286 @@
+/*
+ *
+ * Copyright (c) 2021 Goldfish64
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <gtest/gtest.h>
+
+#include "HostDriver.h"
+#include "DeviceSimulator.h"
+
+#define TEST_FRAME_SIZE   1000
+#define TEST_WIRE_NS      ((TEST_FRAME_SIZE + SIM_WIRE_OVERHEAD) * 8)
+#define TEST_DMA_NS       1000
+#define TEST_INT_NS       2000
+#define TEST_ERROR_EVERY  7
+
+//
+// Driver running against the simulator at 1 Gbps, with the interrupt handler wired up.
+// TX post, reclaim, RX harvest and the interrupt pass go through the ring engine helpers the kext uses.
+//
+class DeviceSimulatorTest : public ::testing::Test {
+protected:
+  NX2DeviceSimulator                  sim;
+  NX2HostDriver<NX2DeviceSimulator>   *driver;
+  status_block_t                      *statusBlock;
+  UInt64                              rxMatched;
+  UInt64                              rxMismatched;
+  
+  void SetUp() override {
+    SetUp(false, 0);
+  }
+  
+  void SetUp(bool loopback, UInt32 rxErrorInterval) {
+    nx2_sim_config_t config = { 1000, TEST_DMA_NS, TEST_INT_NS, loopback, rxErrorInterval };
+    
+    ASSERT_TRUE(sim.init(&config));
+    statusBlock = (status_block_t*) nx2HostAllocDma(STATUS_BLOCK_SIZE);
+    driver      = (NX2HostDriver<NX2DeviceSimulator>*) nx2HostAllocDma(sizeof (*driver));
+    ASSERT_NE(statusBlock, nullptr);
+    ASSERT_NE(driver, nullptr);
+    ASSERT_TRUE(driver->init(&sim, statusBlock));
+    
+    sim.interrupt           = [](void *context) { ((NX2HostDriver<NX2DeviceSimulator>*) context)->interruptOccurred(); };
+    sim.interruptContext    = driver;
+    driver->rxInput         = checkRxFrame;
+    driver->rxInputContext  = this;
+    rxMatched               = 0;
+    rxMismatched            = 0;
+  }
+  
+  void TearDown() override {
+    driver->free();
+    sim.free();
+    ::free(driver);
+    ::free(statusBlock);
+  }
+  
+  //
+  // Frames carry their sequence number in the first byte of the payload after the addresses.
+  //
+  bool sendFrame(UInt8 sequence) {
+    nx2_packet_t packet = nx2HostPoolAlloc(&driver->txPool);
+    if (packet == NULL) {
+      return false;
+    }
+    
+    memset(packet->data, sequence, TEST_FRAME_SIZE);
+    if (!driver->sendTxPacket(packet, TEST_FRAME_SIZE)) {
+      nx2HostPoolRelease(&driver->txPool, packet);
+      return false;
+    }
+    return true;
+  }
+  
+  static void checkRxFrame(void *context, nx2_packet_t packet, UInt16 packetLength) {
+    DeviceSimulatorTest *test = (DeviceSimulatorTest*) context;
+    UInt8               *data = packet->data + sizeof (rx_l2_header_t) + RX_HEADER_PAD;
+    bool                matched = packetLength == TEST_FRAME_SIZE;
+    
+    for (UInt32 i = 1; matched && i < packetLength; i++) {
+      matched = data[i] == data[0];
+    }
+    if (matched) {
+      test->rxMatched++;
+    } else {
+      test->rxMismatched++;
+    }
+  }
+  
+  void runUntilIdle() {
+    while (sim.step()) { }
+  }
+};
+
+class DeviceSimulatorLoopbackTest : public DeviceSimulatorTest {
+protected:
+  void SetUp() override {
+    DeviceSimulatorTest::SetUp(true, 0);
+  }
+};
+
+class DeviceSimulatorRxErrorTest : public DeviceSimulatorTest {
+protected:
+  void SetUp() override {
+    DeviceSimulatorTest::SetUp(true, TEST_ERROR_EVERY);
+  }
+};
+
+TEST_F(DeviceSimulatorTest, TxCompletesAfterFetchAndWireTime) {
+  driver->initTxRxRegs(0, 1, 0, 1);
+  driver->enableInterrupts(false);
+  
+  ASSERT_TRUE(sendFrame(1));
+  sim.advance(TEST_DMA_NS + TEST_WIRE_NS - 1);
+  EXPECT_EQ(statusBlock->index, 0);
+  
+  sim.advance(1);
+  EXPECT_EQ(statusBlock->index, 1);
+  EXPECT_EQ(statusBlock->txConsumer0, 1);
+  EXPECT_EQ(driver->interruptWork.passes, 0u);
+  
+  sim.advance(TEST_INT_NS);
+  EXPECT_EQ(driver->interruptWork.passes, 1u);
+  EXPECT_EQ(driver->txRing.cons, 1);
+  EXPECT_EQ(driver->txPool.freeCount, (UInt32) HOST_TX_POOL_COUNT);
+}
+
+TEST_F(DeviceSimulatorTest, TxFramesAreSerializedOnTheWire) {
+  driver->initTxRxRegs(0, 1, 0, 1);
+  
+  for (UInt8 i = 0; i < 4; i++) {
+    ASSERT_TRUE(sendFrame(i));
+  }
+  sim.advance(TEST_DMA_NS + (TEST_WIRE_NS * 4) - 1);
+  EXPECT_EQ(sim.stats.txFrames, 3u);
+  
+  sim.advance(1);
+  EXPECT_EQ(sim.stats.txFrames, 4u);
+  EXPECT_EQ(statusBlock->txConsumer0, 4);
+}
+
+TEST_F(DeviceSimulatorTest, TripCountCoalescesStatusUpdates) {
+  driver->initTxRxRegs(1000, 4, 1000, 4);
+  driver->enableInterrupts(false);
+  
+  for (UInt8 i = 0; i < 3; i++) {
+    ASSERT_TRUE(sendFrame(i));
+  }
+  sim.advance(TEST_DMA_NS + (TEST_WIRE_NS * 3));
+  EXPECT_EQ(sim.stats.statusUpdates, 0u);
+  
+  ASSERT_TRUE(sendFrame(3));
+  runUntilIdle();
+  EXPECT_EQ(sim.stats.statusUpdates, 1u);
+  EXPECT_EQ(sim.stats.interrupts, 1u);
+  EXPECT_EQ(statusBlock->txConsumer0, 4);
+  EXPECT_EQ(driver->txRing.cons, 4);
+}
+
+TEST_F(DeviceSimulatorTest, TicksFlushBelowTripCount) {
+  driver->initTxRxRegs(50, 100, 50, 100);
+  driver->enableInterrupts(false);
+  
+  ASSERT_TRUE(sendFrame(1));
+  sim.advance(TEST_DMA_NS + TEST_WIRE_NS + (50 * 1000) - 1);
+  EXPECT_EQ(sim.stats.statusUpdates, 0u);
+  
+  sim.advance(1);
+  EXPECT_EQ(sim.stats.statusUpdates, 1u);
+  EXPECT_EQ(statusBlock->txConsumer0, 1);
+}
+
+TEST_F(DeviceSimulatorTest, MaskedInterruptFiresOnStaleAck) {
+  driver->initTxRxRegs(0, 1, 0, 1);
+  
+  ASSERT_TRUE(sendFrame(1));
+  runUntilIdle();
+  EXPECT_EQ(statusBlock->index, 1);
+  EXPECT_EQ(sim.stats.interrupts, 0u);
+  
+  //
+  // Unmasking with the index last seen by the driver raises the interrupt for the missed update.
+  //
+  driver->enableInterrupts(false);
+  runUntilIdle();
+  EXPECT_EQ(sim.stats.interrupts, 1u);
+  EXPECT_EQ(driver->lastStatusIndex, 1);
+  EXPECT_EQ(driver->txRing.cons, 1);
+}
+
+TEST_F(DeviceSimulatorTest, CoalesceNowRaisesInterrupt) {
+  driver->enableInterrupts(true);
+  runUntilIdle();
+  EXPECT_EQ(sim.stats.statusUpdates, 1u);
+  EXPECT_EQ(sim.stats.interrupts, 1u);
+  EXPECT_EQ(driver->interruptWork.passes, 1u);
+}
+
+TEST_F(DeviceSimulatorTest, RxDropsWithoutPostedBuffers) {
+  driver->initTxRxRegs(0, 1, 0, 1);
+  
+  //
+  // Interrupts stay masked, so nothing is refilled and every frame past the posted BDs is dropped.
+  //
+  sim.generateRxFrames(64, RX_USABLE_BD_COUNT + 100);
+  runUntilIdle();
+  EXPECT_EQ(sim.stats.rxFrames, (UInt64) RX_USABLE_BD_COUNT);
+  EXPECT_EQ(sim.stats.rxNoBuffer, 100u);
+  
+  driver->enableInterrupts(false);
+  runUntilIdle();
+  EXPECT_EQ(driver->rxPackets, (UInt64) RX_USABLE_BD_COUNT);
+  EXPECT_EQ(driver->rxErrors, 0u);
+}
+
+TEST_F(DeviceSimulatorLoopbackTest, FramesSurviveLoopback) {
+  UInt32 sent = 0;
+  
+  driver->initTxRxRegs(TX_INT_TICKS, TX_QUICK_CONS_TRIP, RX_INT_TICKS, RX_QUICK_CONS_TRIP);
+  driver->enableInterrupts(false);
+  
+  //
+  // Sends more frames than either ring holds, so both wrap and the driver has to keep up.
+  //
+  while (sent < RX_USABLE_BD_COUNT * 3) {
+    if (sendFrame((UInt8) sent)) {
+      sent++;
+    } else {
+      ASSERT_TRUE(sim.step());
+    }
+  }
+  runUntilIdle();
+  
+  EXPECT_EQ(sim.stats.txFrames, (UInt64) sent);
+  EXPECT_EQ(sim.stats.rxNoBuffer, 0u);
+  EXPECT_EQ(rxMatched, (UInt64) sent);
+  EXPECT_EQ(rxMismatched, 0u);
+  EXPECT_EQ(driver->txPool.freeCount, (UInt32) HOST_TX_POOL_COUNT);
+  EXPECT_LT(sim.stats.interrupts, (UInt64) sent);
+}
+
+//
+// Frames with errors are counted and never reach rxInput. Their buffers are reposted in place,
+// so the ring keeps up across several wraps and no pool packets are taken for them.
+//
+TEST_F(DeviceSimulatorRxErrorTest, RxErrorsReuseTheirBuffer) {
+  UInt32 sent = 0;
+  
+  driver->initTxRxRegs(TX_INT_TICKS, TX_QUICK_CONS_TRIP, RX_INT_TICKS, RX_QUICK_CONS_TRIP);
+  driver->enableInterrupts(false);
+  
+  while (sent < RX_USABLE_BD_COUNT * 3) {
+    if (sendFrame((UInt8) sent)) {
+      sent++;
+    } else {
+      ASSERT_TRUE(sim.step());
+    }
+  }
+  runUntilIdle();
+  
+  EXPECT_EQ(sim.stats.rxNoBuffer, 0u);
+  EXPECT_EQ(sim.stats.rxErrors, (UInt64) sent / TEST_ERROR_EVERY);
+  EXPECT_EQ(driver->rxErrors, sim.stats.rxErrors);
+  EXPECT_EQ(driver->rxPackets, sent - sim.stats.rxErrors);
+  EXPECT_EQ(rxMatched, driver->rxPackets);
+  EXPECT_EQ(rxMismatched, 0u);
+  EXPECT_EQ(driver->rxPool.freeCount, (UInt32) (HOST_RX_POOL_COUNT - RX_USABLE_BD_COUNT));
+}
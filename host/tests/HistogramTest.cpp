@@ -0,0 +1,135 @@
+/*
+ *
+ * Copyright (c) 2021 Goldfish64
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <gtest/gtest.h>
+
+#include "HostDriver.h"
+#include "DeviceSimulator.h"
+
+TEST(HistogramTest, BucketsAreLog2) {
+  EXPECT_EQ(nx2HistogramGetBucket(0), 0u);
+  EXPECT_EQ(nx2HistogramGetBucket(1), 1u);
+  EXPECT_EQ(nx2HistogramGetBucket(2), 2u);
+  EXPECT_EQ(nx2HistogramGetBucket(3), 2u);
+  EXPECT_EQ(nx2HistogramGetBucket(4), 3u);
+  EXPECT_EQ(nx2HistogramGetBucket(1023), 10u);
+  EXPECT_EQ(nx2HistogramGetBucket(1024), 11u);
+  EXPECT_EQ(nx2HistogramGetBucket(1ULL << (HISTOGRAM_BUCKETS - 2)), (UInt32) HISTOGRAM_BUCKETS - 1);
+}
+
+TEST(HistogramTest, LargeValuesClampToLastBucket) {
+  EXPECT_EQ(nx2HistogramGetBucket(1ULL << (HISTOGRAM_BUCKETS - 1)), (UInt32) HISTOGRAM_BUCKETS - 1);
+  EXPECT_EQ(nx2HistogramGetBucket(UINT64_MAX), (UInt32) HISTOGRAM_BUCKETS - 1);
+}
+
+TEST(HistogramTest, RecordKeepsCountAndSum) {
+  azul_nx2_histogram_t histogram;
+  
+  memset(&histogram, 0, sizeof (histogram));
+  nx2HistogramRecord(&histogram, 0);
+  nx2HistogramRecord(&histogram, 5);
+  nx2HistogramRecord(&histogram, 6);
+  nx2HistogramRecord(&histogram, 1ULL << 40);
+  
+  EXPECT_EQ(histogram.count, 4u);
+  EXPECT_EQ(histogram.sum, 11u + (1ULL << 40));
+  EXPECT_EQ(histogram.buckets[0], 1u);
+  EXPECT_EQ(histogram.buckets[3], 2u);
+  EXPECT_EQ(histogram.buckets[HISTOGRAM_BUCKETS - 1], 1u);
+}
+
+TEST(HistogramTest, IdlePassesHaveNoWork) {
+  azul_nx2_work_stats_t work;
+  
+  memset(&work, 0, sizeof (work));
+  nx2WorkRecordPass(&work, false, 0, 0, 1, 0);
+  nx2WorkRecordPass(&work, true, 0, 0, 2, 1);
+  nx2WorkRecordPass(&work, false, 4, 0, 3, 2);
+  nx2WorkRecordPass(&work, false, 0, 8, 4, 3);
+  
+  EXPECT_EQ(work.passes, 4u);
+  EXPECT_EQ(work.idlePasses, 1u);
+  EXPECT_EQ(work.histograms[kWorkTxReclaimed].count, 4u);
+  EXPECT_EQ(work.histograms[kWorkTxReclaimed].buckets[0], 3u);
+  EXPECT_EQ(work.histograms[kWorkTxReclaimed].buckets[3], 1u);
+  EXPECT_EQ(work.histograms[kWorkRxPackets].sum, 8u);
+  EXPECT_EQ(work.histograms[kWorkRxPackets].buckets[4], 1u);
+}
+
+TEST(HistogramTest, StatusDeltaWraps) {
+  azul_nx2_work_stats_t work;
+  
+  memset(&work, 0, sizeof (work));
+  nx2WorkRecordPass(&work, false, 1, 0, 0x0001, 0xFFFE);
+  EXPECT_EQ(work.histograms[kWorkStatusDelta].sum, 3u);
+  EXPECT_EQ(work.histograms[kWorkStatusDelta].buckets[2], 1u);
+}
+
+//
+// Interrupt passes of the host driver against the simulator, as the kext accounts them.
+//
+TEST(HistogramTest, DriverPassesAgainstSimulator) {
+  nx2_sim_config_t                  config = { 1000, 1000, 2000, false };
+  NX2DeviceSimulator                sim;
+  NX2HostDriver<NX2DeviceSimulator> *driver;
+  status_block_t                    *statusBlock;
+  nx2_packet_t                      packet;
+  
+  ASSERT_TRUE(sim.init(&config));
+  statusBlock = (status_block_t*) nx2HostAllocDma(STATUS_BLOCK_SIZE);
+  driver      = (NX2HostDriver<NX2DeviceSimulator>*) nx2HostAllocDma(sizeof (*driver));
+  ASSERT_NE(statusBlock, nullptr);
+  ASSERT_NE(driver, nullptr);
+  ASSERT_TRUE(driver->init(&sim, statusBlock));
+  sim.interrupt         = [](void *context) { ((NX2HostDriver<NX2DeviceSimulator>*) context)->interruptOccurred(); };
+  sim.interruptContext  = driver;
+  driver->initTxRxRegs(0, 1, 0, 1);
+  
+  //
+  // Coalesce-now with nothing completed is an idle pass.
+  //
+  driver->enableInterrupts(true);
+  while (sim.step()) { }
+  EXPECT_EQ(driver->interruptWork.passes, 1u);
+  EXPECT_EQ(driver->interruptWork.idlePasses, 1u);
+  
+  //
+  // Two frames completing with a trip count of one are each reported by their own status update.
+  //
+  for (UInt32 i = 0; i < 2; i++) {
+    packet = nx2HostPoolAlloc(&driver->txPool);
+    ASSERT_NE(packet, nullptr);
+    ASSERT_TRUE(driver->sendTxPacket(packet, 64));
+  }
+  while (sim.step()) { }
+  
+  EXPECT_EQ(driver->interruptWork.idlePasses, 1u);
+  EXPECT_EQ(driver->interruptWork.histograms[kWorkTxReclaimed].sum, 2u);
+  EXPECT_EQ(driver->interruptWork.histograms[kWorkStatusDelta].sum, sim.stats.statusUpdates);
+  EXPECT_EQ(driver->interruptWork.passes, sim.stats.interrupts);
+  
+  driver->free();
+  sim.free();
+  free(driver);
+  free(statusBlock);
+}
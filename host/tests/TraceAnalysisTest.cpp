@@ -0,0 +1,132 @@
+/*
+ *
+ * Copyright (c) 2021 Goldfish64
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <gtest/gtest.h>
+
+#include "TraceAnalysis.h"
+
+static void addEntry(std::vector<azul_nx2_reg_trace_entry_t> &entries, UInt64 timestamp,
+                     azul_nx2_reg_trace_type_t type, UInt32 offset, UInt32 value) {
+  azul_nx2_reg_trace_entry_t entry;
+  
+  memset(&entry, 0, sizeof (entry));
+  entry.timestamp = timestamp;
+  entry.type      = type;
+  entry.offset    = offset;
+  entry.value     = value;
+  entries.push_back(entry);
+}
+
+TEST(TraceAnalysisTest, ParsesIoregOutput) {
+  std::vector<azul_nx2_reg_trace_entry_t> entries;
+  std::string                             input = "  |   \"RegisterTraceData\" = <";
+  const char                              *hex = "0123456789ABCDEF";
+  const UInt8                             *bytes;
+  
+  addEntry(entries, 1000, kRegTraceWrite32, NX2_HC_COMMAND, 0x10001);
+  bytes = (const UInt8*) entries.data();
+  for (size_t i = 0; i < sizeof (azul_nx2_reg_trace_entry_t); i++) {
+    input.push_back(hex[bytes[i] >> 4]);
+    input.push_back(hex[bytes[i] & 0xF]);
+  }
+  input += ">\n";
+  
+  entries.clear();
+  ASSERT_TRUE(nx2TraceParse(input, entries));
+  ASSERT_EQ(entries.size(), 1u);
+  EXPECT_EQ(entries[0].timestamp, 1000u);
+  EXPECT_EQ(entries[0].type, (UInt32) kRegTraceWrite32);
+  EXPECT_EQ(entries[0].offset, (UInt32) NX2_HC_COMMAND);
+  EXPECT_EQ(entries[0].value, 0x10001u);
+  
+  EXPECT_FALSE(nx2TraceParse(std::string("\"RegisterTraceData\" = <0>"), entries));
+  EXPECT_FALSE(nx2TraceParse(std::string(3, '\0'), entries));
+}
+
+TEST(TraceAnalysisTest, FindsRedundantWrites) {
+  std::vector<azul_nx2_reg_trace_entry_t> entries;
+  std::vector<nx2_trace_write_stats_t>    results;
+  
+  //
+  // Rewrite of the same value, then a read showing the hardware changed it, then a write of the old value.
+  //
+  addEntry(entries, 0, kRegTraceWrite32, 0x100, 5);
+  addEntry(entries, 1, kRegTraceWrite32, 0x100, 5);
+  addEntry(entries, 2, kRegTraceRead32, 0x100, 7);
+  addEntry(entries, 3, kRegTraceWrite32, 0x100, 5);
+  
+  //
+  // Read-modify-write that changed nothing, and the same offset in the PHY space kept apart.
+  //
+  addEntry(entries, 4, kRegTraceRead32, 0x200, 9);
+  addEntry(entries, 5, kRegTraceWrite32, 0x200, 9);
+  addEntry(entries, 6, kRegTraceWritePhy16, 0x100, 5);
+  
+  //
+  // Repeated commands and doorbells are not redundant.
+  //
+  addEntry(entries, 7, kRegTraceWrite32, NX2_HC_COMMAND, NX2_HC_COMMAND_COAL_NOW);
+  addEntry(entries, 8, kRegTraceWrite32, NX2_HC_COMMAND, NX2_HC_COMMAND_COAL_NOW);
+  addEntry(entries, 9, kRegTraceWrite16, MB_GET_CID_ADDR(TX_CID) + NX2_L2MQ_TX_HOST_BIDX, 1);
+  addEntry(entries, 10, kRegTraceWrite16, MB_GET_CID_ADDR(TX_CID) + NX2_L2MQ_TX_HOST_BIDX, 1);
+  
+  nx2TraceFindRedundantWrites(entries, results);
+  ASSERT_EQ(results.size(), 2u);
+  for (const nx2_trace_write_stats_t &stats : results) {
+    EXPECT_EQ(stats.space, kTraceSpaceMmio);
+    if (stats.offset == 0x100) {
+      EXPECT_EQ(stats.writes, 3u);
+      EXPECT_EQ(stats.rewrites, 1u);
+      EXPECT_EQ(stats.writesAfterRead, 0u);
+    } else {
+      EXPECT_EQ(stats.offset, 0x200u);
+      EXPECT_EQ(stats.writesAfterRead, 1u);
+    }
+  }
+}
+
+TEST(TraceAnalysisTest, FindsPollsAndGaps) {
+  std::vector<azul_nx2_reg_trace_entry_t> entries;
+  std::vector<nx2_trace_phase_t>          results;
+  
+  addEntry(entries, 0, kRegTraceWrite32, 0x100, 1);
+  for (UInt32 i = 0; i < 10; i++) {
+    addEntry(entries, 1000 + (i * 1000), kRegTraceRead32, 0x104, i == 9);
+  }
+  addEntry(entries, 500000, kRegTraceWrite32, 0x108, 1);
+  addEntry(entries, 501000, kRegTraceRead32, 0x10C, 0);
+  addEntry(entries, 502000, kRegTraceRead32, 0x10C, 0);
+  
+  nx2TraceFindSlowPhases(entries, TRACE_GAP_DEFAULT_NS, TRACE_POLL_DEFAULT_READS, results);
+  ASSERT_EQ(results.size(), 2u);
+  
+  EXPECT_EQ(results[0].type, kTracePhaseGap);
+  EXPECT_EQ(results[0].first, 10u);
+  EXPECT_EQ(results[0].duration, 490000u);
+  
+  EXPECT_EQ(results[1].type, kTracePhasePoll);
+  EXPECT_EQ(results[1].first, 1u);
+  EXPECT_EQ(results[1].last, 10u);
+  EXPECT_EQ(results[1].offset, 0x104u);
+  EXPECT_EQ(results[1].duration, 9000u);
+}
@@ -0,0 +1,277 @@
+/*
+ *
+ * Copyright (c) 2021 Goldfish64
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <gtest/gtest.h>
+#include <atomic>
+#include <thread>
+
+#include "UserQueueMock.h"
+
+#define TEST_FRAME_SIZE   1000
+#define TEST_WRAP_START   0xFFFFFF00
+
+//
+// Driver and process ends sharing one queue region and buffer area.
+//
+class UserQueueTest : public ::testing::Test {
+protected:
+  nx2_user_shared_t     *shared;
+  UInt8                 *buffers;
+  NX2UserDriverMock     *driver;
+  NX2UserProcessMock    *process;
+  
+  void SetUp() override {
+    shared  = (nx2_user_shared_t*) nx2HostAllocDma(sizeof (*shared));
+    buffers = (UInt8*) nx2HostAllocDma((size_t) NX2_USER_BUFFER_COUNT * NX2_USER_BUFFER_SIZE);
+    ASSERT_NE(shared, nullptr);
+    ASSERT_NE(buffers, nullptr);
+    
+    driver  = new NX2UserDriverMock(shared, buffers);
+    process = new NX2UserProcessMock(shared, buffers);
+  }
+  
+  void TearDown() override {
+    delete process;
+    delete driver;
+    free(buffers);
+    free(shared);
+  }
+  
+  void resetAt(UInt32 start) {
+    driver->reset(start);
+    process->reset();
+  }
+  
+  //
+  // Checks that every buffer is back with the process and nothing was handed back twice.
+  //
+  void expectAllReturned() {
+    EXPECT_EQ(process->ownedCount(), (UInt32) NX2_USER_BUFFER_COUNT);
+    EXPECT_EQ(process->protocolErrors, 0u);
+  }
+};
+
+//
+// Many times the queue size worth of frames each way, with the indexes crossing the 32-bit wrap.
+//
+TEST_F(UserQueueTest, RoundTripAcrossWrap) {
+  resetAt(TEST_WRAP_START);
+  
+  process->fillRx(NX2_USER_BUFFER_COUNT / 2);
+  driver->fillRx();
+  for (UInt32 i = 0; i < 64; i++) {
+    driver->receive(37, TEST_FRAME_SIZE);
+    process->receive();
+    process->fillRx(37);
+    
+    process->submitTx(41, TEST_FRAME_SIZE);
+    driver->postTx();
+    driver->completeTx(41);
+    process->reapTx();
+  }
+  EXPECT_LT(shared->rxComplete.prod, TEST_WRAP_START);
+  EXPECT_LT(shared->txComplete.prod, TEST_WRAP_START);
+  
+  EXPECT_EQ(driver->rings.rxFrames, 64u * 37);
+  EXPECT_EQ(process->rxFrames, 64u * 37);
+  EXPECT_EQ(process->rxOutOfOrder, 0u);
+  EXPECT_EQ(driver->rings.txFrames, 64u * 41);
+  EXPECT_EQ(driver->txOutOfOrder, 0u);
+  EXPECT_EQ(process->txCompleted, 64u * 41);
+  EXPECT_EQ(process->txErrors, 0u);
+  EXPECT_EQ(driver->rings.rxDropped + driver->rings.rxRejected + driver->rings.txRejected, 0u);
+  
+  //
+  // Detaching returns the buffers still posted for receive or waiting on rxFill.
+  //
+  EXPECT_EQ(process->ownedCount() + driver->rings.rxPosted + nx2UserQueueAvailable(&shared->rxFill, driver->rings.rxFillCons),
+            (UInt32) NX2_USER_BUFFER_COUNT);
+  EXPECT_EQ(process->protocolErrors, 0u);
+}
+
+//
+// A producer index more than a queue ahead of the consumer is garbage, and the queue is read as empty.
+//
+TEST_F(UserQueueTest, UntrustedProducerIndex) {
+  resetAt(TEST_WRAP_START);
+  
+  process->submitTx(4, TEST_FRAME_SIZE);
+  shared->txSubmit.prod = TEST_WRAP_START + NX2_USER_QUEUE_SIZE + 1;
+  EXPECT_EQ(nx2UserQueueAvailable(&shared->txSubmit, driver->rings.txSubmitCons), 0u);
+  EXPECT_EQ(driver->postTx(), 0u);
+  
+  shared->rxFill.prod = TEST_WRAP_START - 1;
+  EXPECT_EQ(driver->fillRx(), 0u);
+  EXPECT_EQ(shared->rxFill.cons, TEST_WRAP_START);
+  
+  //
+  // A full queue is still accepted.
+  //
+  shared->txSubmit.prod = TEST_WRAP_START + NX2_USER_QUEUE_SIZE;
+  EXPECT_EQ(nx2UserQueueAvailable(&shared->txSubmit, driver->rings.txSubmitCons), (UInt32) NX2_USER_QUEUE_SIZE);
+}
+
+//
+// A consumer index that does not fit the queue leaves the driver no space, so frames are dropped rather than
+// overwriting entries, and their buffers go back on the RX ring.
+//
+TEST_F(UserQueueTest, UntrustedConsumerIndex) {
+  resetAt(0);
+  
+  process->fillRx(16);
+  driver->fillRx();
+  shared->rxComplete.cons = 0x80000000;
+  EXPECT_EQ(nx2UserQueueSpace(&shared->rxComplete, driver->rings.rxCompleteProd), 0u);
+  
+  driver->receive(8, TEST_FRAME_SIZE);
+  EXPECT_EQ(driver->rings.rxFrames, 0u);
+  EXPECT_EQ(driver->rings.rxDropped, 8u);
+  EXPECT_EQ(shared->rxComplete.prod, 0u);
+  EXPECT_EQ(driver->rings.rxPosted, 16u);
+  
+  shared->rxComplete.cons = process->rxCompleteCons;
+  driver->receive(8, TEST_FRAME_SIZE);
+  EXPECT_EQ(process->receive(), 8u);
+  EXPECT_EQ(process->protocolErrors, 0u);
+}
+
+//
+// Out of range buffer indexes are skipped on rxFill. On txSubmit they, and bad lengths, come back as errors.
+//
+TEST_F(UserQueueTest, RejectedBuffers) {
+  resetAt(TEST_WRAP_START);
+  
+  nx2UserQueuePush(&shared->rxFill, &process->rxFillProd, NX2_USER_BUFFER_COUNT, 0, 0);
+  nx2UserQueuePush(&shared->rxFill, &process->rxFillProd, 0xFFFFFFFF, 0, 0);
+  process->fillRx(2);
+  EXPECT_EQ(driver->fillRx(), 2u);
+  EXPECT_EQ(driver->rings.rxRejected, 2u);
+  EXPECT_EQ(shared->rxFill.cons, shared->rxFill.prod);
+  
+  process->submitTx(1, TEST_FRAME_SIZE);
+  nx2UserQueuePush(&shared->txSubmit, &process->txSubmitProd, NX2_USER_BUFFER_COUNT, TEST_FRAME_SIZE, 0);
+  process->submitTx(1, NX2_USER_TX_MIN_LENGTH - 1);
+  process->submitTx(1, NX2_USER_TX_MAX_LENGTH + 1);
+  process->submitTx(1, NX2_USER_TX_MAX_LENGTH);
+  
+  EXPECT_EQ(driver->postTx(), 2u);
+  EXPECT_EQ(driver->rings.txRejected, 3u);
+  driver->completeTx(2);
+  EXPECT_EQ(process->reapTx(), 4u);
+  EXPECT_EQ(process->txErrors, 3u);
+  
+  //
+  // The rejected out of range index is handed back as given, and the process refuses it.
+  //
+  EXPECT_EQ(process->protocolErrors, 1u);
+  EXPECT_EQ(process->ownedCount() + driver->rings.rxPosted, (UInt32) NX2_USER_BUFFER_COUNT);
+}
+
+//
+// Each side stops at a full queue or ring and picks up where it left off once there is room.
+//
+TEST_F(UserQueueTest, FullQueues) {
+  resetAt(TEST_WRAP_START);
+  
+  //
+  // rxComplete fills when the process stops reading. The driver drops frames but keeps its buffers posted.
+  //
+  process->fillRx(NX2_USER_BUFFER_COUNT);
+  EXPECT_EQ(driver->fillRx(), (UInt32) NX2_USER_BUFFER_COUNT);
+  EXPECT_EQ(nx2UserQueueSpace(&shared->rxFill, process->rxFillProd), (UInt32) NX2_USER_QUEUE_SIZE);
+  
+  driver->receive(NX2_USER_QUEUE_SIZE + 10, TEST_FRAME_SIZE);
+  EXPECT_EQ(driver->rings.rxFrames, (UInt64) NX2_USER_QUEUE_SIZE);
+  EXPECT_EQ(driver->rings.rxDropped, 0u);
+  EXPECT_EQ(nx2UserQueueSpace(&shared->rxComplete, driver->rings.rxCompleteProd), 0u);
+  
+  EXPECT_EQ(process->receive(), (UInt32) NX2_USER_QUEUE_SIZE);
+  EXPECT_EQ(process->rxOutOfOrder, 0u);
+  expectAllReturned();
+  
+  //
+  // txSubmit fills when the driver is not kicked.
+  //
+  EXPECT_EQ(process->submitTx(NX2_USER_BUFFER_COUNT + 1, TEST_FRAME_SIZE), (UInt32) NX2_USER_BUFFER_COUNT);
+  EXPECT_EQ(nx2UserQueueSpace(&shared->txSubmit, process->txSubmitProd), 0u);
+  EXPECT_EQ(driver->postTx(), (UInt32) NX2_USER_BUFFER_COUNT);
+  
+  //
+  // The TX ring has more BDs than there are buffers, so only a process submitting buffers it no longer owns
+  // can fill it. The driver takes what fits and leaves the rest queued.
+  //
+  for (UInt32 i = 0; i < NX2_USER_QUEUE_SIZE; i++) {
+    nx2UserQueuePush(&shared->txSubmit, &process->txSubmitProd, i, TEST_FRAME_SIZE, 0);
+  }
+  nx2UserQueueReleaseProd(&shared->txSubmit, process->txSubmitProd);
+  
+  EXPECT_EQ(driver->postTx(), (UInt32) (NX2_USER_MOCK_TX_CAPACITY - NX2_USER_BUFFER_COUNT));
+  EXPECT_EQ(driver->postTx(), 0u);
+  EXPECT_EQ(nx2UserQueueAvailable(&shared->txSubmit, driver->rings.txSubmitCons),
+            (UInt32) (NX2_USER_QUEUE_SIZE + NX2_USER_BUFFER_COUNT - NX2_USER_MOCK_TX_CAPACITY));
+  
+  //
+  // Completions are reaped a queue at a time, so none are dropped. The resubmitted buffers come back as protocol errors.
+  //
+  while (driver->completeTx(NX2_USER_QUEUE_SIZE) > 0) {
+    process->reapTx();
+    driver->postTx();
+  }
+  process->reapTx();
+  EXPECT_EQ(driver->rings.txFrames, (UInt64) (NX2_USER_BUFFER_COUNT + NX2_USER_QUEUE_SIZE));
+  EXPECT_EQ(process->txCompleted, (UInt64) NX2_USER_BUFFER_COUNT);
+  EXPECT_EQ(process->protocolErrors, (UInt64) NX2_USER_QUEUE_SIZE);
+  EXPECT_EQ(process->ownedCount(), (UInt32) NX2_USER_BUFFER_COUNT);
+}
+
+//
+// Driver and process on their own threads, as they are in practice, passing frames through txSubmit and txComplete.
+//
+TEST_F(UserQueueTest, ConcurrentTx) {
+  std::atomic<bool> done(false);
+  const UInt64      frameCount = 50000;
+  
+  resetAt(TEST_WRAP_START);
+  
+  std::thread driverThread([&]() {
+    while (!done.load(std::memory_order_acquire)) {
+      driver->postTx();
+      driver->completeTx(NX2_USER_MOCK_TX_CAPACITY);
+    }
+  });
+  
+  UInt64 submitted = 0;
+  while (process->txCompleted < frameCount) {
+    if (submitted < frameCount) {
+      submitted += process->submitTx((UInt32) std::min<UInt64>(64, frameCount - submitted), TEST_FRAME_SIZE);
+    }
+    process->reapTx();
+  }
+  done.store(true, std::memory_order_release);
+  driverThread.join();
+  
+  EXPECT_EQ(driver->rings.txFrames, frameCount);
+  EXPECT_EQ(driver->txOutOfOrder, 0u);
+  EXPECT_EQ(process->txErrors, 0u);
+  expectAllReturned();
+}
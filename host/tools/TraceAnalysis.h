@@ -0,0 +1,245 @@
+/*
+ *
+ * Copyright (c) 2021 Goldfish64
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __TRACE_ANALYSIS_H__
+#define __TRACE_ANALYSIS_H__
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "HostPlatform.h"
+
+//
+// Analysis of a RegisterTraceData snapshot, as published by the driver:
+//   - Redundant writes: writes of the value the register was last written with, or last read as.
+//     The first are removable outright; the second are read-modify-write sequences that changed nothing.
+//     Command registers and mailboxes act on every write and are never counted.
+//   - Slow phases: polling loops (runs of reads of one register) and gaps between accesses, longest first.
+//     Gaps are usually IODelay/IOSleep calls or firmware handshakes.
+// Register spaces are kept apart, so MMIO, indirect and PHY offsets never alias.
+//
+#define TRACE_GAP_DEFAULT_NS      100000
+#define TRACE_POLL_DEFAULT_READS  4
+
+typedef enum {
+  kTraceSpaceMmio = 0,
+  kTraceSpaceIndirect,
+  kTraceSpacePhy,
+  kTraceSpaceCount
+} nx2_trace_space_t;
+
+typedef enum {
+  kTracePhasePoll = 0,
+  kTracePhaseGap
+} nx2_trace_phase_type_t;
+
+typedef struct {
+  nx2_trace_space_t         space;
+  UInt32                    offset;
+  UInt32                    writes;
+  UInt32                    rewrites;
+  UInt32                    writesAfterRead;
+} nx2_trace_write_stats_t;
+
+typedef struct {
+  nx2_trace_phase_type_t    type;
+  UInt32                    first;
+  UInt32                    last;
+  UInt64                    duration;
+  nx2_trace_space_t         space;
+  UInt32                    offset;
+} nx2_trace_phase_t;
+
+static inline bool nx2TraceIsWrite(const azul_nx2_reg_trace_entry_t *entry) {
+  return entry->type >= kRegTraceWrite16;
+}
+
+static inline nx2_trace_space_t nx2TraceGetSpace(const azul_nx2_reg_trace_entry_t *entry) {
+  switch (entry->type) {
+    case kRegTraceReadIndr32:
+    case kRegTraceWriteIndr32:
+      return kTraceSpaceIndirect;
+    case kRegTraceReadPhy16:
+    case kRegTraceWritePhy16:
+      return kTraceSpacePhy;
+    default:
+      return kTraceSpaceMmio;
+  }
+}
+
+static inline bool nx2TraceIsCommand(const azul_nx2_reg_trace_entry_t *entry) {
+  if (nx2TraceGetSpace(entry) != kTraceSpaceMmio) {
+    return false;
+  }
+  
+  switch (entry->offset) {
+    case NX2_PCICFG_INT_ACK_CMD:
+    case NX2_MISC_COMMAND:
+    case NX2_EMAC_MDIO_COMM:
+    case NX2_MQ_COMMAND:
+    case NX2_TBDR_COMMAND:
+    case NX2_HC_COMMAND:
+      return true;
+    default:
+      return entry->offset >= MB_GET_CID_ADDR(0);
+  }
+}
+
+static inline UInt64 nx2TraceGetKey(const azul_nx2_reg_trace_entry_t *entry) {
+  return ((UInt64) nx2TraceGetSpace(entry) << 32) | entry->offset;
+}
+
+//
+// Parses either the raw property bytes or ioreg output containing "RegisterTraceData" = <hex>.
+//
+static bool nx2TraceParse(const std::string &input, std::vector<azul_nx2_reg_trace_entry_t> &entries) {
+  std::string bytes;
+  size_t      start;
+  size_t      end;
+  
+  start = input.find("\"RegisterTraceData\"");
+  if (start != std::string::npos) {
+    start = input.find('<', start);
+    end   = start != std::string::npos ? input.find('>', start) : std::string::npos;
+    if (end == std::string::npos || (end - start - 1) % 2 != 0) {
+      return false;
+    }
+    
+    for (size_t i = start + 1; i < end; i += 2) {
+      char hex[3] = { input[i], input[i + 1], '\0' };
+      char *hexEnd;
+      bytes.push_back((char) strtoul(hex, &hexEnd, 16));
+      if (*hexEnd != '\0') {
+        return false;
+      }
+    }
+  } else {
+    bytes = input;
+  }
+  
+  if (bytes.size() % sizeof (azul_nx2_reg_trace_entry_t) != 0) {
+    return false;
+  }
+  entries.resize(bytes.size() / sizeof (azul_nx2_reg_trace_entry_t));
+  memcpy(entries.data(), bytes.data(), bytes.size());
+  return true;
+}
+
+static void nx2TraceFindRedundantWrites(const std::vector<azul_nx2_reg_trace_entry_t> &entries,
+                                        std::vector<nx2_trace_write_stats_t> &results) {
+  struct RegState {
+    bool    written;
+    bool    read;
+    UInt32  lastWrite;
+    UInt32  lastRead;
+    nx2_trace_write_stats_t stats;
+  };
+  std::map<UInt64, RegState> regs;
+  
+  for (const azul_nx2_reg_trace_entry_t &entry : entries) {
+    RegState &reg = regs[nx2TraceGetKey(&entry)];
+    reg.stats.space   = nx2TraceGetSpace(&entry);
+    reg.stats.offset  = entry.offset;
+    
+    if (!nx2TraceIsWrite(&entry)) {
+      reg.read      = true;
+      reg.lastRead  = entry.value;
+      
+      //
+      // A read that differs from the last write means the hardware changed the register,
+      // so a later write of the old value is not redundant.
+      //
+      if (reg.written && reg.lastWrite != entry.value) {
+        reg.written = false;
+      }
+      continue;
+    }
+    
+    reg.stats.writes++;
+    if (nx2TraceIsCommand(&entry)) {
+      continue;
+    }
+    if (reg.written && reg.lastWrite == entry.value) {
+      reg.stats.rewrites++;
+    } else if (reg.read && reg.lastRead == entry.value) {
+      reg.stats.writesAfterRead++;
+    }
+    reg.written   = true;
+    reg.read      = false;
+    reg.lastWrite = entry.value;
+  }
+  
+  results.clear();
+  for (const auto &reg : regs) {
+    if (reg.second.stats.rewrites > 0 || reg.second.stats.writesAfterRead > 0) {
+      results.push_back(reg.second.stats);
+    }
+  }
+  std::sort(results.begin(), results.end(), [](const nx2_trace_write_stats_t &a, const nx2_trace_write_stats_t &b) {
+    return (a.rewrites + a.writesAfterRead) > (b.rewrites + b.writesAfterRead);
+  });
+}
+
+static void nx2TraceFindSlowPhases(const std::vector<azul_nx2_reg_trace_entry_t> &entries, UInt64 gapNs, UInt32 pollReads,
+                                   std::vector<nx2_trace_phase_t> &results) {
+  nx2_trace_phase_t phase;
+  UInt32            runStart = 0;
+  
+  results.clear();
+  for (UInt32 i = 1; i <= entries.size(); i++) {
+    //
+    // A polling run ends at the first access that is not a read of the same register.
+    //
+    if (i == entries.size() || nx2TraceIsWrite(&entries[i]) || nx2TraceIsWrite(&entries[runStart]) ||
+        nx2TraceGetKey(&entries[i]) != nx2TraceGetKey(&entries[runStart])) {
+      if (i - runStart >= pollReads) {
+        phase.type      = kTracePhasePoll;
+        phase.first     = runStart;
+        phase.last      = i - 1;
+        phase.duration  = entries[i - 1].timestamp - entries[runStart].timestamp;
+        phase.space     = nx2TraceGetSpace(&entries[runStart]);
+        phase.offset    = entries[runStart].offset;
+        results.push_back(phase);
+      }
+      runStart = i;
+    }
+    
+    if (i < entries.size() && entries[i].timestamp - entries[i - 1].timestamp >= gapNs) {
+      phase.type      = kTracePhaseGap;
+      phase.first     = i - 1;
+      phase.last      = i;
+      phase.duration  = entries[i].timestamp - entries[i - 1].timestamp;
+      phase.space     = nx2TraceGetSpace(&entries[i - 1]);
+      phase.offset    = entries[i - 1].offset;
+      results.push_back(phase);
+    }
+  }
+  
+  std::stable_sort(results.begin(), results.end(), [](const nx2_trace_phase_t &a, const nx2_trace_phase_t &b) {
+    return a.duration > b.duration;
+  });
+}
+
+#endif
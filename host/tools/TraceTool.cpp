@@ -0,0 +1,131 @@
+/*
+ *
+ * Copyright (c) 2021 Goldfish64
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+//
+// nx2-trace: reports redundant writes and slow phases in a register trace captured from the driver.
+//
+// Capture with the RegisterTrace property set in Info.plist, then after bring-up:
+//   ioreg -r -c AzulNX2Ethernet -k RegisterTraceData -w0 > trace.txt
+//   nx2-trace trace.txt
+// The raw property bytes are accepted as well.
+//
+#include <stdio.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+
+#include "TraceAnalysis.h"
+
+#define TRACE_TOP_DEFAULT         20
+
+static const char *spaceNames[kTraceSpaceCount] = { "mmio", "indirect", "phy" };
+
+static void usage(const char *name) {
+  fprintf(stderr, "Usage: %s [-g gap_us] [-p poll_reads] [-n top] <trace file | ->\n", name);
+  fprintf(stderr, "  -g  report gaps between accesses of at least gap_us (default %u)\n", TRACE_GAP_DEFAULT_NS / 1000);
+  fprintf(stderr, "  -p  report runs of at least poll_reads reads of one register (default %u)\n", TRACE_POLL_DEFAULT_READS);
+  fprintf(stderr, "  -n  entries to list per report (default %u)\n", TRACE_TOP_DEFAULT);
+}
+
+int main(int argc, char **argv) {
+  std::vector<azul_nx2_reg_trace_entry_t> entries;
+  std::vector<nx2_trace_write_stats_t>    writes;
+  std::vector<nx2_trace_phase_t>          phases;
+  std::stringstream                       input;
+  UInt64                                  gapNs     = TRACE_GAP_DEFAULT_NS;
+  UInt32                                  pollReads = TRACE_POLL_DEFAULT_READS;
+  UInt32                                  top       = TRACE_TOP_DEFAULT;
+  UInt32                                  writeCount = 0;
+  UInt32                                  redundantCount = 0;
+  int                                     opt;
+  
+  while ((opt = getopt(argc, argv, "g:p:n:h")) != -1) {
+    switch (opt) {
+      case 'g':
+        gapNs = strtoull(optarg, NULL, 0) * 1000;
+        break;
+      case 'p':
+        pollReads = (UInt32) strtoul(optarg, NULL, 0);
+        break;
+      case 'n':
+        top = (UInt32) strtoul(optarg, NULL, 0);
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+  if (optind + 1 != argc || pollReads < 2) {
+    usage(argv[0]);
+    return 1;
+  }
+  
+  if (strcmp(argv[optind], "-") == 0) {
+    input << std::cin.rdbuf();
+  } else {
+    std::ifstream file(argv[optind], std::ios::binary);
+    if (!file) {
+      fprintf(stderr, "Failed to open %s\n", argv[optind]);
+      return 1;
+    }
+    input << file.rdbuf();
+  }
+  
+  if (!nx2TraceParse(input.str(), entries)) {
+    fprintf(stderr, "Input is not a RegisterTraceData snapshot\n");
+    return 1;
+  }
+  if (entries.empty()) {
+    printf("Trace is empty\n");
+    return 0;
+  }
+  
+  for (const azul_nx2_reg_trace_entry_t &entry : entries) {
+    writeCount += nx2TraceIsWrite(&entry);
+  }
+  printf("%zu accesses (%u writes) over %llu us\n\n", entries.size(), writeCount,
+         (unsigned long long) (entries.back().timestamp / 1000));
+  
+  nx2TraceFindRedundantWrites(entries, writes);
+  for (const nx2_trace_write_stats_t &stats : writes) {
+    redundantCount += stats.rewrites + stats.writesAfterRead;
+  }
+  printf("Redundant writes: %u of %u\n", redundantCount, writeCount);
+  printf("  %-9s %-10s %8s %8s %10s\n", "space", "offset", "writes", "rewrite", "after-read");
+  for (UInt32 i = 0; i < writes.size() && i < top; i++) {
+    printf("  %-9s 0x%08X %8u %8u %10u\n", spaceNames[writes[i].space], writes[i].offset,
+           writes[i].writes, writes[i].rewrites, writes[i].writesAfterRead);
+  }
+  
+  nx2TraceFindSlowPhases(entries, gapNs, pollReads, phases);
+  printf("\nSlow phases: %zu\n", phases.size());
+  printf("  %-5s %10s %10s %8s %-9s %-10s\n", "type", "start_us", "length_us", "entries", "space", "offset");
+  for (UInt32 i = 0; i < phases.size() && i < top; i++) {
+    printf("  %-5s %10llu %10llu %8u %-9s 0x%08X\n", phases[i].type == kTracePhasePoll ? "poll" : "gap",
+           (unsigned long long) (entries[phases[i].first].timestamp / 1000), (unsigned long long) (phases[i].duration / 1000),
+           phases[i].last - phases[i].first + 1, spaceNames[phases[i].space], phases[i].offset);
+  }
+  return 0;
+}
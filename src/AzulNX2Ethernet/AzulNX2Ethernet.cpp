@@ -22,6 +22,7 @@
  */
 
 #include "AzulNX2Ethernet.h"
+#include "UserClient.h"
 
 OSDefineMetaClassAndStructors (AzulNX2Ethernet, super);
 
@@ -62,6 +63,11 @@ bool AzulNX2Ethernet::start(IOService *provider) {
     }
     baseAddr = (volatile void *) baseMemoryMap->getVirtualAddress();
     
+    if (!initRegisterTrace() || !initEventTrace()) {
+      SYSLOG("Failed to allocate trace buffers!");
+      break;
+    }
+    
     if (!initEventSources(provider)) {
       SYSLOG("Failed to setup event sources!");
       break;
@@ -74,18 +80,23 @@ bool AzulNX2Ethernet::start(IOService *provider) {
       SYSLOG("Controller prep failed!");
       break;
     }
-    if (!resetController(NX2_DRV_MSG_CODE_RESET)) {
-      SYSLOG("Controller reset failed!");
-      break;
-    }
-    if (!initControllerChip()) {
-      SYSLOG("Controller initialization failed!");
+    
+    //
+    // The descriptor benchmark needs a running controller, and runs the first time it is started.
+    //
+    OSBoolean *benchProp = OSDynamicCast(OSBoolean, getProperty("BenchmarkDescriptors"));
+    benchmarkDescriptors = benchProp != NULL && benchProp->isTrue();
+    OSBoolean *probeProp = OSDynamicCast(OSBoolean, getProperty("DeviceLatencyProbe"));
+    deviceLatencyProbe = probeProp != NULL && probeProp->isTrue();
+    
+    //
+    // Reset, PHY probing and initialization continue asynchronously on the work loop.
+    //
+    if (!beginBringup(NX2_DRV_MSG_CODE_RESET, false)) {
+      SYSLOG("Controller bring-up failed to start!");
       break;
     }
     
-    probePHY();
-    createMediumDictionary();
-    
     initialized = true;
   } while (false);
   
@@ -126,6 +137,36 @@ void AzulNX2Ethernet::stop(IOService *provider) {
     interruptSource->disable();
     workLoop->removeEventSource(interruptSource);
   }
+  if (bringupTimer != NULL) {
+    bringupTimer->cancelTimeout();
+    bringupTimer->disable();
+    workLoop->removeEventSource(bringupTimer);
+  }
+  if (sampleTimer != NULL) {
+    sampleTimer->cancelTimeout();
+    sampleTimer->disable();
+    workLoop->removeEventSource(sampleTimer);
+  }
+  if (ftqTimer != NULL) {
+    ftqTimer->cancelTimeout();
+    ftqTimer->disable();
+    workLoop->removeEventSource(ftqTimer);
+  }
+  if (linkTimer != NULL) {
+    linkTimer->cancelTimeout();
+    linkTimer->disable();
+    linkWorkLoop->removeEventSource(linkTimer);
+  }
+  if (linkMonitorTimer != NULL) {
+    linkMonitorTimer->cancelTimeout();
+    linkMonitorTimer->disable();
+    workLoop->removeEventSource(linkMonitorTimer);
+  }
+  if (selfTestTimer != NULL) {
+    selfTestTimer->cancelTimeout();
+    selfTestTimer->disable();
+    workLoop->removeEventSource(selfTestTimer);
+  }
   
   super::stop(provider);
 }
@@ -135,14 +176,203 @@ void AzulNX2Ethernet::free() {
   freeDmaBuffer(&statsBuffer);
   freeDmaBuffer(&txBuffer);
   freeDmaBuffer(&rxBuffer);
+  freeDmaBuffer(&arenaBuffer);
   
-  if (NX2_CHIP_NUM == NX2_CHIP_NUM_5709) {
+  if (chipOps != NULL && chipOps->hostContext) {
     freeDmaBuffer(&contextBuffer);
   }
+  freeRegisterTrace();
+  freeEventTrace();
+  freeBypassBuffers();
+  
+  //
+  // Event sources were removed from their work loops in stop().
+  //
+  if (interruptSource != NULL) {
+    interruptSource->release();
+    interruptSource = NULL;
+  }
+  if (bringupTimer != NULL) {
+    bringupTimer->release();
+    bringupTimer = NULL;
+  }
+  if (sampleTimer != NULL) {
+    sampleTimer->release();
+    sampleTimer = NULL;
+  }
+  if (ftqTimer != NULL) {
+    ftqTimer->release();
+    ftqTimer = NULL;
+  }
+  if (linkTimer != NULL) {
+    linkTimer->release();
+    linkTimer = NULL;
+  }
+  if (linkMonitorTimer != NULL) {
+    linkMonitorTimer->release();
+    linkMonitorTimer = NULL;
+  }
+  if (selfTestTimer != NULL) {
+    selfTestTimer->release();
+    selfTestTimer = NULL;
+  }
+  if (linkWorkLoop != NULL) {
+    linkWorkLoop->release();
+    linkWorkLoop = NULL;
+  }
+  if (phyLock != NULL) {
+    IORecursiveLockFree(phyLock);
+    phyLock = NULL;
+  }
   
   super::free();
 }
 
+//
+// Properties that request a diagnostic action rather than set a value.
+//
+static const char *propertyActions[] = {
+  "DumpRegisterTrace",
+  "DumpEventTrace",
+  "DumpLatency",
+  "ResetLatency",
+  "DumpInterruptWork",
+  "ResetInterruptWork",
+  "DumpProcessorSamples",
+  "DumpFtqSamples",
+  "ResetFtqSamples",
+  "DumpFlowControl",
+  "RunSelfTest",
+  "DumpAccessCounts",
+  "ResetAccessCounts"
+};
+
+IOReturn AzulNX2Ethernet::setProperties(OSObject *properties) {
+  OSDictionary  *dict = OSDynamicCast(OSDictionary, properties);
+  IOCommandGate *gate;
+  bool          isAction = false;
+  
+  if (dict == NULL) {
+    return kIOReturnBadArgument;
+  }
+  
+  for (UInt32 i = 0; i < sizeof (propertyActions) / sizeof (propertyActions[0]); i++) {
+    if (dict->getObject(propertyActions[i]) != NULL) {
+      isAction = true;
+      break;
+    }
+  }
+  if (!isAction) {
+    return super::setProperties(properties);
+  }
+  
+  //
+  // Actions read and reset state owned by the work loop, and a self-test takes over the port.
+  // They are limited to administrators and run on the work loop.
+  //
+  if (IOUserClient::clientHasPrivilege(current_task(), kIOClientPrivilegeAdministrator) != kIOReturnSuccess) {
+    return kIOReturnNotPrivileged;
+  }
+  
+  gate = getCommandGate();
+  if (gate == NULL) {
+    return kIOReturnNotReady;
+  }
+  return gate->runAction(gatedSetProperties, dict);
+}
+
+IOReturn AzulNX2Ethernet::gatedSetProperties(OSObject *owner, void *arg0, void *arg1, void *arg2, void *arg3) {
+  AzulNX2Ethernet *eth  = (AzulNX2Ethernet*) owner;
+  OSDictionary    *dict = (OSDictionary*) arg0;
+  
+  //
+  // Allow diagnostic snapshots to be requested from userspace.
+  //
+  if (dict->getObject("DumpRegisterTrace") != NULL) {
+    eth->publishRegisterTrace();
+    return kIOReturnSuccess;
+  }
+  if (dict->getObject("DumpEventTrace") != NULL) {
+    eth->publishEventTrace();
+    return kIOReturnSuccess;
+  }
+  if (dict->getObject("DumpLatency") != NULL) {
+    eth->publishLatencyHistograms();
+    return kIOReturnSuccess;
+  }
+  if (dict->getObject("ResetLatency") != NULL) {
+    eth->resetLatencyHistograms();
+    return kIOReturnSuccess;
+  }
+  if (dict->getObject("DumpInterruptWork") != NULL) {
+    eth->publishInterruptWork();
+    return kIOReturnSuccess;
+  }
+  if (dict->getObject("ResetInterruptWork") != NULL) {
+    eth->resetInterruptWork();
+    return kIOReturnSuccess;
+  }
+  if (dict->getObject("DumpProcessorSamples") != NULL) {
+    eth->publishCpuSamples();
+    return kIOReturnSuccess;
+  }
+  if (dict->getObject("DumpFtqSamples") != NULL) {
+    eth->publishFtqSamples();
+    return kIOReturnSuccess;
+  }
+  if (dict->getObject("ResetFtqSamples") != NULL) {
+    eth->resetFtqSamples();
+    return kIOReturnSuccess;
+  }
+  if (dict->getObject("DumpFlowControl") != NULL) {
+    eth->publishFlowControl();
+    return kIOReturnSuccess;
+  }
+  if (dict->getObject("RunSelfTest") != NULL) {
+    return eth->beginSelfTest(OSDynamicCast(OSDictionary, dict->getObject("RunSelfTest")));
+  }
+  if (dict->getObject("DumpAccessCounts") != NULL) {
+    eth->publishAccessCounts();
+    return kIOReturnSuccess;
+  }
+  if (dict->getObject("ResetAccessCounts") != NULL) {
+    eth->resetAccessCounts();
+    return kIOReturnSuccess;
+  }
+  
+  return kIOReturnUnsupported;
+}
+
+IOReturn AzulNX2Ethernet::newUserClient(task_t owningTask, void *securityID, UInt32 type, IOUserClient **handler) {
+  AzulNX2UserClient *client;
+  
+  if (type != NX2_USER_CLIENT_TYPE) {
+    return super::newUserClient(owningTask, securityID, type, handler);
+  }
+  
+  client = OSTypeAlloc(AzulNX2UserClient);
+  if (client == NULL) {
+    return kIOReturnNoMemory;
+  }
+  
+  if (!client->initWithTask(owningTask, securityID, type, NULL)) {
+    client->release();
+    return kIOReturnNotPermitted;
+  }
+  if (!client->attach(this)) {
+    client->release();
+    return kIOReturnError;
+  }
+  if (!client->start(this)) {
+    client->detach(this);
+    client->release();
+    return kIOReturnError;
+  }
+  
+  *handler = client;
+  return kIOReturnSuccess;
+}
+
 IOWorkLoop* AzulNX2Ethernet::getWorkLoop() const {
   return workLoop;
 }
@@ -165,11 +395,24 @@ const OSString* AzulNX2Ethernet::newModelString() const {
 }
 
 UInt32 AzulNX2Ethernet::outputPacket(mbuf_t m, void *param) {
+  azul_nx2_access_bucket_t  prevBucket;
+  UInt32                    status;
   
   if (!isEnabled)
     return kIOReturnOutputSuccess;
   
-  return sendTxPacket(m);
+  //
+  // The stack is detached in bypass mode, anything still queued is dropped.
+  //
+  if (isBypassActive()) {
+    freePacket(m);
+    return kIOReturnOutputDropped;
+  }
+  
+  prevBucket = setAccessBucket(kAccessBucketTx);
+  status = sendTxPacket(m);
+  setAccessBucket(prevBucket);
+  return status;
 }
 
 IOReturn AzulNX2Ethernet::enable(IONetworkInterface *interface) {
@@ -187,27 +430,27 @@ IOReturn AzulNX2Ethernet::enable(IONetworkInterface *interface) {
       break;
     }
     
-    stopController();
-    
-    if (!resetController(NX2_DRV_MSG_CODE_RESET)) {
-      SYSLOG("Controller reset failed!");
-      break;
-    }
-    if (!initControllerChip()) {
-      SYSLOG("Controller initialization failed!");
+    //
+    // If bring-up from start is still in progress, simply start the controller once it completes.
+    //
+    if (isBringupActive()) {
+      bringupStartPending = true;
+      initialized = true;
       break;
     }
     
-    startController();
-    
-    updatePHYMediaState();
+    stopController();
     
-    txQueue->setCapacity(TX_QUEUE_LENGTH);
-    txQueue->start();
+    //
+    // Controller will be started and enabled once bring-up completes.
+    //
+    if (!beginBringup(NX2_DRV_MSG_CODE_RESET, true)) {
+      SYSLOG("Controller bring-up failed to start!");
+      break;
+    }
     
-    isEnabled = true;
     initialized = true;
-    DBGLOG("Controller is now enabled");
+    DBGLOG("Controller bring-up has been started");
     
   } while (false);
   
@@ -220,20 +463,35 @@ IOReturn AzulNX2Ethernet::getHardwareAddress(IOEthernetAddress *address) {
 }
 
 void AzulNX2Ethernet::interruptOccurred(IOInterruptEventSource *source, int count) {
+  azul_nx2_access_bucket_t prevBucket;
+  UInt64                   handlerStartTime;
+  UInt32                   txReclaimed = 0;
+  UInt32                   rxPackets = 0;
+  bool                     linkChanged = false;
+  UInt16                   probeIndex;
+  UInt32                   probeEndRaw = 0;
+  
   if (!isEnabled) {
     return;
   }
   
-  writeReg32(NX2_PCICFG_INT_ACK_CMD, NX2_PCICFG_INT_ACK_CMD_USE_INT_HC_PARAM | NX2_PCICFG_INT_ACK_CMD_MASK_INT);
+  interruptTime = mach_absolute_time();
+  prevBucket = setAccessBucket(kAccessBucketInterrupt);
+  nx2InterruptMask(&ringRegs);
   
   
  // UInt32 *hcsMem32 = (UInt32*)stsBlockData;
   
   //IOLog("INT\n");
  // IOLog("INT status %X ack %X, %X time %X IDX %X\n", hcsMem32[0], hcsMem32[1], hcsMem32[8], (((uint8_t*)stsBlockData)[0x34]), hcsMem32[13]);
-  UInt32 i = statusBlock->index;
-  if (i % 200 == 0) {
-    SYSLOG("INT status %X (%X) index %u tx idx %u rx idx %u", statusBlock->attnBits, statusBlock->attnBitsAck, statusBlock->index, readTxCons(), readRxCons());
+  traceEvent(kEventInterrupt, statusBlock->index, statusBlock->attnBits);
+  
+  //
+  // The probe is timed to the first pass seeing a new index, and matched once the pass's work is known.
+  //
+  probeIndex = statusBlock->index;
+  if (deviceClock.probePending && probeIndex != deviceClock.probeStatusIndex) {
+    probeEndRaw = readReg32(NX2_TIMER_25MHZ_FREE_RUN);
   }
   
   
@@ -243,28 +501,44 @@ void AzulNX2Ethernet::interruptOccurred(IOInterruptEventSource *source, int coun
   //SYSLOG("TXP %X %X", readReg32(NX2_TXP_CPU_STATE), readReg32(NX2_TXP_CPU_EVENT_MASK));
   
   /*if (statusBlock->status_rx_quick_consumer_index0 > 0) {
-    UInt8 *dd = (UInt8*) mbuf_data(rxPackets[statusBlock->status_rx_quick_consumer_index0 - 1]);
+    UInt8 *dd = (UInt8*) mbuf_data(rxRing.packets[statusBlock->status_rx_quick_consumer_index0 - 1]);
     dd += 0x12;
     SYSLOG("RX d %X %X %X %X %X %X %X", dd[0], dd[1], dd[2], dd[3], dd[4], dd[5], dd[6]);
   }*/
   
   
   if ((statusBlock->attnBits & STATUS_ATTN_BITS_LINK_STATE) != (statusBlock->attnBitsAck & STATUS_ATTN_BITS_LINK_STATE)) {
+    setAccessBucket(kAccessBucketPhy);
+    handlerStartTime = mach_absolute_time();
     handlePHYInterrupt(statusBlock);
+    recordElapsed(&interruptWork.histograms[kWorkLinkTime], handlerStartTime);
+    linkChanged = true;
   }
   
-  UInt16 txConsNew = readTxCons();
-  if (txCons != txConsNew) {
-    handleTxInterrupt(txConsNew);
-  }
+  nx2InterruptService(statusBlock, &txRing, &rxRing, [&](UInt16 txConsNew) {
+    setAccessBucket(kAccessBucketTx);
+    handlerStartTime = mach_absolute_time();
+    txReclaimed = handleTxInterrupt(txConsNew);
+    recordElapsed(&interruptWork.histograms[kWorkTxTime], handlerStartTime);
+  }, [&](UInt16 rxConsNew) {
+    setAccessBucket(kAccessBucketRx);
+    handlerStartTime = mach_absolute_time();
+    rxPackets = handleRxInterrupt(rxConsNew);
+    recordElapsed(&interruptWork.histograms[kWorkRxTime], handlerStartTime);
+  });
   
-  UInt16 rxConsNew = readRxCons();
-  if (rxCons != rxConsNew) {
-    handleRxInterrupt(rxConsNew);
-  }
+  //
+  // Account for the work done in this pass.
+  //
+  nx2WorkRecordPass(&interruptWork, linkChanged, txReclaimed, rxPackets, statusBlock->index, lastStatusIndex);
   
+  setAccessBucket(kAccessBucketInterrupt);
+  if (deviceClock.probePending && probeIndex != deviceClock.probeStatusIndex) {
+    completeDeviceLatencyProbe(probeEndRaw, probeIndex, !linkChanged && txReclaimed == 0 && rxPackets == 0);
+  }
   lastStatusIndex = statusBlock->index;
   enableInterrupts(false);
+  setAccessBucket(prevBucket);
 }
 
 IOReturn AzulNX2Ethernet::getMaxPacketSize(UInt32 *maxSize) const
@@ -286,3 +560,26 @@ IOReturn AzulNX2Ethernet::setPromiscuousMode(bool active) {
   setRxMode(active);
   return kIOReturnSuccess;
 }
+
+IOReturn AzulNX2Ethernet::selectMedium(const IONetworkMedium *medium) {
+  IOReturn status;
+  UInt32 index = medium != NULL ? medium->getIndex() : kMediumTypeIndexAuto;
+  
+  if (index >= kMediumTypeCount) {
+    return kIOReturnUnsupported;
+  }
+  selectedMediumIndex = index;
+  
+  //
+  // The PHY is only programmed once bring-up is done, otherwise the medium is applied when the controller starts.
+  //
+  if (bringupState == kBringupStateDone) {
+    status = setPHYMedium(index);
+    if (IORETURN_ERR(status)) {
+      return status;
+    }
+  }
+  
+  setSelectedMedium(medium);
+  return kIOReturnSuccess;
+}
@@ -26,6 +26,8 @@
 
 #include <IOKit/IODMACommand.h>
 #include <IOKit/IOBufferMemoryDescriptor.h>
+#include <IOKit/IOCommandGate.h>
+#include <IOKit/IOLocks.h>
 #include <IOKit/IOInterruptEventSource.h>
 #include <IOKit/IOTimerEventSource.h>
 #include <IOKit/network/IONetworkInterface.h>
@@ -40,20 +42,385 @@
 #include "FirmwareStructs.h"
 #include "Registers.h"
 #include "PHY.h"
-#include "HwBuffers.h"
+
+//
+// PCIe is cache coherent on x86, allowing descriptor memory to be mapped cacheable.
+// A write barrier is then required before ringing a doorbell so BD stores are visible to the controller.
+//
+#if defined(__x86_64__) || defined(__i386__)
+#define DMA_COHERENT_PLATFORM 1
+#define DMA_WRITE_BARRIER()   __asm__ volatile ("sfence" ::: "memory")
+#else
+#define DMA_COHERENT_PLATFORM 0
+#define DMA_WRITE_BARRIER()   OSSynchronizeIO()
+#endif
+
+typedef mbuf_t nx2_packet_t;
+#include "RingEngine.h"
+#include "UserQueue.h"
+#include "RegisterTrace.h"
+#include "Histogram.h"
+#include "ChipTraits.h"
 
 #define super IOEthernetController
 
+//
+// SYSLOG is always logged. DBGLOG is compiled out of release builds.
+// WARNLOG is for conditions that may repeat on the packet path, and is rate limited per call site
+// with a token bucket of LOG_LIMIT_BURST messages, refilled evenly over LOG_LIMIT_INTERVAL_MS.
+// The number of suppressed messages is reported with the next one logged.
+//
+// The limit is global to the call site, not per port: it is shared by every controller and
+// updated atomically, as sites are reached from both the main and the link work loops.
+//
+#define LOG_LIMIT_BURST       5
+#define LOG_LIMIT_INTERVAL_MS 1000
+
+typedef struct {
+  UInt64                    refillTime;
+  UInt32                    suppressed;
+} azul_nx2_log_limit_t;
+
 #define SYSLOG(str, ...) logPrint(__FUNCTION__, str, ## __VA_ARGS__)
+#define WARNLOG(str, ...) \
+  do { \
+    static azul_nx2_log_limit_t logLimit = { 0, 0 }; \
+    logPrintLimited(&logLimit, __FUNCTION__, str, ## __VA_ARGS__); \
+  } while (false)
+
+#ifdef DEBUG
 #define DBGLOG(str, ...) logPrint(__FUNCTION__, str, ## __VA_ARGS__)
+#else
+#define DBGLOG(str, ...) do { } while (false)
+#endif
 
 #define IORETURN_ERR(a)  (a != kIOReturnSuccess)
 
-#define DMA_BITS_40           ((1ULL << 40) - 1)
-#define DMA_BITS_64           (~0ULL)
+#define DMA_BENCH_ITERATIONS  64
+#define DMA_BENCH_POLL_LIMIT  100000
+
+//
+// Controller bring-up is driven by a timer so that the work loop is never blocked
+// while waiting on the bootcode or on the chip reset to complete.
+//
+#define BRINGUP_POLL_INTERVAL_MS  1
+#define BRINGUP_FW_TIMEOUT_US     (FW_ACK_TIME_OUT_MS * 50)
+#define BRINGUP_RESET_TIMEOUT_US  100
+
+typedef enum {
+  kBringupStateIdle = 0,
+  kBringupStateReset,
+  kBringupStateWait0,
+  kBringupStateCoreReset,
+  kBringupStateWait1,
+  kBringupStateContext,
+  kBringupStateCpus,
+  kBringupStateWait2,
+  kBringupStateDone,
+  kBringupStateFailed,
+  kBringupStateCount
+} azul_nx2_bringup_state_t;
+
+//
+// Latencies tracked in nanoseconds, published as the LatencyHistograms property by setting DumpLatency.
+//   - RX delivery: interrupt arrival to the RX batch being flushed to the network stack.
+//   - RX batch: time spent harvesting and refilling one RX batch.
+//   - TX completion: doorbell write to the BD being reclaimed.
+//   - Device to host: coalesce-now probe to the interrupt handler servicing its own status block update,
+//     in device time. Only probes whose update arrived with no other work are counted.
+//   - MDIO read/write: one PHY register transaction, including any auto-poll suspension.
+//   - Link down: last EMAC link state poll that saw the link up to link loss being reported to the interface.
+//     This bounds detection plus reporting from above, at a resolution of the link monitor interval.
+//     Only recorded while the link monitor runs, as there is no earlier observation to measure from otherwise.
+//
+typedef enum {
+  kLatencyRxDelivery = 0,
+  kLatencyRxBatch,
+  kLatencyTxCompletion,
+  kLatencyDeviceToHost,
+  kLatencyMdioRead,
+  kLatencyMdioWrite,
+  kLatencyLinkDown,
+  kLatencyCount
+} azul_nx2_latency_t;
+
+//
+// Host/device clock correlation using the 25 MHz free-running timer, read alongside host time on each
+// background sample. Device ticks are converted to nanoseconds at the rate measured over the last
+// DEVICE_CLOCK_WINDOW samples instead of the nominal rate. The 32-bit timer wraps every ~171 seconds,
+// so correlation requires a shorter sample interval.
+//
+// With the DeviceLatencyProbe property set, each sample also issues a coalesce-now probe while TX is idle,
+// timed in device ticks from the command until the interrupt handler first sees a new status index.
+// The sample is kept only if that pass advanced the index by one and found no link, TX or RX work;
+// otherwise the update may have been raised by traffic and the probe is counted as discarded.
+//
+#define DEVICE_CLOCK_NS_PER_TICK  40
+#define DEVICE_CLOCK_WINDOW       64
+
+typedef struct {
+  UInt64                    ticks;
+  UInt32                    lastRaw;
+  UInt32                    samples;
+  
+  UInt64                    anchorHostNs;
+  UInt64                    anchorTicks;
+  UInt32                    anchorSamples;
+  UInt64                    rateHostNs;
+  UInt64                    rateTicks;
+  
+  bool                      probePending;
+  UInt16                    probeStatusIndex;
+  UInt32                    probeRaw;
+  UInt64                    probesDiscarded;
+} azul_nx2_device_clock_t;
+
+//
+// Link changes are resolved off the interrupt path LINK_CHANGE_DELAY_MS after the first link interrupt.
+// Further link interrupts within the delay are folded into the same update.
+//
+#define LINK_CHANGE_DELAY_MS    10
+
+//
+// Link loss is reported from the EMAC link attention. The LinkMonitorInterval property optionally also polls
+// the EMAC link state every interval (in microseconds) while the link is up with auto polling, bounding the
+// report latency if the attention is held up. Each poll is a work loop wakeup and an uncached register read,
+// 2000 per second per port at 500 us, so the monitor is off by default.
+//
+#define LINK_MONITOR_INTERVAL_US  0
+
+//
+// 5706S SerDes PHYs have no hardware parallel detection, the link is polled for it instead.
+//
+#define SERDES_POLL_INTERVAL_MS 1000
+
+//
+// Loopback self-test, started by an administrator setting the RunSelfTest property to a dictionary of:
+//   - Mode: "MAC" (EMAC internal loopback, default) or "PHY" (PHY loopback at 1000 Mb/s full duplex).
+//   - FrameCount: total frames to send.
+//   - BurstLength: maximum frames posted per refill. Refills occur on each TX completion and timer tick.
+//   - FrameSizes: array of frame sizes without CRC, cycled by sequence number. Defaults to a simple IMIX.
+// The network stack is paused for the duration, and the port is returned to its normal mode afterwards.
+// Frames are addressed to the port itself and carry a sequence number and a byte pattern checked on RX.
+// Results are published as the SelfTestResults property.
+//
+#define SELF_TEST_ETHERTYPE       0x88B5
+#define SELF_TEST_MAGIC           0x4E583254
+#define SELF_TEST_MIN_FRAME       (kIOEthernetMinPacketSize - kIOEthernetCRCSize)
+#define SELF_TEST_MAX_FRAME       (kIOEthernetMaxPacketSize - kIOEthernetCRCSize)
+#define SELF_TEST_MAX_SIZES       16
+#define SELF_TEST_FRAME_COUNT     100000
+#define SELF_TEST_BURST_LENGTH    64
+#define SELF_TEST_POLL_MS         10
+#define SELF_TEST_DRAIN_MS        100
+#define SELF_TEST_STALL_MS        1000
+
+//
+// Self-test frame header, fields are big endian. The pattern byte at frame offset i is (sequence + i) & 0xFF.
+//
+typedef struct __attribute__((packed)) {
+  UInt8                     destAddress[kIOEthernetAddressSize];
+  UInt8                     srcAddress[kIOEthernetAddressSize];
+  UInt16                    etherType;
+  UInt32                    magic;
+  UInt32                    sequence;
+} azul_nx2_self_test_frame_t;
+
+typedef enum {
+  kSelfTestStateIdle = 0,
+  kSelfTestStateStarting,
+  kSelfTestStateRunning,
+  kSelfTestStateDraining
+} azul_nx2_self_test_state_t;
+
+typedef enum {
+  kSelfTestModeMac = 0,
+  kSelfTestModePhy
+} azul_nx2_self_test_mode_t;
+
+typedef struct {
+  azul_nx2_self_test_state_t  state;
+  azul_nx2_self_test_mode_t   mode;
+  UInt32                      frameCount;
+  UInt32                      burstLength;
+  UInt16                      frameSizes[SELF_TEST_MAX_SIZES];
+  UInt32                      frameSizeCount;
+  
+  UInt32                      nextSeq;
+  UInt32                      expectedSeq;
+  UInt16                      savedPhyControl;
+  bool                        timedOut;
+  
+  UInt64                      txFrames;
+  UInt64                      txBytes;
+  UInt64                      txStalls;
+  UInt64                      txDropped;
+  UInt64                      rxFrames;
+  UInt64                      rxBytes;
+  UInt64                      rxErrors;
+  UInt64                      rxCorrupt;
+  UInt64                      rxOutOfOrder;
+  UInt64                      rxForeign;
+  
+  UInt64                      startTime;
+  UInt64                      lastRxTime;
+  UInt64                      lastProgressTime;
+} azul_nx2_self_test_t;
+
+//
+// Background sampling of on-chip state, at a low rate set by the SampleInterval property (ms, 0 disables).
+//
+#define SAMPLE_INTERVAL_MS      1000
+
+//
+// On-chip MIPS processor sampling. Each processor's program counter, state and event mask are read,
+// and the program counter is binned across the firmware text section. A processor is flagged as looping
+// if its program counter has not moved for CPU_LOOP_SAMPLES consecutive samples.
+// Published as the ProcessorSamples property by setting DumpProcessorSamples.
+//
+#define CPU_PC_BUCKETS          16
+#define CPU_LOOP_SAMPLES        8
+
+typedef enum {
+  kCpuRxp = 0,
+  kCpuTxp,
+  kCpuTpat,
+  kCpuCom,
+  kCpuCp,
+  kCpuCount
+} azul_nx2_cpu_t;
+
+typedef struct {
+  cpu_reg_t                 reg;
+  UInt32                    textStart;
+  UInt32                    textLength;
+  
+  UInt32                    pc;
+  UInt32                    state;
+  UInt32                    eventMask;
+  UInt32                    samePcCount;
+  bool                      halted;
+  bool                      looping;
+  
+  UInt64                    samples;
+  UInt64                    haltedSamples;
+  UInt64                    pcOutsideText;
+  UInt64                    pcBuckets[CPU_PC_BUCKETS];
+} azul_nx2_cpu_sampler_t;
+
+//
+// Flow-through queue depth sampling for each internal pipeline stage.
+// Queues drain in microseconds, so each background sample starts a burst of FTQ_BURST_SAMPLES samples
+// spaced by the FtqSampleInterval property (us, 0 disables) while the interface is enabled.
+// All FTQ control registers share the RLUP depth field layout. Each sample is also kept in a time series
+// of the last FTQ_SERIES_COUNT samples.
+// Published as the FtqSamples property by setting DumpFtqSamples, along with the stage
+// having the highest average fill relative to its maximum depth. The time series is published as
+// the FtqSeriesData property, in the same format and time base as the register trace.
+//
+#define FTQ_SAMPLE_INTERVAL_US  100
+#define FTQ_BURST_SAMPLES       64
+#define FTQ_SERIES_COUNT        256
+#define FTQ_CTL_MAX_DEPTH_SHIFT 12
+#define FTQ_CTL_CUR_DEPTH_SHIFT 22
+
+typedef enum {
+  kFtqRlup = 0,
+  kFtqRv2pP,
+  kFtqRv2pT,
+  kFtqRv2pM,
+  kFtqRv2pCsr,
+  kFtqRdma,
+  kFtqTsch,
+  kFtqTbdr,
+  kFtqCsch,
+  kFtqCount
+} azul_nx2_ftq_t;
+
+typedef struct {
+  UInt32                    maxDepth;
+  UInt32                    peakDepth;
+  UInt64                    depthSum;
+  UInt64                    samples;
+  UInt64                    fullSamples;
+  azul_nx2_histogram_t      depths;
+} azul_nx2_ftq_sampler_t;
+
+typedef struct {
+  UInt64                    timestamp;
+  UInt16                    depths[kFtqCount];
+} azul_nx2_ftq_series_entry_t;
+
+//
+// Driver-owned control registers kept in software, so hot paths can modify them without an MMIO read.
+// Shadows are loaded from hardware once the chip is initialized after reset.
+// Setting the VerifyShadowRegisters property checks each shadow read against hardware.
+//
+typedef enum {
+  kShadowRegHcCommand = 0,
+  kShadowRegEmacMode,
+  kShadowRegEmacTxMode,
+  kShadowRegEmacRxMode,
+  kShadowRegEmacMdioMode,
+  kShadowRegMiscNewCoreCtl,
+  kShadowRegCount
+} azul_nx2_shadow_reg_t;
+
+//
+// Register access accounting, bucketed by the code path performing the access.
+// Counters are always on; indirect accesses count as the config cycles they generate.
+// The work loop, the link work loop and the output thread each keep their own current bucket and counters,
+// so none is charged for another's accesses. Threads outside both gates other than the output thread share
+// the output context. Counters of all contexts are summed when published.
+//
+typedef enum {
+  kAccessBucketInit = 0,
+  kAccessBucketInterrupt,
+  kAccessBucketTx,
+  kAccessBucketRx,
+  kAccessBucketPhy,
+  kAccessBucketSampler,
+  kAccessBucketSelfTest,
+  kAccessBucketCount
+} azul_nx2_access_bucket_t;
+
+typedef enum {
+  kAccessContextWorkLoop = 0,
+  kAccessContextLink,
+  kAccessContextOutput,
+  kAccessContextCount
+} azul_nx2_access_context_t;
+
+typedef enum {
+  kAccessTypeMmioRead = 0,
+  kAccessTypeMmioWrite,
+  kAccessTypeConfigRead,
+  kAccessTypeConfigWrite,
+  kAccessTypeCount
+} azul_nx2_access_type_t;
+
+//
+// Driver event tracing, replacing logging on the interrupt path. Always enabled.
+// Each event is a fixed-size record with two event-specific arguments.
+// The trace is published as the EventTraceData property, in the same order and time base as the register trace,
+// on demand by setting the DumpEventTrace property.
+//
+#define EVENT_TRACE_COUNT     1024
 
-#define ADDR_LO(a)            ((a) & 0xFFFFFFFF)
-#define ADDR_HI(a)            ((a) >> 32)
+typedef enum {
+  kEventInterrupt = 0,      // status index, attention bits
+  kEventRxError,            // BD index, (errors << 16) | status
+  kEventTxStall,            // free BDs, segments needed
+  kEventLinkChange          // link up, EMAC status
+} azul_nx2_event_t;
+
+typedef struct {
+  UInt64                    timestamp;
+  UInt32                    event;
+  UInt32                    arg0;
+  UInt32                    arg1;
+  UInt32                    reserved;
+} azul_nx2_event_trace_entry_t;
 
 typedef struct {
   IOBufferMemoryDescriptor  *bufDesc;
@@ -61,36 +428,100 @@ typedef struct {
   mach_vm_address_t         physAddr;
   void                      *buffer;
   size_t                    size;
+  bool                      cacheable;
 } azul_nx2_dma_buf_t;
 
+//
+// Control structures carved out of a single DMA arena allocation.
+//
+typedef struct {
+  azul_nx2_dma_buf_t        *dmaBuf;
+  const char                *name;
+  size_t                    size;
+  UInt32                    alignment;
+} azul_nx2_dma_arena_entry_t;
+
+//
+// Bypass mode, where the port is detached from the network stack and its rings are driven
+// by a single process through AzulNX2UserClient. See UserQueue.h for the shared queue protocol
+// and the driver end of it, kept in rings.
+// Entering and leaving bypass mode resets the controller, as the RX ring is rebuilt with different buffers.
+//
+typedef struct {
+  IOService                 *owner;
+  IOBufferMemoryDescriptor  *sharedDesc;
+  nx2_user_shared_t         *shared;
+  azul_nx2_dma_buf_t        buffers;
+  nx2_user_rings_t          rings;
+} azul_nx2_bypass_t;
+
+class AzulNX2UserClient;
+
 class AzulNX2Ethernet : public IOEthernetController {
   OSDeclareDefaultStructors(AzulNX2Ethernet);
+  friend class AzulNX2UserClient;
   
 private:
   IOPCIDevice                 *pciNub;
   IOMemoryMap                 *baseMemoryMap;
   volatile void               *baseAddr;
   bool                        isEnabled;
+  bool                        cacheableDescriptors;
+  bool                        benchmarkDescriptors;
+  bool                        deviceLatencyProbe;
   
   UInt16                      pciVendorId;
   UInt16                      pciDeviceId;
   UInt16                      pciSubVendorId;
   UInt16                      pciSubDeviceId;
   UInt32                      chipId;
+  const nx2_chip_ops_t        *chipOps;
   
   IOWorkLoop                  *workLoop;
   IOInterruptEventSource      *interruptSource;
+  IOTimerEventSource          *bringupTimer;
+  IOTimerEventSource          *sampleTimer;
+  IOTimerEventSource          *ftqTimer;
+  IOWorkLoop                  *linkWorkLoop;
+  IOTimerEventSource          *linkTimer;
+  IORecursiveLock             *phyLock;
+  IOTimerEventSource          *linkMonitorTimer;
+  UInt32                      linkMonitorInterval;
+  UInt64                      linkUpSeenTime;
+  IOTimerEventSource          *selfTestTimer;
+  azul_nx2_self_test_t        selfTest;
+  azul_nx2_bypass_t           bypass;
+  bool                        linkChangePending;
+  bool                        linkDownReported;
+  UInt32                      linkChangeCount;
+  UInt32                      linkUpdateGeneration;
+  UInt32                      sampleInterval;
+  azul_nx2_cpu_sampler_t      cpuSamplers[kCpuCount];
+  azul_nx2_ftq_sampler_t      ftqSamplers[kFtqCount];
+  UInt32                      ftqSampleInterval;
+  UInt32                      ftqBurstRemaining;
+  azul_nx2_ftq_series_entry_t ftqSeries[FTQ_SERIES_COUNT];
+  UInt32                      ftqSeriesIndex;
 
   OSDictionary                *mediumDict;
   UInt32                      currentMediumIndex;
+  UInt32                      selectedMediumIndex;
   phy_media_state_t           mediaState;
+  UInt32                      flowControlPolicy;
   
   IOEthernetInterface         *ethInterface;
   IOEthernetAddress           ethAddress;
   
   UInt32                      shMemBase;
   UInt16                      phyAddress;
-  
+  phy_type_t                  phyType;
+  UInt8                       phyIeeeOffset;
+  bool                        phy25GCapable;
+  bool                        phyParallelDetect;
+  bool                        phyAutoPoll;
+  UInt32                      mdioTimeouts;
+  
+  azul_nx2_dma_buf_t          arenaBuffer;
   azul_nx2_dma_buf_t          statusBuffer;
   azul_nx2_dma_buf_t          statsBuffer;
   azul_nx2_dma_buf_t          contextBuffer;
@@ -99,51 +530,155 @@ private:
   
   status_block_t              *statusBlock;
 
+  //
+  // Register accessor handed to the ring engine, so its doorbells and interrupt acks go through
+  // writeReg16()/writeReg32() and are traced and counted like any other access.
+  //
+  struct azul_nx2_ring_regs_t {
+    AzulNX2Ethernet           *driver;
+    
+    inline void writeReg16(UInt32 offset, UInt16 value) {
+      driver->writeReg16(offset, value);
+    }
+    inline void writeReg32(UInt32 offset, UInt32 value) {
+      driver->writeReg32(offset, value);
+    }
+  };
+  azul_nx2_ring_regs_t        ringRegs = { this };
+  
+  azul_nx2_tx_ring_t          txRing CACHE_LINE_ALIGNED;
+  azul_nx2_rx_ring_t          rxRing CACHE_LINE_ALIGNED;
   
-  tx_bd_t                     *txChain;
-  UInt16                      txProd;
-  UInt16                      txCons;
-  UInt32                      txProdBufferSize;
-  UInt16                      txFreeDescriptors;
-  mbuf_t                      txPackets[TX_USABLE_BD_COUNT];
   IOOutputQueue               *txQueue;
   IOMbufNaturalMemoryCursor   *txCursor;
-  
-  rx_bd_t                     *rxChain;
-  UInt16                      rxProd;
-  UInt16                      rxCons;
-  UInt32                      rxProdBufferSize;
-  UInt16                      rxFreeDescriptors;
-  mbuf_t                      rxPackets[RX_USABLE_BD_COUNT];
-  UInt32                      rxPacketLengths[RX_USABLE_BD_COUNT];
-  IOOutputQueue               *rxQueue;
   IOMbufNaturalMemoryCursor   *rxCursor;
   
-  UInt32                      rxMode;
+  UInt32                      shadowRegs[kShadowRegCount];
+  bool                        shadowRegsVerify;
 
   
   
   UInt16                      fwSyncSeq = 0;
-  
+  UInt32                      fwSyncMsg = 0;
+  
+  azul_nx2_bringup_state_t    bringupState = kBringupStateIdle;
+  UInt32                      bringupResetCode;
+  bool                        bringupStartPending;
+  UInt64                      bringupStartTime;
+  UInt64                      bringupPhaseStartTime;
+  UInt64                      bringupDeadline;
+  UInt32                      bringupPhaseTimes[kBringupStateCount];
 
   const nx2_mips_fw_file_t    *firmwareMips;
   const nx2_rv2p_fw_file_t    *firmwareRv2p;
   
   UInt16                      lastStatusIndex = 0;
   
+  azul_nx2_histogram_t        latencyHistograms[kLatencyCount];
+  UInt64                      interruptTime;
+  UInt64                      txDoorbellTimes[TX_USABLE_BD_COUNT];
+  azul_nx2_device_clock_t     deviceClock;
+  azul_nx2_work_stats_t       interruptWork;
+  
+  azul_nx2_reg_trace_entry_t  *regTrace;
+  volatile SInt32             regTraceIndex;
+  azul_nx2_event_trace_entry_t *eventTrace;
+  volatile SInt32             eventTraceIndex;
+  
+  azul_nx2_access_bucket_t    accessBuckets[kAccessContextCount];
+  UInt64                      accessCounts[kAccessContextCount][kAccessBucketCount][kAccessTypeCount];
+  
   void logPrint(const char *func, const char *format, ...);
+  void logPrintLimited(azul_nx2_log_limit_t *limit, const char *func, const char *format, ...);
+  
+  inline void traceRegAccess(azul_nx2_reg_trace_type_t type, UInt32 offset, UInt32 value) {
+    if (regTrace != NULL) {
+      azul_nx2_reg_trace_entry_t *entry = &regTrace[OSIncrementAtomic(&regTraceIndex) & (REG_TRACE_COUNT - 1)];
+      entry->timestamp  = mach_absolute_time();
+      entry->type       = type;
+      entry->offset     = offset;
+      entry->value      = value;
+    }
+  }
+  inline azul_nx2_access_context_t getAccessContext() {
+    if (workLoop == NULL || workLoop->inGate()) {
+      return kAccessContextWorkLoop;
+    }
+    return (linkWorkLoop != NULL && linkWorkLoop->inGate()) ? kAccessContextLink : kAccessContextOutput;
+  }
+  inline void countRegAccess(azul_nx2_access_type_t type) {
+    azul_nx2_access_context_t context = getAccessContext();
+    accessCounts[context][accessBuckets[context]][type]++;
+  }
+  inline azul_nx2_access_bucket_t setAccessBucket(azul_nx2_access_bucket_t bucket) {
+    azul_nx2_access_context_t context     = getAccessContext();
+    azul_nx2_access_bucket_t  prevBucket  = accessBuckets[context];
+    accessBuckets[context] = bucket;
+    return prevBucket;
+  }
+  void publishAccessCounts();
+  void resetAccessCounts();
+  inline void traceEvent(azul_nx2_event_t event, UInt32 arg0, UInt32 arg1) {
+    if (eventTrace != NULL) {
+      azul_nx2_event_trace_entry_t *entry = &eventTrace[OSIncrementAtomic(&eventTraceIndex) & (EVENT_TRACE_COUNT - 1)];
+      entry->timestamp  = mach_absolute_time();
+      entry->event      = event;
+      entry->arg0       = arg0;
+      entry->arg1       = arg1;
+    }
+  }
+  inline void recordHistogram(azul_nx2_histogram_t *histogram, UInt64 value) {
+    nx2HistogramRecord(histogram, value);
+  }
+  inline void recordElapsed(azul_nx2_histogram_t *histogram, UInt64 startTime) {
+    UInt64 elapsedNs;
+    absolutetime_to_nanoseconds(mach_absolute_time() - startTime, &elapsedNs);
+    recordHistogram(histogram, elapsedNs);
+  }
+  inline void recordLatency(azul_nx2_latency_t latency, UInt64 startTime) {
+    recordElapsed(&latencyHistograms[latency], startTime);
+  }
+  OSDictionary *copyHistogramDictionary(const azul_nx2_histogram_t *histogram);
+  void publishLatencyHistograms();
+  void sampleDeviceClock();
+  UInt64 deviceTicksToNs(UInt64 ticks);
+  SInt64 getDeviceClockDriftPpm();
+  void startDeviceLatencyProbe();
+  void completeDeviceLatencyProbe(UInt32 endRaw, UInt16 statusIndex, bool idle);
+  void resetLatencyHistograms();
+  void publishInterruptWork();
+  void resetInterruptWork();
+  void publishTraceRing(const char *name, const void *ring, size_t entrySize, UInt32 ringCount, UInt32 index);
+  bool initRegisterTrace();
+  void freeRegisterTrace();
+  void publishRegisterTrace();
+  bool initEventTrace();
+  void freeEventTrace();
+  void publishEventTrace();
   
   UInt16 readReg16(UInt32 offset);
   UInt32 readReg32(UInt32 offset);
   UInt32 readRegIndr32(UInt32 offset);
   UInt32 readShMem32(UInt32 offset);
-  UInt32 readContext32(UInt32 cid, UInt32 offset);
+  template <typename Chip> UInt32 readContext32(UInt32 cid, UInt32 offset);
+  inline UInt32 readContext32(UInt32 cid, UInt32 offset) {
+    return (this->*chipOps->readContext32)(cid, offset);
+  }
   
   void writeReg16(UInt32 offset, UInt16 value);
   void writeReg32(UInt32 offset, UInt32 value);
   void writeRegIndr32(UInt32 offset, UInt32 value);
   void writeShMem32(UInt32 offset, UInt32 value);
-  void writeContext32(UInt32 cid, UInt32 offset, UInt32 value);
+  template <typename Chip> void writeContext32(UInt32 cid, UInt32 offset, UInt32 value);
+  inline void writeContext32(UInt32 cid, UInt32 offset, UInt32 value) {
+    (this->*chipOps->writeContext32)(cid, offset, value);
+  }
+  
+  void loadShadowRegs();
+  UInt32 readShadowReg(azul_nx2_shadow_reg_t reg);
+  void writeShadowReg(azul_nx2_shadow_reg_t reg, UInt32 value);
+  
+  bool selectChipOps();
   
   bool initEventSources(IOService *provider);
   
@@ -153,16 +688,26 @@ private:
   void enableInterrupts(bool coalNow);
   void disableInterrupts();
   
-  bool allocDmaBuffer(azul_nx2_dma_buf_t *dmaBuf, size_t size, UInt32 alignment);
+  bool allocDmaBuffer(azul_nx2_dma_buf_t *dmaBuf, size_t size, UInt32 alignment, bool cacheable, bool userShared = false);
   void freeDmaBuffer(azul_nx2_dma_buf_t *dmaBuf);
-  
-  bool firmwareSync(UInt32 msgData);
-  bool initContext();
+  bool allocDmaArena(azul_nx2_dma_buf_t *arena, azul_nx2_dma_arena_entry_t *entries, UInt32 count, bool cacheable);
+  void benchmarkDmaBuffers();
+  
+  void postFirmwareSync(UInt32 msgData);
+  bool checkFirmwareSync();
+  void timeoutFirmwareSync();
+  template <typename Chip> bool initContext();
+  inline bool initContext() {
+    return (this->*chipOps->initContext)();
+  }
 
   //
   // Processors
   //
-  void initCpus();
+  template <typename Chip> void initCpus();
+  inline void initCpus() {
+    (this->*chipOps->initCpus)();
+  }
   UInt32 processRv2pFixup(UInt32 rv2pProc, UInt32 index, UInt32 fixup, UInt32 rv2pCode);
   void loadRv2pFirmware(UInt32 rv2pProcessor, const nx2_rv2p_fw_file_entry_t *rv2pEntry);
   void loadCpuFirmware(const cpu_reg_t *cpuReg, const nx2_mips_fw_file_entry_t *mipsEntry);
@@ -173,16 +718,56 @@ private:
   void initCpuTpat();
   void initCpuCom();
   void initCpuCp();
+  void initCpuSampler(azul_nx2_cpu_t cpu, const cpu_reg_t *cpuReg, const nx2_mips_fw_file_entry_t *mipsEntry);
+  void startSampling();
+  void stopSampling();
+  void sampleCpus();
+  void sampleTimerOccurred(IOTimerEventSource *source);
+  void publishCpuSamples();
+  void sampleFtqs();
+  void startFtqBurst();
+  void ftqTimerOccurred(IOTimerEventSource *source);
+  void publishFtqSamples();
+  void resetFtqSamples();
   
   //
   // Controller
   //
   bool prepareController();
-  bool resetController(UInt32 resetCode);
-  bool initControllerChip();
+  template <typename Chip> void resetControllerPrepare(UInt32 resetCode);
+  inline void resetControllerPrepare(UInt32 resetCode) {
+    (this->*chipOps->resetControllerPrepare)(resetCode);
+  }
+  template <typename Chip> void resetControllerCore();
+  inline void resetControllerCore() {
+    (this->*chipOps->resetControllerCore)();
+  }
+  template <typename Chip> bool resetControllerCheck();
+  inline bool resetControllerCheck() {
+    return (this->*chipOps->resetControllerCheck)();
+  }
+  template <typename Chip> bool resetControllerFinish(UInt32 resetCode);
+  inline bool resetControllerFinish(UInt32 resetCode) {
+    return (this->*chipOps->resetControllerFinish)(resetCode);
+  }
+  void initControllerChipEarly();
+  template <typename Chip> void initControllerChipLate();
+  inline void initControllerChipLate() {
+    (this->*chipOps->initControllerChipLate)();
+  }
   bool startController();
   void stopController();
   
+  //
+  // Asynchronous bring-up
+  //
+  bool isBringupActive() const;
+  bool beginBringup(UInt32 resetCode, bool startOnComplete);
+  void setBringupState(azul_nx2_bringup_state_t state, UInt32 timeoutUs);
+  bool isBringupTimedOut();
+  void completeBringup();
+  void bringupTimerOccurred(IOTimerEventSource *source);
+  
   //
   // PHY-related
   //
@@ -193,35 +778,91 @@ private:
   IOReturn enablePHYLoopback();
   IOReturn enablePHYAutoMDIX();
   IOReturn enablePHYAutoNegotiation();
-  
-  void addNetworkMedium(UInt32 index, UInt32 type, UInt32 speed);
+  IOReturn updatePHYPauseAdvertisement();
+  IOReturn setPHYMedium(UInt32 mediumIndex);
+  IOReturn initPHYSerDes();
+  bool hasSerDesSignal();
+  void pollSerDesParallelDetect();
+  IOReturn readCopperLinkState(phy_media_state_t *state, UInt32 *mediumIndex);
+  IOReturn readSerDesLinkState(phy_media_state_t *state, UInt32 *mediumIndex);
+  void enablePHYAutoPoll();
+  bool suspendPHYAutoPoll();
+  void resumePHYAutoPoll();
+  
+  void addNetworkMedium(UInt32 index, UInt32 type, UInt32 speed, const char *name = NULL);
   void createMediumDictionary();
+  IOReturn readPHYMediaState(phy_media_state_t *state, UInt32 *mediumIndex);
+  void applyPHYMediaState(const phy_media_state_t *state, UInt32 mediumIndex);
   void updatePHYMediaState();
+  void updateFlowControl();
+  void publishFlowControl();
   void fetchMacAddress();
   void handlePHYInterrupt(status_block_t *stsBlock);
+  void reportLinkDown();
+  void startLinkMonitor();
+  void stopLinkMonitor();
+  void linkMonitorTimerOccurred(IOTimerEventSource *source);
+  void scheduleLinkUpdate();
+  void cancelLinkUpdate();
+  void linkTimerOccurred(IOTimerEventSource *source);
+  static IOReturn gatedApplyLinkUpdate(OSObject *owner, void *arg0, void *arg1, void *arg2, void *arg3);
   
   
   //
   // Transmit/receive
   //
   void initTxRxRegs();
-  bool initTxRing();
+  template <typename Chip> bool initTxRing();
+  inline bool initTxRing() {
+    return (this->*chipOps->initTxRing)();
+  }
   void freeTxRing();
-  UInt16 readTxCons();
   UInt32 sendTxPacket(mbuf_t packet);
-  void handleTxInterrupt(UInt16 txConsIndexNew);
+  UInt32 handleTxInterrupt(UInt16 txConsIndexNew);
   
   void initRxRegs();
   bool initRxRing();
   bool initRxDescriptor(UInt16 index, bool forceAllocate);
   void freeRxRing();
-  UInt16 readRxCons();
-  void handleRxInterrupt(UInt16 rxConsIndexNew);
+  UInt32 handleRxInterrupt(UInt16 rxConsIndexNew);
   
   void setRxMode(bool promiscuous);
   void setMacAddress();
   
+  //
+  // Loopback self-test
+  //
+  inline bool isSelfTestActive() const {
+    return selfTest.state != kSelfTestStateIdle;
+  }
+  IOReturn beginSelfTest(OSDictionary *config);
+  void cancelSelfTest();
+  bool startSelfTestLoopback();
+  void stopSelfTestLoopback();
+  void sendSelfTestFrames();
+  void checkSelfTestFrame(const rx_l2_header_t *l2Header, UInt16 packetLength);
+  void completeSelfTest();
+  void updateSelfTest();
+  void selfTestTimerOccurred(IOTimerEventSource *source);
+  
+  //
+  // Bypass mode
+  //
+  inline bool isBypassActive() const {
+    return bypass.owner != NULL;
+  }
+  bool allocBypassBuffers();
+  void freeBypassBuffers();
+  void resetBypassQueues();
+  IOReturn attachBypass(IOService *owner);
+  IOReturn detachBypass(IOService *owner);
+  IOReturn kickBypass(IOService *owner, UInt32 *txPosted, UInt32 *rxPosted);
+  UInt32 postBypassTxFrames();
+  UInt32 handleBypassTxInterrupt(UInt16 txConsNew);
+  UInt32 handleBypassRxInterrupt(UInt16 rxConsNew);
+  
   void interruptOccurred(IOInterruptEventSource *source, int count);
+  static IOReturn gatedSetProperties(OSObject *owner, void *arg0, void *arg1, void *arg2, void *arg3);
   
 public:
   //
@@ -230,6 +871,8 @@ public:
   virtual bool start(IOService *provider);
   virtual void stop(IOService *provider);
   virtual void free();
+  virtual IOReturn setProperties(OSObject *properties);
+  virtual IOReturn newUserClient(task_t owningTask, void *securityID, UInt32 type, IOUserClient **handler);
   virtual IOWorkLoop *getWorkLoop() const;
   
 
@@ -257,6 +900,7 @@ public:
   virtual IOReturn setMulticastMode(bool active);
   virtual IOReturn setMulticastList(IOEthernetAddress *addrs, UInt32 count);
   virtual IOReturn setPromiscuousMode(bool active);
+  virtual IOReturn selectMedium(const IONetworkMedium *medium);
   
   
 };
@@ -0,0 +1,205 @@
+/*
+ *
+ * Copyright (c) 2021 Goldfish64
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "AzulNX2Ethernet.h"
+
+//
+// All bypass methods run on the work loop, entry points from the user client go through the command gate.
+//
+
+static_assert(NX2_USER_TX_MAX_LENGTH == MAX_PACKET_SIZE - kIOEthernetCRCSize, "Bypass TX limit must match the stack's");
+
+/**
+ Allocates the packet buffers and shared queues on first use. They are kept until the driver is freed,
+ so a process exiting while the hardware still holds its buffers is harmless.
+ */
+bool AzulNX2Ethernet::allocBypassBuffers() {
+  if (bypass.shared != NULL) {
+    return true;
+  }
+  
+  if (!allocDmaBuffer(&bypass.buffers, NX2_USER_BUFFER_COUNT * NX2_USER_BUFFER_SIZE, PAGESIZE_4K, true, true)) {
+    return false;
+  }
+  
+  bypass.sharedDesc = IOBufferMemoryDescriptor::inTaskWithOptions(kernel_task, kIODirectionInOut | kIOMemoryKernelUserShared,
+                                                                   sizeof (nx2_user_shared_t), PAGESIZE_4K);
+  if (bypass.sharedDesc == NULL) {
+    SYSLOG("Failed to allocate bypass queue memory of %u bytes", sizeof (nx2_user_shared_t));
+    freeDmaBuffer(&bypass.buffers);
+    return false;
+  }
+  bypass.shared = (nx2_user_shared_t*) bypass.sharedDesc->getBytesNoCopy();
+  bypass.rings.buffers          = (UInt8*) bypass.buffers.buffer;
+  bypass.rings.buffersPhysAddr  = bypass.buffers.physAddr;
+  
+  resetBypassQueues();
+  DBGLOG("Allocated %u bypass buffers of %u bytes", NX2_USER_BUFFER_COUNT, NX2_USER_BUFFER_SIZE);
+  return true;
+}
+
+void AzulNX2Ethernet::freeBypassBuffers() {
+  if (bypass.sharedDesc != NULL) {
+    bypass.sharedDesc->release();
+    bypass.sharedDesc = NULL;
+    bypass.shared     = NULL;
+  }
+  freeDmaBuffer(&bypass.buffers);
+}
+
+/**
+ Empties all queues, returning every buffer to the process.
+ */
+void AzulNX2Ethernet::resetBypassQueues() {
+  bzero(bypass.shared, sizeof (nx2_user_shared_t));
+  bypass.shared->version      = NX2_USER_QUEUE_VERSION;
+  bypass.shared->bufferCount  = NX2_USER_BUFFER_COUNT;
+  bypass.shared->bufferSize   = NX2_USER_BUFFER_SIZE;
+  bypass.shared->rxDataOffset = sizeof (rx_l2_header_t) + RX_HEADER_PAD;
+  
+  bypass.rings.rxFillCons     = 0;
+  bypass.rings.rxCompleteProd = 0;
+  bypass.rings.txSubmitCons   = 0;
+  bypass.rings.txCompleteProd = 0;
+  bypass.rings.rxPosted       = 0;
+}
+
+/**
+ Detaches the port from the network stack and hands its rings to owner.
+ The controller is reset so the RX ring can be rebuilt from the rxFill queue.
+ */
+IOReturn AzulNX2Ethernet::attachBypass(IOService *owner) {
+  if (isBypassActive()) {
+    return bypass.owner == owner ? kIOReturnSuccess : kIOReturnExclusiveAccess;
+  }
+  if (!isEnabled || isBringupActive() || isSelfTestActive()) {
+    return kIOReturnNotReady;
+  }
+  if (!allocBypassBuffers()) {
+    return kIOReturnNoMemory;
+  }
+  
+  bypass.owner             = owner;
+  bypass.rings.rxFrames    = 0;
+  bypass.rings.rxDropped   = 0;
+  bypass.rings.rxRejected  = 0;
+  bypass.rings.txFrames    = 0;
+  bypass.rings.txRejected  = 0;
+  
+  txQueue->stop();
+  stopController();
+  if (!beginBringup(NX2_DRV_MSG_CODE_RESET, true)) {
+    bypass.owner = NULL;
+    txQueue->start();
+    return kIOReturnIOError;
+  }
+  
+  SYSLOG("Port detached from the network stack for bypass mode");
+  return kIOReturnSuccess;
+}
+
+/**
+ Returns the port to the network stack. Any buffers still posted to the hardware are returned to the process.
+ */
+IOReturn AzulNX2Ethernet::detachBypass(IOService *owner) {
+  if (bypass.owner != owner) {
+    return kIOReturnNotOpen;
+  }
+  
+  bypass.owner = NULL;
+  if (isEnabled) {
+    stopController();
+  }
+  
+  SYSLOG("Port returned to the network stack, bypass mode received %llu frames (%llu dropped) and sent %llu frames",
+         bypass.rings.rxFrames, bypass.rings.rxDropped, bypass.rings.txFrames);
+  resetBypassQueues();
+  
+  if (isEnabled && !beginBringup(NX2_DRV_MSG_CODE_RESET, true)) {
+    SYSLOG("Controller bring-up failed to start!");
+    return kIOReturnIOError;
+  }
+  return kIOReturnSuccess;
+}
+
+/**
+ Posts pending rxFill and txSubmit entries to the hardware and rings the doorbells.
+ */
+IOReturn AzulNX2Ethernet::kickBypass(IOService *owner, UInt32 *txPosted, UInt32 *rxPosted) {
+  *txPosted = 0;
+  *rxPosted = 0;
+  
+  if (bypass.owner != owner) {
+    return kIOReturnNotOpen;
+  }
+  if (isBringupActive()) {
+    return kIOReturnNotReady;
+  }
+  
+  *rxPosted = nx2UserFillRx(bypass.shared, &bypass.rings, &rxRing);
+  if (*rxPosted > 0) {
+    nx2RxRingDoorbell(&ringRegs, &rxRing);
+  }
+  
+  *txPosted = postBypassTxFrames();
+  return kIOReturnSuccess;
+}
+
+/**
+ Moves frames from the txSubmit queue into TX BDs and rings the TX doorbell once for the batch.
+ */
+UInt32 AzulNX2Ethernet::postBypassTxFrames() {
+  UInt32 posted;
+  UInt64 postTime = mach_absolute_time();
+  
+  posted = nx2UserPostTx(bypass.shared, &bypass.rings, &txRing, [&](UInt16 txIndex, UInt32 buffer) {
+    txDoorbellTimes[txIndex] = postTime;
+  });
+  
+  if (posted > 0) {
+    nx2TxRingDoorbell(&ringRegs, &txRing);
+  }
+  return posted;
+}
+
+UInt32 AzulNX2Ethernet::handleBypassTxInterrupt(UInt16 txConsNew) {
+  return nx2UserReclaimTx(bypass.shared, &bypass.rings, &txRing, txConsNew, [this](UInt16 txIndex) {
+    recordLatency(kLatencyTxCompletion, txDoorbellTimes[txIndex]);
+  });
+}
+
+UInt32 AzulNX2Ethernet::handleBypassRxInterrupt(UInt16 rxConsNew) {
+  UInt32                rxPackets;
+  UInt64                batchStartTime = mach_absolute_time();
+  
+  rxPackets = nx2UserHarvestRx(bypass.shared, &bypass.rings, &rxRing, rxConsNew, [this](UInt16 rxIndex, rx_l2_header_t *l2Header) {
+    if (l2Header->errors != 0) {
+      traceEvent(kEventRxError, rxIndex, ((UInt32) l2Header->errors << 16) | l2Header->status);
+    }
+  });
+  nx2RxRingDoorbell(&ringRegs, &rxRing);
+  
+  recordLatency(kLatencyRxBatch, batchStartTime);
+  recordLatency(kLatencyRxDelivery, interruptTime);
+  return rxPackets;
+}
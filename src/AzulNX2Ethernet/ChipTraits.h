@@ -0,0 +1,94 @@
+/*
+ *
+ * Copyright (c) 2021 Goldfish64
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __CHIP_TRAITS_H__
+#define __CHIP_TRAITS_H__
+
+//
+// Compile-time chip family traits.
+// Context, ring, reset, and firmware code is instantiated once per family so chip checks are resolved at compile time.
+//   - is5709:      5709/5716 core. Has NEW_CORE_CTL DMA enable, binary MQ mode, and its own firmware.
+//   - miscEnable:  MISC_ENABLE bits set when the controller is started.
+//   - resetWaitMs: fixed wait after the core reset, for chips that cannot be accessed while resetting.
+//
+struct nx2_chip_5706_t {
+  static const bool   is5709      = false;
+  static const bool   hostContext = false;
+  static const UInt8  dmaBits     = 64;
+  static const UInt32 miscEnable  = NX2_MISC_ENABLE_DEFAULT;
+  static const UInt32 resetWaitMs = 0;
+};
+
+//
+// The BCM5708 cannot use more than 40 bit addresses.
+//
+struct nx2_chip_5708_t {
+  static const bool   is5709      = false;
+  static const bool   hostContext = false;
+  static const UInt8  dmaBits     = 40;
+  static const UInt32 miscEnable  = NX2_MISC_ENABLE_DEFAULT;
+  static const UInt32 resetWaitMs = 0;
+};
+
+//
+// 5709 and 5716 do not have on-chip context memory, and require 500 uS to reset.
+//
+struct nx2_chip_5709_t {
+  static const bool   is5709      = true;
+  static const bool   hostContext = true;
+  static const UInt8  dmaBits     = 64;
+  static const UInt32 miscEnable  = NX2_MISC_ENABLE_DEFAULT_XI;
+  static const UInt32 resetWaitMs = 50;
+};
+
+//
+// Physical address mask for the number of DMA address bits supported.
+//
+static inline mach_vm_address_t nx2DmaMask(UInt8 dmaBits) {
+  return dmaBits >= 64 ? ~0ULL : (1ULL << dmaBits) - 1;
+}
+
+class AzulNX2Ethernet;
+
+//
+// Per-instance chip operations, selected once the chip ID is known.
+//
+typedef struct {
+  bool                hostContext;
+  UInt8               dmaBits;
+  UInt32              miscEnable;
+  UInt32              resetWaitMs;
+  
+  UInt32  (AzulNX2Ethernet::*readContext32)(UInt32 cid, UInt32 offset);
+  void    (AzulNX2Ethernet::*writeContext32)(UInt32 cid, UInt32 offset, UInt32 value);
+  bool    (AzulNX2Ethernet::*initContext)();
+  bool    (AzulNX2Ethernet::*initTxRing)();
+  void    (AzulNX2Ethernet::*resetControllerPrepare)(UInt32 resetCode);
+  void    (AzulNX2Ethernet::*resetControllerCore)();
+  bool    (AzulNX2Ethernet::*resetControllerCheck)();
+  bool    (AzulNX2Ethernet::*resetControllerFinish)(UInt32 resetCode);
+  void    (AzulNX2Ethernet::*initControllerChipLate)();
+  void    (AzulNX2Ethernet::*initCpus)();
+} nx2_chip_ops_t;
+
+#endif
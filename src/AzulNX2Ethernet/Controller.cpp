@@ -49,6 +49,11 @@ bool AzulNX2Ethernet::prepareController() {
       return false;
   }
   
+  if (!selectChipOps()) {
+    SYSLOG("Unsupported controller 0x%X", NX2_CHIP_NUM);
+    return false;
+  }
+  
   pciVendorId    = readReg16(kIOPCIConfigVendorID);
   pciDeviceId    = readReg16(kIOPCIConfigDeviceID);
   pciSubVendorId = readReg16(kIOPCIConfigSubSystemVendorID);
@@ -85,6 +90,11 @@ bool AzulNX2Ethernet::prepareController() {
   
   DBGLOG("Shared memory is at 0x%08X", shMemBase);
   
+  //
+  // MAC address is needed before the interface is attached, which occurs before bring-up completes.
+  //
+  fetchMacAddress();
+  
   //
   // Create memory cursors for TX and RX.
   //
@@ -95,24 +105,56 @@ bool AzulNX2Ethernet::prepareController() {
   }
   
   //
-  // Allocate status, statistics, transmit, and receive buffers.
+  // On-chip processors and queues are sampled at a low rate unless disabled.
   //
-  if (!allocDmaBuffer(&statusBuffer, 0x1000, PAGESIZE_16)) {
-    return false;
-  }
-  if (!allocDmaBuffer(&statsBuffer, 0x1000, PAGESIZE_16)) {
-    freeDmaBuffer(&statusBuffer);
-    return false;
-  }
-  if (!allocDmaBuffer(&txBuffer, TX_PAGE_SIZE, PAGESIZE_4K)) {
-    freeDmaBuffer(&statusBuffer);
-    freeDmaBuffer(&statsBuffer);
-    return false;
+  OSNumber *sampleProp = OSDynamicCast(OSNumber, getProperty("SampleInterval"));
+  sampleInterval = sampleProp != NULL ? sampleProp->unsigned32BitValue() : SAMPLE_INTERVAL_MS;
+  OSNumber *ftqSampleProp = OSDynamicCast(OSNumber, getProperty("FtqSampleInterval"));
+  ftqSampleInterval = ftqSampleProp != NULL ? ftqSampleProp->unsigned32BitValue() : FTQ_SAMPLE_INTERVAL_US;
+  
+  //
+  // The EMAC polls the PHY for link status unless disabled by the PHYAutoPoll property.
+  //
+  OSBoolean *autoPollProp = OSDynamicCast(OSBoolean, getProperty("PHYAutoPoll"));
+  phyAutoPoll = autoPollProp == NULL || autoPollProp->isTrue();
+  OSNumber *linkMonitorProp = OSDynamicCast(OSNumber, getProperty("LinkMonitorInterval"));
+  linkMonitorInterval = linkMonitorProp != NULL ? linkMonitorProp->unsigned32BitValue() : LINK_MONITOR_INTERVAL_US;
+  
+  //
+  // Pause frames are negotiated in both directions unless restricted by the FlowControl property.
+  //
+  OSString *flowProp = OSDynamicCast(OSString, getProperty("FlowControl"));
+  flowControlPolicy = kFlowControlBoth;
+  if (flowProp != NULL) {
+    if (flowProp->isEqualTo("None")) {
+      flowControlPolicy = kFlowControlNone;
+    } else if (flowProp->isEqualTo("RX")) {
+      flowControlPolicy = kFlowControlRx;
+    } else if (flowProp->isEqualTo("TX")) {
+      flowControlPolicy = kFlowControlTx;
+    }
   }
-  if (!allocDmaBuffer(&rxBuffer, RX_PAGE_SIZE, PAGESIZE_4K)) {
-    freeDmaBuffer(&statusBuffer);
-    freeDmaBuffer(&statsBuffer);
-    freeDmaBuffer(&txBuffer);
+  
+  //
+  // Shadowed registers are checked against hardware on every use if verification is enabled.
+  //
+  OSBoolean *verifyProp = OSDynamicCast(OSBoolean, getProperty("VerifyShadowRegisters"));
+  shadowRegsVerify = verifyProp != NULL && verifyProp->isTrue();
+  
+  //
+  // Allocate status, statistics, transmit, and receive buffers from a single arena.
+  // These may be cacheable if enabled and the platform is cache coherent.
+  //
+  OSBoolean *cacheableProp = OSDynamicCast(OSBoolean, getProperty("CacheableDescriptors"));
+  cacheableDescriptors = DMA_COHERENT_PLATFORM && (cacheableProp == NULL || cacheableProp->isTrue());
+  
+  azul_nx2_dma_arena_entry_t arenaEntries[] = {
+    { &txBuffer,      "TX",         TX_PAGE_SIZE,       PAGESIZE_4K },
+    { &rxBuffer,      "RX",         RX_PAGE_SIZE,       PAGESIZE_4K },
+    { &statusBuffer,  "Status",     STATUS_BLOCK_SIZE,  PAGESIZE_64 },
+    { &statsBuffer,   "Statistics", STATS_BLOCK_SIZE,   PAGESIZE_64 }
+  };
+  if (!allocDmaArena(&arenaBuffer, arenaEntries, sizeof (arenaEntries) / sizeof (arenaEntries[0]), cacheableDescriptors)) {
     return false;
   }
   
@@ -120,12 +162,9 @@ bool AzulNX2Ethernet::prepareController() {
   // 5709 and 5716 do not have on-chip context memory.
   // It is required to allocate host memory for this purpose.
   //
-  if (NX2_CHIP_NUM == NX2_CHIP_NUM_5709) {
-    if (!allocDmaBuffer(&contextBuffer, CTX_PAGE_SIZE * CTX_PAGE_CNT, PAGESIZE_4K)) {
-      freeDmaBuffer(&statusBuffer);
-      freeDmaBuffer(&statsBuffer);
-      freeDmaBuffer(&txBuffer);
-      freeDmaBuffer(&rxBuffer);
+  if (chipOps->hostContext) {
+    if (!allocDmaBuffer(&contextBuffer, CTX_PAGE_SIZE * CTX_PAGE_CNT, PAGESIZE_4K, false)) {
+      freeDmaBuffer(&arenaBuffer);
       return false;
     }
   }
@@ -133,15 +172,15 @@ bool AzulNX2Ethernet::prepareController() {
   //
   // Ensure packet arrays are clear.
   //
-  memset(txPackets, 0, sizeof (txPackets));
-  memset(rxPackets, 0, sizeof (rxPackets));
+  memset(txRing.packets, 0, sizeof (txRing.packets));
+  memset(rxRing.packets, 0, sizeof (rxRing.packets));
   
   return true;
 }
 
-bool AzulNX2Ethernet::resetController(UInt32 resetCode) {
-  bool success  = false;
-  UInt32 reg    = 0;
+template <typename Chip>
+void AzulNX2Ethernet::resetControllerPrepare(UInt32 resetCode) {
+  UInt32 reg = 0;
   
   //
   // Ensure all pending PCI transactions are completed.
@@ -157,93 +196,100 @@ bool AzulNX2Ethernet::resetController(UInt32 resetCode) {
   //
   // Disable DMA.
   //
-  if (NX2_CHIP_NUM == NX2_CHIP_NUM_5709) {
+  if (Chip::is5709) {
     reg = readReg32(NX2_MISC_NEW_CORE_CTL);
     reg &= ~NX2_MISC_NEW_CORE_CTL_DMA_ENABLE;
     writeReg32(NX2_MISC_NEW_CORE_CTL, reg);
   }
   
-  do {
-    //
-    // Prepare firmware for software reset.
-    //
-    if (!firmwareSync(NX2_DRV_MSG_DATA_WAIT0 | resetCode)) {
-      IOLog("AzulNX2Ethernet: reset signal timeout!\n");
-      break;
-    }
-    writeShMem32(NX2_DRV_RESET_SIGNATURE, NX2_DRV_RESET_SIGNATURE_MAGIC);
-    readReg32(NX2_MISC_ID);
-    
-    //
-    // Reset controller. 5709 and 5716 use a different reset method.
-    //
-    // 5709/5716 requires 500 uS to reset.
-    // Others require 30 uS.
-    //
-    if (NX2_CHIP_NUM == NX2_CHIP_NUM_5709) {
-      writeReg32(NX2_MISC_COMMAND, NX2_MISC_COMMAND_SW_RESET);
-      readReg32(NX2_MISC_COMMAND);
-      IOSleep(50);
-      
-      pciNub->configWrite32(NX2_PCICFG_MISC_CONFIG,
-                            NX2_PCICFG_MISC_CONFIG_REG_WINDOW_ENA |
-                            NX2_PCICFG_MISC_CONFIG_TARGET_MB_WORD_SWAP);
-    } else {
-      writeReg32(NX2_PCICFG_MISC_CONFIG,
-                 NX2_PCICFG_MISC_CONFIG_CORE_RST_REQ |
-                 NX2_PCICFG_MISC_CONFIG_REG_WINDOW_ENA |
-                 NX2_PCICFG_MISC_CONFIG_TARGET_MB_WORD_SWAP);
-      
-      for (int i = 0; i < 10; i++) {
-        reg = readReg32(NX2_PCICFG_MISC_CONFIG);
-        if ((reg & (NX2_PCICFG_MISC_CONFIG_CORE_RST_REQ | NX2_PCICFG_MISC_CONFIG_CORE_RST_BSY)) == 0) {
-          break;
-        }
-        
-        IODelay(10);
-      }
-      
-      //
-      // Verify reset completed.
-      //
-      if ((reg & (NX2_PCICFG_MISC_CONFIG_CORE_RST_REQ | NX2_PCICFG_MISC_CONFIG_CORE_RST_BSY))) {
-        IOLog("AzulNX2Ethernet: reset timeout!\n");
-        break;
-      }
-    }
-    
-    //
-    // Ensure byte swapping is configured.
-    //
-    reg = readReg32(NX2_PCI_SWAP_DIAG0);
-    if (reg != 0x01020304) {
-      IOLog("AzulNX2Ethernet: byte swapping is invalid!\n");
-      break;
-    }
-    
-    //
-    // Wait for firmware to initialize again.
-    //
-    IOLog("AzulNX2Ethernet: NX2_DRV_MSG_DATA_WAIT1\n");
-    if (!firmwareSync(NX2_DRV_MSG_DATA_WAIT1 | resetCode)) {
-      IOLog("AzulNX2Ethernet: failed 33\n");
-      break;
-    }
-    
-    success = true;
-    IOLog("AzulNX2Ethernet: reset completed\n");
-  } while (false);
+  //
+  // Prepare firmware for software reset.
+  //
+  postFirmwareSync(NX2_DRV_MSG_DATA_WAIT0 | resetCode);
+}
+
+template <typename Chip>
+void AzulNX2Ethernet::resetControllerCore() {
+  writeShMem32(NX2_DRV_RESET_SIGNATURE, NX2_DRV_RESET_SIGNATURE_MAGIC);
+  readReg32(NX2_MISC_ID);
   
   //
-  // TODO: Restore EMAC for ASF and IPMI.
+  // Reset controller. 5709 and 5716 use a different reset method.
+  //
+  // 5709/5716 requires 500 uS to reset.
+  // Others require 30 uS.
   //
+  if (Chip::hostContext) {
+    writeReg32(NX2_MISC_COMMAND, NX2_MISC_COMMAND_SW_RESET);
+    readReg32(NX2_MISC_COMMAND);
+  } else {
+    writeReg32(NX2_PCICFG_MISC_CONFIG,
+               NX2_PCICFG_MISC_CONFIG_CORE_RST_REQ |
+               NX2_PCICFG_MISC_CONFIG_REG_WINDOW_ENA |
+               NX2_PCICFG_MISC_CONFIG_TARGET_MB_WORD_SWAP);
+  }
+}
+
+/**
+ Checks if the core reset has completed. 5709/5716 are given a fixed delay by the caller instead.
+ */
+template <typename Chip>
+bool AzulNX2Ethernet::resetControllerCheck() {
+  UInt32 reg;
   
+  if (Chip::hostContext) {
+    return true;
+  }
   
+  reg = readReg32(NX2_PCICFG_MISC_CONFIG);
+  return (reg & (NX2_PCICFG_MISC_CONFIG_CORE_RST_REQ | NX2_PCICFG_MISC_CONFIG_CORE_RST_BSY)) == 0;
+}
 
-  return success;
+template void AzulNX2Ethernet::resetControllerPrepare<nx2_chip_5706_t>(UInt32 resetCode);
+template void AzulNX2Ethernet::resetControllerPrepare<nx2_chip_5708_t>(UInt32 resetCode);
+template void AzulNX2Ethernet::resetControllerPrepare<nx2_chip_5709_t>(UInt32 resetCode);
+template void AzulNX2Ethernet::resetControllerCore<nx2_chip_5706_t>();
+template void AzulNX2Ethernet::resetControllerCore<nx2_chip_5708_t>();
+template void AzulNX2Ethernet::resetControllerCore<nx2_chip_5709_t>();
+template bool AzulNX2Ethernet::resetControllerCheck<nx2_chip_5706_t>();
+template bool AzulNX2Ethernet::resetControllerCheck<nx2_chip_5708_t>();
+template bool AzulNX2Ethernet::resetControllerCheck<nx2_chip_5709_t>();
+
+template <typename Chip>
+bool AzulNX2Ethernet::resetControllerFinish(UInt32 resetCode) {
+  UInt32 reg;
+  
+  if (Chip::is5709) {
+    pciNub->configWrite32(NX2_PCICFG_MISC_CONFIG,
+                          NX2_PCICFG_MISC_CONFIG_REG_WINDOW_ENA |
+                          NX2_PCICFG_MISC_CONFIG_TARGET_MB_WORD_SWAP);
+  }
+  
+  //
+  // Ensure byte swapping is configured.
+  //
+  reg = readReg32(NX2_PCI_SWAP_DIAG0);
+  if (reg != 0x01020304) {
+    SYSLOG("Byte swapping is invalid!");
+    return false;
+  }
+  
+  //
+  // Wait for firmware to initialize again.
+  //
+  postFirmwareSync(NX2_DRV_MSG_DATA_WAIT1 | resetCode);
+  
+  //
+  // TODO: Restore EMAC for ASF and IPMI.
+  //
+  return true;
 }
 
-bool AzulNX2Ethernet::initControllerChip() {
+template bool AzulNX2Ethernet::resetControllerFinish<nx2_chip_5706_t>(UInt32 resetCode);
+template bool AzulNX2Ethernet::resetControllerFinish<nx2_chip_5708_t>(UInt32 resetCode);
+template bool AzulNX2Ethernet::resetControllerFinish<nx2_chip_5709_t>(UInt32 resetCode);
+
+void AzulNX2Ethernet::initControllerChipEarly() {
   UInt32 reg = 0;
   
   disableInterrupts();
@@ -275,14 +321,11 @@ bool AzulNX2Ethernet::initControllerChip() {
              NX2_MISC_ENABLE_SET_BITS_HOST_COALESCE_ENABLE |
              NX2_MISC_ENABLE_STATUS_BITS_RX_V2P_ENABLE |
              NX2_MISC_ENABLE_STATUS_BITS_CONTEXT_ENABLE);
-  
-  //
-  // Initialize context and start CPUs.
-  //
-  if (!initContext()) {
-    return false;
-  }
-  initCpus();
+}
+
+template <typename Chip>
+void AzulNX2Ethernet::initControllerChipLate() {
+  UInt32 reg = 0;
   
   writeReg32(NX2_EMAC_ATTENTION_ENA, NX2_EMAC_ATTENTION_ENA_LINK);
   
@@ -291,7 +334,7 @@ bool AzulNX2Ethernet::initControllerChip() {
   reg &= ~NX2_MQ_CONFIG_KNL_BYP_BLK_SIZE;
   reg |= NX2_MQ_CONFIG_KNL_BYP_BLK_SIZE_256;
   
-  if (NX2_CHIP_NUM == NX2_CHIP_NUM_5709) {
+  if (Chip::is5709) {
     reg |= NX2_MQ_CONFIG_BIN_MQ_MODE;
     if (NX2_CHIP_ID == NX2_CHIP_ID_5709_A1) {
       reg |= NX2_MQ_CONFIG_HALT_DIS;
@@ -307,8 +350,6 @@ bool AzulNX2Ethernet::initControllerChip() {
   
   writeReg32(NX2_EMAC_RX_MTU_SIZE, MAX_PACKET_SIZE);
   
-  fetchMacAddress();
-  
   //
   // Set status and statistics block addresses.
   //
@@ -327,42 +368,56 @@ bool AzulNX2Ethernet::initControllerChip() {
   
   writeReg32(NX2_HC_COMMAND, NX2_HC_COMMAND_CLR_STAT_NOW);
   writeReg32(NX2_HC_ATTN_BITS_ENABLE, 0x1);
+  
+  //
+  // Driver-owned control registers are only modified through their shadows from here on.
+  //
+  loadShadowRegs();
 #define NX2_RXP_PM_CTRL      0x0e00d0
   /* Set the perfect match control register to default. */
   writeRegIndr32(NX2_RXP_PM_CTRL, 0);
   
-  if (NX2_CHIP_NUM == NX2_CHIP_NUM_5709) {
-    reg = readReg32(NX2_MISC_NEW_CORE_CTL);
-    reg |= NX2_MISC_NEW_CORE_CTL_DMA_ENABLE;
-    writeReg32(NX2_MISC_NEW_CORE_CTL, reg);
+  if (Chip::is5709) {
+    writeShadowReg(kShadowRegMiscNewCoreCtl, readShadowReg(kShadowRegMiscNewCoreCtl) | NX2_MISC_NEW_CORE_CTL_DMA_ENABLE);
   }
   
-
-  
-  firmwareSync(NX2_DRV_MSG_DATA_WAIT2 | NX2_DRV_MSG_CODE_RESET);
-  
-
-
-  return true;
+  postFirmwareSync(NX2_DRV_MSG_DATA_WAIT2 | NX2_DRV_MSG_CODE_RESET);
 }
 
+template void AzulNX2Ethernet::initControllerChipLate<nx2_chip_5706_t>();
+template void AzulNX2Ethernet::initControllerChipLate<nx2_chip_5708_t>();
+template void AzulNX2Ethernet::initControllerChipLate<nx2_chip_5709_t>();
+
 bool AzulNX2Ethernet::startController() {
   setRxMode(false);
   
-  if (NX2_CHIP_NUM == NX2_CHIP_NUM_5709) {
-    writeReg32(NX2_MISC_ENABLE_SET_BITS, NX2_MISC_ENABLE_DEFAULT_XI);
-  } else {
-    writeReg32(NX2_MISC_ENABLE_SET_BITS, NX2_MISC_ENABLE_DEFAULT);
-  }
+  writeReg32(NX2_MISC_ENABLE_SET_BITS, chipOps->miscEnable);
   readReg32(NX2_MISC_ENABLE_SET_BITS);
   IODelay(20);
+  
+  if (benchmarkDescriptors) {
+    benchmarkDescriptors = false;
+    benchmarkDmaBuffers();
+  }
 
   initTxRing();
   initRxRing();
   
   enableInterrupts(true);
   
+  if (phyType != kPhyTypeCopper) {
+    initPHYSerDes();
+  }
+  enablePHYAutoPoll();
+  if (selectedMediumIndex != kMediumTypeIndexAuto) {
+    setPHYMedium(selectedMediumIndex);
+  } else {
+    updatePHYPauseAdvertisement();
+  }
   updatePHYMediaState();
+  if (phyType == kPhyTypeSerDes5706) {
+    linkTimer->setTimeoutMS(SERDES_POLL_INTERVAL_MS);
+  }
   
   //resetPHY();
  // enablePHYAutoMDIX();
@@ -383,4 +438,262 @@ void AzulNX2Ethernet::stopController() {
   IODelay(20);
   
   disableInterrupts();
+  
+  //
+  // Packets still posted for TX will never complete, the ring is rebuilt empty when the controller is started again.
+  //
+  freeTxRing();
+}
+
+static const char *bringupStateNames[kBringupStateCount] = {
+  "Idle",
+  "Reset",
+  "WAIT0",
+  "Core reset",
+  "WAIT1",
+  "Context init",
+  "CPU load",
+  "WAIT2",
+  "Done",
+  "Failed"
+};
+
+bool AzulNX2Ethernet::isBringupActive() const {
+  return bringupState != kBringupStateIdle &&
+         bringupState != kBringupStateDone &&
+         bringupState != kBringupStateFailed;
+}
+
+/**
+ Starts an asynchronous reset and initialization of the controller.
+ If startOnComplete is set, the controller is started and enabled once bring-up finishes.
+ */
+bool AzulNX2Ethernet::beginBringup(UInt32 resetCode, bool startOnComplete) {
+  if (bringupTimer == NULL) {
+    return false;
+  }
+  
+  stopSampling();
+  stopLinkMonitor();
+  cancelSelfTest();
+  
+  //
+  // The device timer restarts with the chip, so correlation starts over.
+  //
+  bzero(&deviceClock, sizeof (deviceClock));
+  
+  bringupResetCode    = resetCode;
+  bringupStartPending = startOnComplete;
+  memset(bringupPhaseTimes, 0, sizeof (bringupPhaseTimes));
+  
+  clock_get_uptime(&bringupStartTime);
+  bringupPhaseStartTime = bringupStartTime;
+  bringupState          = kBringupStateReset;
+  
+  //
+  // Cancelled once bring-up is active, so a link resolution starting afterwards sees it and leaves the PHY alone.
+  //
+  cancelLinkUpdate();
+  
+  bringupTimer->setTimeoutUS(1);
+  return true;
+}
+
+/**
+ Moves bring-up to the next phase, recording how long the previous phase took.
+ */
+void AzulNX2Ethernet::setBringupState(azul_nx2_bringup_state_t state, UInt32 timeoutUs) {
+  UInt64 now;
+  UInt64 elapsedNs;
+  UInt64 timeoutAbs;
+  
+  clock_get_uptime(&now);
+  absolutetime_to_nanoseconds(now - bringupPhaseStartTime, &elapsedNs);
+  bringupPhaseTimes[bringupState] = (UInt32) (elapsedNs / 1000);
+  DBGLOG("Bring-up phase %s completed in %u us", bringupStateNames[bringupState], bringupPhaseTimes[bringupState]);
+  
+  nanoseconds_to_absolutetime((UInt64) timeoutUs * 1000, &timeoutAbs);
+  bringupPhaseStartTime = now;
+  bringupDeadline       = now + timeoutAbs;
+  bringupState          = state;
+}
+
+bool AzulNX2Ethernet::isBringupTimedOut() {
+  UInt64 now;
+  
+  clock_get_uptime(&now);
+  return now > bringupDeadline;
+}
+
+void AzulNX2Ethernet::completeBringup() {
+  UInt64 now;
+  UInt64 elapsedNs;
+  OSDictionary *timings;
+  
+  clock_get_uptime(&now);
+  absolutetime_to_nanoseconds(now - bringupStartTime, &elapsedNs);
+  SYSLOG("Controller bring-up completed in %llu us", elapsedNs / 1000);
+  
+  //
+  // Publish per-phase timings.
+  //
+  timings = OSDictionary::withCapacity(kBringupStateCount);
+  if (timings != NULL) {
+    for (UInt32 i = kBringupStateReset; i < kBringupStateDone; i++) {
+      OSNumber *num = OSNumber::withNumber(bringupPhaseTimes[i], 32);
+      if (num != NULL) {
+        timings->setObject(bringupStateNames[i], num);
+        num->release();
+      }
+    }
+    setProperty("BringupTimings", timings);
+    timings->release();
+  }
+  publishRegisterTrace();
+  
+  //
+  // The PHY is identified from the bond ID and shared memory, which are only valid once the reset has completed.
+  //
+  if (mediumDict == NULL) {
+    probePHY();
+    createMediumDictionary();
+  }
+  startSampling();
+  
+  if (!bringupStartPending) {
+    return;
+  }
+  bringupStartPending = false;
+  
+  startController();
+  
+  //
+  // The network stack stays detached while in bypass mode.
+  //
+  if (!isBypassActive()) {
+    txQueue->setCapacity(TX_QUEUE_LENGTH);
+    txQueue->start();
+  }
+  
+  isEnabled = true;
+  DBGLOG("Controller is now enabled");
+}
+
+void AzulNX2Ethernet::bringupTimerOccurred(IOTimerEventSource *source) {
+  azul_nx2_access_bucket_t  prevBucket;
+  UInt32                    pollMs = BRINGUP_POLL_INTERVAL_MS;
+  
+  prevBucket = setAccessBucket(kAccessBucketInit);
+  switch (bringupState) {
+    case kBringupStateReset:
+      resetControllerPrepare(bringupResetCode);
+      setBringupState(kBringupStateWait0, BRINGUP_FW_TIMEOUT_US);
+      break;
+      
+    case kBringupStateWait0:
+      if (!checkFirmwareSync()) {
+        if (isBringupTimedOut()) {
+          timeoutFirmwareSync();
+          SYSLOG("Reset signal timeout!");
+          setBringupState(kBringupStateFailed, 0);
+        }
+        break;
+      }
+      
+      resetControllerCore();
+      setBringupState(kBringupStateCoreReset, BRINGUP_RESET_TIMEOUT_US);
+      
+      //
+      // 5709/5716 cannot be accessed during reset and are given a fixed amount of time.
+      //
+      if (chipOps->resetWaitMs != 0) {
+        pollMs = chipOps->resetWaitMs;
+      }
+      break;
+      
+    case kBringupStateCoreReset:
+      if (!resetControllerCheck()) {
+        if (isBringupTimedOut()) {
+          SYSLOG("Reset timeout!");
+          setBringupState(kBringupStateFailed, 0);
+        }
+        break;
+      }
+      
+      if (!resetControllerFinish(bringupResetCode)) {
+        setBringupState(kBringupStateFailed, 0);
+        break;
+      }
+      setBringupState(kBringupStateWait1, BRINGUP_FW_TIMEOUT_US);
+      break;
+      
+    case kBringupStateWait1:
+      if (!checkFirmwareSync()) {
+        if (isBringupTimedOut()) {
+          timeoutFirmwareSync();
+          setBringupState(kBringupStateFailed, 0);
+        }
+        break;
+      }
+      DBGLOG("Reset completed");
+      
+      initControllerChipEarly();
+      setBringupState(kBringupStateContext, 0);
+      pollMs = 0;
+      break;
+      
+    case kBringupStateContext:
+      if (!initContext()) {
+        SYSLOG("Context initialization failed!");
+        setBringupState(kBringupStateFailed, 0);
+        break;
+      }
+      setBringupState(kBringupStateCpus, 0);
+      pollMs = 0;
+      break;
+      
+    case kBringupStateCpus:
+      initCpus();
+      initControllerChipLate();
+      setBringupState(kBringupStateWait2, BRINGUP_FW_TIMEOUT_US);
+      break;
+      
+    case kBringupStateWait2:
+      //
+      // A timeout here is not fatal.
+      //
+      if (!checkFirmwareSync()) {
+        if (!isBringupTimedOut()) {
+          break;
+        }
+        timeoutFirmwareSync();
+      }
+      
+      setBringupState(kBringupStateDone, 0);
+      completeBringup();
+      break;
+      
+    default:
+      break;
+  }
+  
+  if (bringupState == kBringupStateFailed) {
+    SYSLOG("Controller bring-up failed!");
+    publishRegisterTrace();
+    bringupStartPending = false;
+    setAccessBucket(prevBucket);
+    return;
+  }
+  
+  //
+  // Yield to the work loop between phases.
+  //
+  if (isBringupActive()) {
+    if (pollMs == 0) {
+      bringupTimer->setTimeoutUS(1);
+    } else {
+      bringupTimer->setTimeoutMS(pollMs);
+    }
+  }
+  setAccessBucket(prevBucket);
 }
@@ -52,6 +52,14 @@ typedef struct {
   UInt32  mipsViewBase;
 } cpu_reg_t;
 
+//
+// State bits common to all on-chip MIPS processors that indicate the processor has halted.
+//
+#define CPU_STATE_HALTED_MASK           (NX2_RXP_CPU_STATE_BAD_INST_HALTED | NX2_RXP_CPU_STATE_PAGE_0_DATA_HALTED | \
+                                         NX2_RXP_CPU_STATE_PAGE_0_INST_HALTED | NX2_RXP_CPU_STATE_BAD_DATA_ADDR_HALTED | \
+                                         NX2_RXP_CPU_STATE_BAD_pc_HALTED | NX2_RXP_CPU_STATE_ALIGN_HALTED | \
+                                         NX2_RXP_CPU_STATE_FIO_ABORT_HALTED | NX2_RXP_CPU_STATE_SOFT_HALTED)
+
 typedef struct {
   UInt32  address;
   UInt32  length;
@@ -0,0 +1,91 @@
+/*
+ *
+ * Copyright (c) 2021 Goldfish64
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __HISTOGRAM_H__
+#define __HISTOGRAM_H__
+
+//
+// OS-independent histogram and interrupt work accounting, shared with the host tests.
+// The platform including this header must provide the UInt types.
+//
+
+//
+// Log2-bucketed histograms. Bucket 0 holds zero values, and bucket n holds values in [2^(n-1), 2^n).
+// Values beyond the last bucket are counted in it.
+//
+#define HISTOGRAM_BUCKETS     32
+
+typedef struct {
+  UInt64                    count;
+  UInt64                    sum;
+  UInt64                    buckets[HISTOGRAM_BUCKETS];
+} azul_nx2_histogram_t;
+
+static inline UInt32 nx2HistogramGetBucket(UInt64 value) {
+  UInt32 bucket = value == 0 ? 0 : 64 - __builtin_clzll(value);
+  return bucket < HISTOGRAM_BUCKETS ? bucket : HISTOGRAM_BUCKETS - 1;
+}
+
+static inline void nx2HistogramRecord(azul_nx2_histogram_t *histogram, UInt64 value) {
+  histogram->buckets[nx2HistogramGetBucket(value)]++;
+  histogram->count++;
+  histogram->sum += value;
+}
+
+//
+// Per-interrupt work accounting, published as the InterruptWork property by setting DumpInterruptWork.
+// Batch histograms count RX packets harvested, TX BDs reclaimed and status index advance per pass;
+// handler histograms are the time in nanoseconds spent in each handler when it ran.
+// A pass is idle when it found no link change and no TX or RX work.
+//
+typedef enum {
+  kWorkRxPackets = 0,
+  kWorkTxReclaimed,
+  kWorkStatusDelta,
+  kWorkLinkTime,
+  kWorkTxTime,
+  kWorkRxTime,
+  kWorkCount
+} azul_nx2_work_t;
+
+typedef struct {
+  azul_nx2_histogram_t      histograms[kWorkCount];
+  UInt64                    passes;
+  UInt64                    idlePasses;
+} azul_nx2_work_stats_t;
+
+/**
+ Accounts for one interrupt pass. The status index is 16 bits and wraps.
+ */
+static inline void nx2WorkRecordPass(azul_nx2_work_stats_t *work, bool linkChanged, UInt32 txReclaimed,
+                                     UInt32 rxPackets, UInt16 statusIndex, UInt16 lastStatusIndex) {
+  work->passes++;
+  if (!linkChanged && txReclaimed == 0 && rxPackets == 0) {
+    work->idlePasses++;
+  }
+  nx2HistogramRecord(&work->histograms[kWorkTxReclaimed], txReclaimed);
+  nx2HistogramRecord(&work->histograms[kWorkRxPackets], rxPackets);
+  nx2HistogramRecord(&work->histograms[kWorkStatusDelta], (UInt16) (statusIndex - lastStatusIndex));
+}
+
+#endif
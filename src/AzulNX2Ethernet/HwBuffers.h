@@ -24,7 +24,11 @@
 #ifndef __HW_BUFFERS_H__
 #define __HW_BUFFERS_H__
 
+#define ADDR_LO(a)      ((a) & 0xFFFFFFFF)
+#define ADDR_HI(a)      ((a) >> 32)
+
 #define PAGESIZE_16     16
+#define PAGESIZE_64     64
 #define PAGESIZE_4K     4096
 
 #define MAX_PACKET_SIZE           (kIOEthernetMaxPacketSize + 4)
@@ -94,6 +98,13 @@ typedef struct {
   UInt16 index;
 } status_block_t;
 
+//
+// Status and statistics blocks are written by the controller.
+// The statistics block is well under 1KB; both are kept on their own cache lines.
+//
+#define STATUS_BLOCK_SIZE           0x40
+#define STATS_BLOCK_SIZE            0x400
+
 //
 // Transmit buffer descriptor.
 //
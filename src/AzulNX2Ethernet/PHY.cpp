@@ -26,14 +26,24 @@
 IOReturn AzulNX2Ethernet::readPhyReg16(UInt8 offset, UInt16 *value) {
   IOReturn status = kIOReturnTimeout;
   UInt32 reg;
+  bool autoPoll;
+  UInt64 startTime = mach_absolute_time();
+  azul_nx2_access_bucket_t prevBucket = setAccessBucket(kAccessBucketPhy);
   
   //
   // Handle clause 45 PHYs here.
+  // IEEE registers are relocated on the 5709S.
   //
+  if (offset < PHY_5709S_IEEE_OFFSET) {
+    offset += phyIeeeOffset;
+  }
   
   //
   // Disable auto polling.
+  // The link work loop also polls the PHY, so the whole transaction is done under the PHY lock.
   //
+  IORecursiveLockLock(phyLock);
+  autoPoll = suspendPHYAutoPoll();
   
   //
   // Read from the specified PHY register.
@@ -56,6 +66,7 @@ IOReturn AzulNX2Ethernet::readPhyReg16(UInt8 offset, UInt16 *value) {
       reg &= NX2_EMAC_MDIO_COMM_DATA;
       
       *value = reg & 0xFFFF;
+      traceRegAccess(kRegTraceReadPhy16, offset, *value);
       status = kIOReturnSuccess;
       break;
     }
@@ -64,9 +75,17 @@ IOReturn AzulNX2Ethernet::readPhyReg16(UInt8 offset, UInt16 *value) {
   //
   // Re-enable auto polling.
   //
+  if (autoPoll) {
+    resumePHYAutoPoll();
+  }
+  
+  setAccessBucket(prevBucket);
+  recordLatency(kLatencyMdioRead, startTime);
+  IORecursiveLockUnlock(phyLock);
   
   if (IORETURN_ERR(status)) {
-    SYSLOG("PHY timeout while reading register 0x%X!", offset);
+    mdioTimeouts++;
+    WARNLOG("PHY timeout while reading register 0x%X!", offset);
   }
   return status;
 }
@@ -74,18 +93,28 @@ IOReturn AzulNX2Ethernet::readPhyReg16(UInt8 offset, UInt16 *value) {
 IOReturn AzulNX2Ethernet::writePhyReg16(UInt8 offset, UInt16 value) {
   IOReturn status = kIOReturnTimeout;
   UInt32 reg;
+  bool autoPoll;
+  UInt64 startTime = mach_absolute_time();
+  azul_nx2_access_bucket_t prevBucket = setAccessBucket(kAccessBucketPhy);
   
   //
   // Handle clause 45 PHYs here.
+  // IEEE registers are relocated on the 5709S.
   //
+  if (offset < PHY_5709S_IEEE_OFFSET) {
+    offset += phyIeeeOffset;
+  }
   
   //
   // Disable auto polling.
   //
+  IORecursiveLockLock(phyLock);
+  autoPoll = suspendPHYAutoPoll();
   
   //
   // Write to the specified PHY register.
   //
+  traceRegAccess(kRegTraceWritePhy16, offset, value);
   writeReg32(NX2_EMAC_MDIO_COMM,
              NX2_MIPHY(phyAddress) |
              NX2_MIREG(offset) |
@@ -108,18 +137,100 @@ IOReturn AzulNX2Ethernet::writePhyReg16(UInt8 offset, UInt16 value) {
   //
   // Re-enable auto polling.
   //
+  if (autoPoll) {
+    resumePHYAutoPoll();
+  }
+  
+  setAccessBucket(prevBucket);
+  recordLatency(kLatencyMdioWrite, startTime);
+  IORecursiveLockUnlock(phyLock);
   
   if (IORETURN_ERR(status)) {
-    SYSLOG("PHY timeout while writing register 0x%X!", offset);
+    mdioTimeouts++;
+    WARNLOG("PHY timeout while writing register 0x%X!", offset);
   }
   return status;
 }
 
+/**
+ Enables EMAC auto polling of the PHY, so link state is tracked in hardware and reported through NX2_EMAC_STATUS.
+ */
+void AzulNX2Ethernet::enablePHYAutoPoll() {
+  if (!phyAutoPoll) {
+    return;
+  }
+  
+  resumePHYAutoPoll();
+  DBGLOG("PHY auto polling is now enabled");
+}
+
+/**
+ Stops auto polling ahead of a manual MDIO transaction. Returns true if polling was active and must be resumed.
+ */
+bool AzulNX2Ethernet::suspendPHYAutoPoll() {
+  UInt32 mode = readShadowReg(kShadowRegEmacMdioMode);
+  if (!(mode & NX2_EMAC_MDIO_MODE_AUTO_POLL)) {
+    return false;
+  }
+  
+  //
+  // Allow any in-flight poll to complete.
+  //
+  writeShadowReg(kShadowRegEmacMdioMode, mode & ~NX2_EMAC_MDIO_MODE_AUTO_POLL);
+  readReg32(NX2_EMAC_MDIO_MODE);
+  IODelay(40);
+  return true;
+}
+
+void AzulNX2Ethernet::resumePHYAutoPoll() {
+  writeShadowReg(kShadowRegEmacMdioMode, readShadowReg(kShadowRegEmacMdioMode) | NX2_EMAC_MDIO_MODE_AUTO_POLL);
+  readReg32(NX2_EMAC_MDIO_MODE);
+  IODelay(40);
+}
+
 bool AzulNX2Ethernet::probePHY() {
+  UInt32 bondId;
+  
   //
   // Default PHY address is 1 for copper-based controllers.
   //
-  phyAddress = 1;
+  phyAddress        = 1;
+  phyType           = kPhyTypeCopper;
+  phyIeeeOffset     = 0;
+  phy25GCapable     = false;
+  phyParallelDetect = false;
+  
+  //
+  // SerDes controllers are identified by bond ID, which the 5709 reports through the dual media control register.
+  //
+  if (NX2_CHIP_NUM == NX2_CHIP_NUM_5709) {
+    bondId = readReg32(NX2_MISC_DUAL_MEDIA_CTRL) & NX2_MISC_DUAL_MEDIA_CTRL_BOND_ID;
+    if (bondId == NX2_MISC_DUAL_MEDIA_CTRL_BOND_ID_S) {
+      phyType = kPhyTypeSerDes5709;
+    }
+  } else if (NX2_CHIP_BOND_ID & NX2_CHIP_BOND_ID_SERDES_BIT) {
+    phyType = NX2_CHIP_NUM == NX2_CHIP_NUM_5706 ? kPhyTypeSerDes5706 : kPhyTypeSerDes5708;
+  }
+  
+  //
+  // SerDes PHYs other than the 5706S are at address 2.
+  // 2.5Gbps is only used on the 5708S if enabled by the board configuration.
+  //
+  if (phyType == kPhyTypeSerDes5708 || phyType == kPhyTypeSerDes5709) {
+    phyAddress = 2;
+  }
+  if (phyType == kPhyTypeSerDes5708) {
+    phy25GCapable = readShMem32(NX2_SHARED_HW_CFG_CONFIG) & NX2_SHARED_HW_CFG_PHY_2_5G;
+  }
+  
+  //
+  // The relocated IEEE registers of the 5709S are not where the EMAC auto poller looks.
+  //
+  if (phyType == kPhyTypeSerDes5709) {
+    phyAutoPoll = false;
+  }
+  
+  DBGLOG("PHY type %u at address %u, 2.5Gbps capable: %u", phyType, phyAddress, phy25GCapable);
   
   //UInt32 oui1 = readPhyReg32(0x02);
   //UInt32 oui2 = readPhyReg32(0x03);
@@ -129,6 +240,146 @@ bool AzulNX2Ethernet::probePHY() {
   return true;
 }
 
+/**
+ Configures a SerDes PHY for 1000BASE-X autonegotiation with parallel detection.
+ 2.5Gbps is also enabled on the 5708S if the board allows it.
+ */
+IOReturn AzulNX2Ethernet::initPHYSerDes() {
+  IOReturn status;
+  UInt16 reg;
+  
+  if (phyType == kPhyTypeSerDes5708) {
+    //
+    // Use the IEEE layout for the standard registers, then select the digital block for the 1000BASE-X controls.
+    //
+    status = writePhyReg16(PHY_5708S_BLOCK_ADDR, PHY_5708S_BLOCK_ADDR_DIG3);
+    if (!(IORETURN_ERR(status))) {
+      status = writePhyReg16(PHY_5708S_DIG3_0, PHY_5708S_DIG3_0_USE_IEEE);
+    }
+    if (!(IORETURN_ERR(status))) {
+      status = writePhyReg16(PHY_5708S_BLOCK_ADDR, PHY_5708S_BLOCK_ADDR_DIG);
+    }
+    if (IORETURN_ERR(status)) {
+      return status;
+    }
+    
+    //
+    // Enable fiber mode with signal autodetection, and parallel detection of partners that do not negotiate.
+    //
+    status = readPhyReg16(PHY_5708S_1000X_CONTROL1, &reg);
+    if (!(IORETURN_ERR(status))) {
+      status = writePhyReg16(PHY_5708S_1000X_CONTROL1, reg | PHY_5708S_1000X_CONTROL1_FIBER_MODE | PHY_5708S_1000X_CONTROL1_AUTODET_EN);
+    }
+    if (!(IORETURN_ERR(status))) {
+      status = readPhyReg16(PHY_5708S_1000X_CONTROL2, &reg);
+    }
+    if (!(IORETURN_ERR(status))) {
+      status = writePhyReg16(PHY_5708S_1000X_CONTROL2, reg | PHY_5708S_1000X_CONTROL2_PAR_DET_EN);
+    }
+    if (IORETURN_ERR(status)) {
+      return status;
+    }
+    
+    if (phy25GCapable) {
+      status = readPhyReg16(PHY_5708S_UP1, &reg);
+      if (!(IORETURN_ERR(status))) {
+        status = writePhyReg16(PHY_5708S_UP1, reg | PHY_5708S_UP1_2G5);
+      }
+      if (IORETURN_ERR(status)) {
+        return status;
+      }
+      DBGLOG("PHY 2.5Gbps advertisement is now enabled");
+    }
+  } else if (phyType == kPhyTypeSerDes5709) {
+    //
+    // Enable fiber mode with signal autodetection, then leave the combo IEEE block selected.
+    //
+    status = writePhyReg16(PHY_5709S_BLOCK_ADDR, PHY_5709S_BLOCK_ADDR_SERDES_DIG);
+    if (!(IORETURN_ERR(status))) {
+      status = readPhyReg16(PHY_5709S_1000X_CONTROL1, &reg);
+    }
+    if (!(IORETURN_ERR(status))) {
+      status = writePhyReg16(PHY_5709S_1000X_CONTROL1, reg | PHY_5709S_1000X_CONTROL1_FIBER_MODE | PHY_5709S_1000X_CONTROL1_AUTODET_EN);
+    }
+    if (!(IORETURN_ERR(status))) {
+      status = writePhyReg16(PHY_5709S_BLOCK_ADDR, PHY_5709S_BLOCK_ADDR_COMBO_IEEE);
+    }
+    if (IORETURN_ERR(status)) {
+      return status;
+    }
+    phyIeeeOffset = PHY_5709S_IEEE_OFFSET;
+  }
+  
+  DBGLOG("PHY SerDes is now configured");
+  return kIOReturnSuccess;
+}
+
+/**
+ Checks if a 5706S has signal and sync, without receiving autonegotiation config words from its partner.
+ */
+bool AzulNX2Ethernet::hasSerDesSignal() {
+  UInt16 reg;
+  
+  if (writePhyReg16(PHY_5706S_MISC_SHADOW, PHY_5706S_MISC_SHADOW_MODE_CTL) != kIOReturnSuccess ||
+      readPhyReg16(PHY_5706S_MISC_SHADOW, &reg) != kIOReturnSuccess ||
+      !(reg & PHY_5706S_MODE_CTL_SIGNAL_DETECT)) {
+    return false;
+  }
+  
+  //
+  // Autonegotiation debug and expansion registers are latched, read twice for the current state.
+  //
+  if (writePhyReg16(PHY_5706S_MISC_SHADOW, PHY_5706S_MISC_SHADOW_AN_DEBUG) != kIOReturnSuccess ||
+      readPhyReg16(PHY_5706S_MISC_SHADOW, &reg) != kIOReturnSuccess ||
+      readPhyReg16(PHY_5706S_MISC_SHADOW, &reg) != kIOReturnSuccess ||
+      (reg & (PHY_5706S_AN_DEBUG_NO_SYNC | PHY_5706S_AN_DEBUG_RUDI_INVALID))) {
+    return false;
+  }
+  
+  if (writePhyReg16(PHY_5706S_EXP_ADDRESS, PHY_5706S_EXP_REG1) != kIOReturnSuccess ||
+      readPhyReg16(PHY_5706S_EXP_DATA, &reg) != kIOReturnSuccess ||
+      readPhyReg16(PHY_5706S_EXP_DATA, &reg) != kIOReturnSuccess ||
+      (reg & PHY_5706S_EXP_REG1_RX_CONFIG)) {
+    return false;
+  }
+  
+  return true;
+}
+
+/**
+ Performs parallel detection on a 5706S.
+ 1Gbps full duplex is forced when a partner that does not negotiate is seen, and autonegotiation
+ is restored once the partner starts sending config words or the link is lost.
+ */
+void AzulNX2Ethernet::pollSerDesParallelDetect() {
+  UInt16 control;
+  UInt16 reg;
+  
+  if (readPhyReg16(PHY_MII_CONTROL, &control) != kIOReturnSuccess) {
+    return;
+  }
+  
+  if (phyParallelDetect) {
+    if (mediaState.linkUp) {
+      if (writePhyReg16(PHY_5706S_EXP_ADDRESS, PHY_5706S_EXP_REG1) != kIOReturnSuccess ||
+          readPhyReg16(PHY_5706S_EXP_DATA, &reg) != kIOReturnSuccess ||
+          !(reg & PHY_5706S_EXP_REG1_RX_CONFIG)) {
+        return;
+      }
+    }
+    
+    writePhyReg16(PHY_MII_CONTROL, control | PHY_MII_CONTROL_AUTO_NEG_ENABLE);
+    phyParallelDetect = false;
+    DBGLOG("SerDes parallel detection ended, autonegotiation is enabled");
+  } else if (!mediaState.linkUp && (control & PHY_MII_CONTROL_AUTO_NEG_ENABLE) && hasSerDesSignal()) {
+    control &= ~(PHY_MII_CONTROL_AUTO_NEG_ENABLE);
+    control |= PHY_MII_CONTROL_SPEED_1000 | PHY_MII_CONTROL_DUPLEX_FULL;
+    writePhyReg16(PHY_MII_CONTROL, control);
+    phyParallelDetect = true;
+    DBGLOG("SerDes partner is not negotiating, forcing 1Gbps full duplex");
+  }
+}
+
 IOReturn AzulNX2Ethernet::resetPHY() {
   IOReturn status;
   UInt16 reg;
@@ -169,7 +420,10 @@ IOReturn AzulNX2Ethernet::enablePHYLoopback() {
   IOReturn status;
   UInt16 reg;
   
-  status = writePhyReg16(PHY_MII_CONTROL, PHY_MII_CONTROL_LOOPBACK);
+  //
+  // Loop back at 1000 Mb/s full duplex, matching the GMII port mode used while looped.
+  //
+  status = writePhyReg16(PHY_MII_CONTROL, PHY_MII_CONTROL_LOOPBACK | PHY_MII_CONTROL_DUPLEX_FULL | PHY_MII_CONTROL_SPEED_1000);
   if (IORETURN_ERR(status)) {
     return status;
   }
@@ -242,38 +496,300 @@ IOReturn AzulNX2Ethernet::enablePHYAutoMDIX() {
   return status;
 }
 
+//
+// Gets the pause advertisement for a flow control policy (802.3 Annex 28B).
+// RX-only is advertised as symmetric plus asymmetric, as a partner may not send pause frames without honoring them.
+//
+static UInt16 getPauseAdvertisement(UInt32 flowControl) {
+  switch (flowControl) {
+    case kFlowControlBoth:
+      return PHY_AUTO_NEG_ADVERT_PAUSE_CAP;
+      
+    case kFlowControlRx:
+      return PHY_AUTO_NEG_ADVERT_PAUSE_CAP | PHY_AUTO_NEG_ADVERT_PAUSE_ASYM;
+      
+    case kFlowControlTx:
+      return PHY_AUTO_NEG_ADVERT_PAUSE_ASYM;
+      
+    default:
+      return 0;
+  }
+}
+
+//
+// Resolves flow control from local and partner pause advertisements (802.3 Table 28B-3).
+//
+static UInt32 resolvePause(UInt16 local, UInt16 partner) {
+  if (local & PHY_AUTO_NEG_ADVERT_PAUSE_CAP) {
+    if (partner & PHY_AUTO_NEG_PARTNER_PAUSE_CAP) {
+      return kFlowControlBoth;
+    }
+    if ((local & PHY_AUTO_NEG_ADVERT_PAUSE_ASYM) && (partner & PHY_AUTO_NEG_PARTNER_PAUSE_ASYM)) {
+      return kFlowControlRx;
+    }
+  } else if (local & PHY_AUTO_NEG_ADVERT_PAUSE_ASYM) {
+    if ((partner & PHY_AUTO_NEG_PARTNER_PAUSE_CAP) && (partner & PHY_AUTO_NEG_PARTNER_PAUSE_ASYM)) {
+      return kFlowControlTx;
+    }
+  }
+  return kFlowControlNone;
+}
+
+//
+// Converts pause bits between the copper layout used by the driver and the 1000BASE-X layout of SerDes PHYs.
+//
+static UInt16 getSerDesPause(UInt16 pause) {
+  return ((pause & PHY_AUTO_NEG_ADVERT_PAUSE_CAP) ? PHY_1000X_PAUSE_CAP : 0) |
+         ((pause & PHY_AUTO_NEG_ADVERT_PAUSE_ASYM) ? PHY_1000X_PAUSE_ASYM : 0);
+}
+
+static UInt16 getCopperPause(UInt16 pause) {
+  return ((pause & PHY_1000X_PAUSE_CAP) ? PHY_AUTO_NEG_ADVERT_PAUSE_CAP : 0) |
+         ((pause & PHY_1000X_PAUSE_ASYM) ? PHY_AUTO_NEG_ADVERT_PAUSE_ASYM : 0);
+}
+
+//
+// Gets the medium index for a link speed and duplex.
+//
+static UInt32 getMediumIndex(link_speed speed, link_duplex duplex) {
+  bool fullDuplex = duplex == kLinkDuplexFull;
+  
+  switch (speed) {
+    case kLinkSpeed10:
+      return fullDuplex ? kMediumTypeIndex10FD : kMediumTypeIndex10HD;
+      
+    case kLinkSpeed100:
+      return fullDuplex ? kMediumTypeIndex100FD : kMediumTypeIndex100HD;
+      
+    case kLinkSpeed1000:
+      return fullDuplex ? kMediumTypeIndex1000FD : kMediumTypeIndex1000HD;
+      
+    case kLinkSpeed2500:
+      return kMediumTypeIndex2500FD;
+      
+    default:
+      return kMediumTypeIndexAuto;
+  }
+}
+
 IOReturn AzulNX2Ethernet::enablePHYAutoNegotiation() {
   IOReturn status;
   
+  if (phyType != kPhyTypeCopper) {
+    //
+    // SerDes PHYs advertise 1000BASE-X full duplex and pause only.
+    //
+    status = writePhyReg16(PHY_AUTO_NEG_ADVERT, PHY_1000X_FD | getSerDesPause(getPauseAdvertisement(flowControlPolicy)));
+    if (IORETURN_ERR(status)) {
+      return status;
+    }
+  } else {
+    //
+    // Enable 10Mbps/100Mbps autonegotiation and pause advertisements per the flow control policy.
+    // Also enable 1Gbps autonegotiation advertisements.
+    //
+    status = writePhyReg16(PHY_AUTO_NEG_ADVERT,
+                           PHY_AUTO_NEG_ADVERT_802_3 | PHY_AUTO_NEG_ADVERT_10HD | PHY_AUTO_NEG_ADVERT_10FD |
+                           PHY_AUTO_NEG_ADVERT_100HD | PHY_AUTO_NEG_ADVERT_100FD | getPauseAdvertisement(flowControlPolicy));
+    if (IORETURN_ERR(status)) {
+      return status;
+    }
+    
+    status = writePhyReg16(PHY_1000BASET_CONTROL, PHY_1000BASET_CONTROL_ADVERT_1000HD | PHY_1000BASET_CONTROL_ADVERT_1000FD);
+    if (IORETURN_ERR(status)) {
+      return status;
+    }
+  }
+  
   //
-  // Enable 10Mbps/100Mbps autonegotiation and pause advertisements.
-  // Also enable 1Gbps autonegotiation advertisements.
+  // Force auto negotiation to run.
   //
-  status = writePhyReg16(PHY_AUTO_NEG_ADVERT,
-                         PHY_AUTO_NEG_ADVERT_802_3 | PHY_AUTO_NEG_ADVERT_10HD | PHY_AUTO_NEG_ADVERT_10FD |
-                         PHY_AUTO_NEG_ADVERT_100HD | PHY_AUTO_NEG_ADVERT_100FD) ;//| PHY_AUTO_NEG_ADVERT_PAUSE_CAP | PHY_AUTO_NEG_ADVERT_PAUSE_ASYM);
+  status = writePhyReg16(PHY_MII_CONTROL, PHY_MII_CONTROL_AUTO_NEG_RESTART | PHY_MII_CONTROL_AUTO_NEG_ENABLE);
+  if (!(IORETURN_ERR(status))) {
+    DBGLOG("PHY auto negotiation has started");
+  }
+  
+  return status;
+}
+
+/**
+ Updates the pause bits of the existing advertisement to match the flow control policy.
+ Auto negotiation is restarted only if the advertisement changed.
+ */
+IOReturn AzulNX2Ethernet::updatePHYPauseAdvertisement() {
+  IOReturn status;
+  UInt16 advert;
+  UInt16 newAdvert;
+  UInt16 control;
+  
+  status = readPhyReg16(PHY_AUTO_NEG_ADVERT, &advert);
   if (IORETURN_ERR(status)) {
     return status;
   }
+  
+  if (phyType != kPhyTypeCopper) {
+    newAdvert = (advert & ~(PHY_1000X_PAUSE_CAP | PHY_1000X_PAUSE_ASYM)) |
+                getSerDesPause(getPauseAdvertisement(flowControlPolicy));
+  } else {
+    newAdvert = (advert & ~(PHY_AUTO_NEG_ADVERT_PAUSE_CAP | PHY_AUTO_NEG_ADVERT_PAUSE_ASYM)) |
+                getPauseAdvertisement(flowControlPolicy);
+  }
+  if (newAdvert == advert) {
+    return kIOReturnSuccess;
+  }
+  
+  status = writePhyReg16(PHY_AUTO_NEG_ADVERT, newAdvert);
+  if (IORETURN_ERR(status)) {
+    return status;
+  }
+  
+  status = readPhyReg16(PHY_MII_CONTROL, &control);
+  if (IORETURN_ERR(status)) {
+    return status;
+  }
+  if (control & PHY_MII_CONTROL_AUTO_NEG_ENABLE) {
+    status = writePhyReg16(PHY_MII_CONTROL, control | PHY_MII_CONTROL_AUTO_NEG_RESTART);
+  }
+  
+  DBGLOG("PHY pause advertisement changed from 0x%X to 0x%X", advert, newAdvert);
+  return status;
+}
 
-  status = writePhyReg16(PHY_1000BASET_CONTROL, PHY_1000BASET_CONTROL_ADVERT_1000HD | PHY_1000BASET_CONTROL_ADVERT_1000FD);
+/**
+ Programs the PHY for a medium without resetting the controller.
+ Forced media disable autonegotiation, except 1Gbps copper which requires it and is instead advertised alone.
+ Autonegotiation is only restarted if the advertisement changed or it was previously disabled.
+ */
+IOReturn AzulNX2Ethernet::setPHYMedium(UInt32 mediumIndex) {
+  IOReturn status;
+  bool   serdes         = phyType != kPhyTypeCopper;
+  UInt16 control;
+  UInt16 advert;
+  UInt16 gbControl      = 0;
+  UInt16 newControl;
+  UInt16 newAdvert;
+  UInt16 newGbControl;
+  UInt16 advertMask;
+  UInt16 pause          = getPauseAdvertisement(flowControlPolicy);
+  
+  status = readPhyReg16(PHY_MII_CONTROL, &control);
+  if (!(IORETURN_ERR(status))) {
+    status = readPhyReg16(PHY_AUTO_NEG_ADVERT, &advert);
+  }
+  if (!(IORETURN_ERR(status)) && !serdes) {
+    status = readPhyReg16(PHY_1000BASET_CONTROL, &gbControl);
+  }
   if (IORETURN_ERR(status)) {
     return status;
   }
   
   //
-  // Force auto negotiation to run.
+  // Start from the current registers with all speed, duplex, and advertisement bits cleared.
   //
-  status = writePhyReg16(PHY_MII_CONTROL, PHY_MII_CONTROL_AUTO_NEG_RESTART | PHY_MII_CONTROL_AUTO_NEG_ENABLE);
-  if (!(IORETURN_ERR(status))) {
-    DBGLOG("PHY auto negotiation has started");
+  if (serdes) {
+    advertMask  = PHY_1000X_FD | PHY_1000X_HD | PHY_1000X_PAUSE_CAP | PHY_1000X_PAUSE_ASYM;
+    pause       = getSerDesPause(pause);
+  } else {
+    advertMask  = PHY_AUTO_NEG_ADVERT_10HD | PHY_AUTO_NEG_ADVERT_10FD | PHY_AUTO_NEG_ADVERT_100HD |
+                  PHY_AUTO_NEG_ADVERT_100FD | PHY_AUTO_NEG_ADVERT_PAUSE_CAP | PHY_AUTO_NEG_ADVERT_PAUSE_ASYM;
+  }
+  newControl    = control & ~(PHY_MII_CONTROL_AUTO_NEG_ENABLE | PHY_MII_CONTROL_AUTO_NEG_RESTART |
+                              PHY_MII_CONTROL_SPEED_100 | PHY_MII_CONTROL_SPEED_1000 | PHY_MII_CONTROL_DUPLEX_FULL);
+  newAdvert     = advert & ~advertMask;
+  newGbControl  = gbControl & ~(PHY_1000BASET_CONTROL_ADVERT_1000HD | PHY_1000BASET_CONTROL_ADVERT_1000FD);
+  if (phyType == kPhyTypeSerDes5708) {
+    newControl &= ~(PHY_5708S_MII_CONTROL_FORCE_2500);
+  }
+  
+  switch (mediumIndex) {
+    case kMediumTypeIndex10HD:
+      newControl |= PHY_MII_CONTROL_SPEED_10;
+      break;
+      
+    case kMediumTypeIndex10FD:
+      newControl |= PHY_MII_CONTROL_SPEED_10 | PHY_MII_CONTROL_DUPLEX_FULL;
+      break;
+      
+    case kMediumTypeIndex100HD:
+      newControl |= PHY_MII_CONTROL_SPEED_100;
+      break;
+      
+    case kMediumTypeIndex100FD:
+      newControl |= PHY_MII_CONTROL_SPEED_100 | PHY_MII_CONTROL_DUPLEX_FULL;
+      break;
+      
+    case kMediumTypeIndex1000HD:
+      if (serdes) {
+        newControl   |= PHY_MII_CONTROL_SPEED_1000;
+      } else {
+        newControl   |= PHY_MII_CONTROL_AUTO_NEG_ENABLE;
+        newAdvert    |= pause;
+        newGbControl |= PHY_1000BASET_CONTROL_ADVERT_1000HD;
+      }
+      break;
+      
+    case kMediumTypeIndex1000FD:
+      if (serdes) {
+        newControl   |= PHY_MII_CONTROL_SPEED_1000 | PHY_MII_CONTROL_DUPLEX_FULL;
+      } else {
+        newControl   |= PHY_MII_CONTROL_AUTO_NEG_ENABLE;
+        newAdvert    |= pause;
+        newGbControl |= PHY_1000BASET_CONTROL_ADVERT_1000FD;
+      }
+      break;
+      
+    case kMediumTypeIndex2500FD:
+      if (phyType != kPhyTypeSerDes5708) {
+        return kIOReturnUnsupported;
+      }
+      newControl |= PHY_MII_CONTROL_SPEED_1000 | PHY_MII_CONTROL_DUPLEX_FULL | PHY_5708S_MII_CONTROL_FORCE_2500;
+      break;
+      
+    default:
+      newControl |= PHY_MII_CONTROL_AUTO_NEG_ENABLE;
+      newAdvert  |= pause;
+      if (serdes) {
+        newAdvert    |= PHY_1000X_FD;
+      } else {
+        newAdvert    |= PHY_AUTO_NEG_ADVERT_10HD | PHY_AUTO_NEG_ADVERT_10FD |
+                        PHY_AUTO_NEG_ADVERT_100HD | PHY_AUTO_NEG_ADVERT_100FD;
+        newGbControl |= PHY_1000BASET_CONTROL_ADVERT_1000HD | PHY_1000BASET_CONTROL_ADVERT_1000FD;
+      }
+      break;
+  }
+  
+  //
+  // Parallel detection only applies when autonegotiating.
+  //
+  phyParallelDetect = false;
+  
+  if (newAdvert != advert) {
+    status = writePhyReg16(PHY_AUTO_NEG_ADVERT, newAdvert);
+    if (IORETURN_ERR(status)) {
+      return status;
+    }
+  }
+  if (newGbControl != gbControl) {
+    status = writePhyReg16(PHY_1000BASET_CONTROL, newGbControl);
+    if (IORETURN_ERR(status)) {
+      return status;
+    }
+  }
+  
+  if ((newControl & PHY_MII_CONTROL_AUTO_NEG_ENABLE) &&
+      (newAdvert != advert || newGbControl != gbControl || !(control & PHY_MII_CONTROL_AUTO_NEG_ENABLE))) {
+    status = writePhyReg16(PHY_MII_CONTROL, newControl | PHY_MII_CONTROL_AUTO_NEG_RESTART);
+    DBGLOG("PHY auto negotiation restarted for medium %u", mediumIndex);
+  } else if (newControl != (control & ~PHY_MII_CONTROL_AUTO_NEG_RESTART)) {
+    status = writePhyReg16(PHY_MII_CONTROL, newControl);
+    DBGLOG("PHY forced to medium %u", mediumIndex);
   }
   
   return status;
 }
 
-void AzulNX2Ethernet::addNetworkMedium(UInt32 index, UInt32 type, UInt32 speed) {
-  IONetworkMedium *medium = IONetworkMedium::medium(type, speed * MBit, 0, index);
+void AzulNX2Ethernet::addNetworkMedium(UInt32 index, UInt32 type, UInt32 speed, const char *name) {
+  IONetworkMedium *medium = IONetworkMedium::medium(type, (UInt64) speed * MBit, 0, index, name);
   if (medium != NULL) {
     IONetworkMedium::addMedium(mediumDict, medium);
     medium->release();
@@ -287,76 +803,247 @@ void AzulNX2Ethernet::createMediumDictionary() {
   mediumDict = OSDictionary::withCapacity(kMediumTypeCount);
   
   addNetworkMedium(kMediumTypeIndexAuto, kIOMediumEthernetAuto, kLinkSpeedNone);
-  addNetworkMedium(kMediumTypeIndex10HD, kIOMediumEthernet10BaseT | kIOMediumOptionHalfDuplex, kLinkSpeed10);
-  addNetworkMedium(kMediumTypeIndex10FD, kIOMediumEthernet10BaseT | kIOMediumOptionFullDuplex, kLinkSpeed10);
-  addNetworkMedium(kMediumTypeIndex100HD, kIOMediumEthernet100BaseTX | kIOMediumOptionHalfDuplex, kLinkSpeed100);
-  addNetworkMedium(kMediumTypeIndex100FD, kIOMediumEthernet100BaseTX | kIOMediumOptionFullDuplex, kLinkSpeed100);
-  addNetworkMedium(kMediumTypeIndex1000HD, kIOMediumEthernet1000BaseT | kIOMediumOptionHalfDuplex, kLinkSpeed1000);
-  addNetworkMedium(kMediumTypeIndex1000FD, kIOMediumEthernet1000BaseT | kIOMediumOptionFullDuplex, kLinkSpeed1000);
+  if (phyType != kPhyTypeCopper) {
+    addNetworkMedium(kMediumTypeIndex1000HD, kIOMediumEthernet1000BaseSX | kIOMediumOptionHalfDuplex, kLinkSpeed1000);
+    addNetworkMedium(kMediumTypeIndex1000FD, kIOMediumEthernet1000BaseSX | kIOMediumOptionFullDuplex, kLinkSpeed1000);
+    if (phy25GCapable) {
+      addNetworkMedium(kMediumTypeIndex2500FD, kMediumTypeEthernet2500BaseX | kIOMediumOptionFullDuplex, kLinkSpeed2500,
+                       kMediumName2500BaseX);
+    }
+  } else {
+    addNetworkMedium(kMediumTypeIndex10HD, kIOMediumEthernet10BaseT | kIOMediumOptionHalfDuplex, kLinkSpeed10);
+    addNetworkMedium(kMediumTypeIndex10FD, kIOMediumEthernet10BaseT | kIOMediumOptionFullDuplex, kLinkSpeed10);
+    addNetworkMedium(kMediumTypeIndex100HD, kIOMediumEthernet100BaseTX | kIOMediumOptionHalfDuplex, kLinkSpeed100);
+    addNetworkMedium(kMediumTypeIndex100FD, kIOMediumEthernet100BaseTX | kIOMediumOptionFullDuplex, kLinkSpeed100);
+    addNetworkMedium(kMediumTypeIndex1000HD, kIOMediumEthernet1000BaseT | kIOMediumOptionHalfDuplex, kLinkSpeed1000);
+    addNetworkMedium(kMediumTypeIndex1000FD, kIOMediumEthernet1000BaseT | kIOMediumOptionFullDuplex, kLinkSpeed1000);
+  }
   
   publishMediumDictionary(mediumDict);
 }
 
-void AzulNX2Ethernet::updatePHYMediaState() {
+static const char *flowControlNames[] = {
+  "off",
+  "RX",
+  "TX",
+  "RX/TX"
+};
+
+/**
+ Reads link, speed and duplex from the auxiliary status register of a copper PHY.
+ */
+IOReturn AzulNX2Ethernet::readCopperLinkState(phy_media_state_t *state, UInt32 *mediumIndex) {
+  IOReturn status;
   UInt16 speed;
-  UInt32 mode  = readReg32(NX2_EMAC_MODE);
-  if (readPhyReg16(PHY_AUX_STATUS, &speed) != kIOReturnSuccess) {
-    return;
+  
+  status = readPhyReg16(PHY_AUX_STATUS, &speed);
+  if (IORETURN_ERR(status)) {
+    return status;
   }
   
-  bool link = speed & PHY_AUX_STATUS_LINK_UP;
-  speed    &= PHY_AUX_STATUS_SPEED_MASK;
-  mode     &= ~(NX2_EMAC_MODE_PORT | NX2_EMAC_MODE_HALF_DUPLEX |
-                NX2_EMAC_MODE_MAC_LOOP | NX2_EMAC_MODE_FORCE_LINK |
-                NX2_EMAC_MODE_25G);
+  state->linkUp = speed & PHY_AUX_STATUS_LINK_UP;
+  speed &= PHY_AUX_STATUS_SPEED_MASK;
   
   switch (speed) {
     case PHY_AUX_STATUS_SPEED_10HD:
-      currentMediumIndex  = kMediumTypeIndex10HD;
-      mediaState.duplex   = kLinkDuplexHalf;
-      mediaState.speed    = kLinkSpeed10;
+      *mediumIndex    = kMediumTypeIndex10HD;
+      state->duplex   = kLinkDuplexHalf;
+      state->speed    = kLinkSpeed10;
       break;
       
     case PHY_AUX_STATUS_SPEED_10FD:
-      currentMediumIndex  = kMediumTypeIndex10FD;
-      mediaState.duplex   = kLinkDuplexFull;
-      mediaState.speed    = kLinkSpeed10;
+      *mediumIndex    = kMediumTypeIndex10FD;
+      state->duplex   = kLinkDuplexFull;
+      state->speed    = kLinkSpeed10;
       break;
       
     case PHY_AUX_STATUS_SPEED_100HD:
-      currentMediumIndex  = kMediumTypeIndex100HD;
-      mediaState.duplex   = kLinkDuplexHalf;
-      mediaState.speed    = kLinkSpeed100;
+      *mediumIndex    = kMediumTypeIndex100HD;
+      state->duplex   = kLinkDuplexHalf;
+      state->speed    = kLinkSpeed100;
       break;
       
     case PHY_AUX_STATUS_SPEED_100FD:
-      currentMediumIndex  = kMediumTypeIndex100FD;
-      mediaState.duplex   = kLinkDuplexFull;
-      mediaState.speed    = kLinkSpeed100;
+      *mediumIndex    = kMediumTypeIndex100FD;
+      state->duplex   = kLinkDuplexFull;
+      state->speed    = kLinkSpeed100;
       break;
       
     case PHY_AUX_STATUS_SPEED_1000HD:
-      currentMediumIndex  = kMediumTypeIndex1000HD;
-      mediaState.duplex   = kLinkDuplexHalf;
-      mediaState.speed    = kLinkSpeed1000;
+      *mediumIndex    = kMediumTypeIndex1000HD;
+      state->duplex   = kLinkDuplexHalf;
+      state->speed    = kLinkSpeed1000;
       break;
       
     case PHY_AUX_STATUS_SPEED_1000FD:
-      currentMediumIndex  = kMediumTypeIndex1000FD;
-      mediaState.duplex   = kLinkDuplexFull;
-      mediaState.speed    = kLinkSpeed1000;
+      *mediumIndex    = kMediumTypeIndex1000FD;
+      state->duplex   = kLinkDuplexFull;
+      state->speed    = kLinkSpeed1000;
       break;
       
     default:
-      mediaState.duplex   = kLinkDuplexNone;
-      mediaState.speed    = kLinkSpeedNone;
+      state->duplex   = kLinkDuplexNone;
+      state->speed    = kLinkSpeedNone;
       break;
   }
   
+  return kIOReturnSuccess;
+}
+
+/**
+ Reads link, speed and duplex from a SerDes PHY.
+ The 5708S reports the resolved speed, otherwise the link runs at 1Gbps with duplex from negotiation or forcing.
+ */
+IOReturn AzulNX2Ethernet::readSerDesLinkState(phy_media_state_t *state, UInt32 *mediumIndex) {
+  IOReturn status;
+  UInt16 reg;
+  UInt16 advert;
+  UInt16 partner;
+  UInt16 common;
+  
+  //
+  // Link status is latched low, read twice for the current state.
+  //
+  status = readPhyReg16(PHY_MII_STATUS, &reg);
+  if (!(IORETURN_ERR(status))) {
+    status = readPhyReg16(PHY_MII_STATUS, &reg);
+  }
+  if (IORETURN_ERR(status)) {
+    return status;
+  }
+  
+  state->linkUp = reg & PHY_MII_STATUS_LINK_UP;
+  if (!state->linkUp) {
+    return kIOReturnSuccess;
+  }
+  
+  if (phyType == kPhyTypeSerDes5708) {
+    status = readPhyReg16(PHY_5708S_1000X_STATUS1, &reg);
+    if (IORETURN_ERR(status)) {
+      return status;
+    }
+    
+    state->duplex = (reg & PHY_5708S_1000X_STATUS1_FD) ? kLinkDuplexFull : kLinkDuplexHalf;
+    switch (reg & PHY_5708S_1000X_STATUS1_SPEED_MASK) {
+      case PHY_5708S_1000X_STATUS1_SPEED_10:
+        state->speed = kLinkSpeed10;
+        break;
+        
+      case PHY_5708S_1000X_STATUS1_SPEED_100:
+        state->speed = kLinkSpeed100;
+        break;
+        
+      case PHY_5708S_1000X_STATUS1_SPEED_2500:
+        state->speed = kLinkSpeed2500;
+        break;
+        
+      default:
+        state->speed = kLinkSpeed1000;
+        break;
+    }
+  } else {
+    status = readPhyReg16(PHY_MII_CONTROL, &reg);
+    if (IORETURN_ERR(status)) {
+      return status;
+    }
+    
+    state->speed  = kLinkSpeed1000;
+    state->duplex = (reg & PHY_MII_CONTROL_DUPLEX_FULL) ? kLinkDuplexFull : kLinkDuplexHalf;
+    
+    //
+    // Negotiated duplex is the best common to both advertisements.
+    //
+    if (reg & PHY_MII_CONTROL_AUTO_NEG_ENABLE) {
+      status = readPhyReg16(PHY_AUTO_NEG_ADVERT, &advert);
+      if (!(IORETURN_ERR(status))) {
+        status = readPhyReg16(PHY_AUTO_NEG_PARTNER, &partner);
+      }
+      if (IORETURN_ERR(status)) {
+        return status;
+      }
+      
+      common = advert & partner;
+      if (common & PHY_1000X_FD) {
+        state->duplex = kLinkDuplexFull;
+      } else if (common & PHY_1000X_HD) {
+        state->duplex = kLinkDuplexHalf;
+      }
+    }
+  }
+  
+  *mediumIndex = getMediumIndex(state->speed, state->duplex);
+  return kIOReturnSuccess;
+}
+
+/**
+ Resolves the link from the PHY without touching the cached media state or the EMAC.
+ Only register reads and MDIO transactions are done, so this may run on the link work loop.
+ */
+IOReturn AzulNX2Ethernet::readPHYMediaState(phy_media_state_t *state, UInt32 *mediumIndex) {
+  IOReturn status;
+  UInt16 control;
+  UInt16 partner;
+  
+  state->linkUp       = false;
+  state->duplex       = kLinkDuplexNone;
+  state->speed        = kLinkSpeedNone;
+  state->flowControl  = kFlowControlNone;
+  state->partnerPause = 0;
+  *mediumIndex        = currentMediumIndex;
+  
+  //
+  // With auto polling the EMAC tracks link state, so a down link needs no MDIO transactions.
+  //
+  if (!phyAutoPoll || (readReg32(NX2_EMAC_STATUS) & NX2_EMAC_STATUS_LINK)) {
+    status = phyType == kPhyTypeCopper ? readCopperLinkState(state, mediumIndex) : readSerDesLinkState(state, mediumIndex);
+    if (IORETURN_ERR(status)) {
+      return status;
+    }
+  }
+  
+  if (!state->linkUp) {
+    state->duplex   = kLinkDuplexNone;
+    state->speed    = kLinkSpeedNone;
+    return kIOReturnSuccess;
+  }
+  
+  //
+  // Pause frames are only valid on full duplex links.
+  // A forced link exchanges no pause advertisements, the partner register is stale and flow control stays off.
+  //
+  if (state->duplex == kLinkDuplexFull &&
+      readPhyReg16(PHY_MII_CONTROL, &control) == kIOReturnSuccess && (control & PHY_MII_CONTROL_AUTO_NEG_ENABLE)) {
+    if (readPhyReg16(PHY_AUTO_NEG_PARTNER, &partner) == kIOReturnSuccess) {
+      state->partnerPause = phyType == kPhyTypeCopper ? partner & (PHY_AUTO_NEG_PARTNER_PAUSE_CAP | PHY_AUTO_NEG_PARTNER_PAUSE_ASYM) :
+                                                        getCopperPause(partner);
+      //
+      // RX-only is advertised as symmetric pause, which can resolve to both directions; never exceed the policy.
+      //
+      state->flowControl  = resolvePause(getPauseAdvertisement(flowControlPolicy), state->partnerPause) & flowControlPolicy;
+    }
+  }
+  
+  return kIOReturnSuccess;
+}
+
+/**
+ Programs the EMAC for a resolved link and reports it to the OS. Must be called on the work loop.
+ The cached media state is only updated here, and is the only link state used outside of link resolution.
+ */
+void AzulNX2Ethernet::applyPHYMediaState(const phy_media_state_t *state, UInt32 mediumIndex) {
+  UInt32 mode = readShadowReg(kShadowRegEmacMode);
+  
+  mediaState          = *state;
+  currentMediumIndex  = mediumIndex;
+  
+  mode &= ~(NX2_EMAC_MODE_PORT | NX2_EMAC_MODE_HALF_DUPLEX |
+            NX2_EMAC_MODE_MAC_LOOP | NX2_EMAC_MODE_FORCE_LINK |
+            NX2_EMAC_MODE_25G);
+  
   //
   // PHY link speed is dependent on the link speed.
   //
-  if (link) {
+  if (mediaState.linkUp) {
     switch (mediaState.speed) {
       case kLinkSpeed10:
         if (NX2_CHIP_NUM == NX2_CHIP_NUM_5706) {
@@ -370,6 +1057,11 @@ void AzulNX2Ethernet::updatePHYMediaState() {
         DBGLOG("PHY link speed: MII");
         break;
         
+      case kLinkSpeed2500:
+        mode |= NX2_EMAC_MODE_PORT_GMII | NX2_EMAC_MODE_25G;
+        DBGLOG("PHY link speed: GMII 2.5Gb");
+        break;
+        
       case kLinkSpeed1000:
       default:
         mode |= NX2_EMAC_MODE_PORT_GMII;
@@ -390,15 +1082,95 @@ void AzulNX2Ethernet::updatePHYMediaState() {
   //
   // Update OS with link status.
   //
-  writeReg32(NX2_EMAC_MODE, mode);
-  if (link) {
+  writeShadowReg(kShadowRegEmacMode, mode);
+  updateFlowControl();
+  if (mediaState.linkUp) {
     setLinkStatus(kIONetworkLinkValid | kIONetworkLinkActive,
                   IONetworkMedium::getMediumWithIndex(mediumDict, currentMediumIndex));
-    SYSLOG("Link is up at %u Mbps, %s duplex", mediaState.speed, mediaState.duplex == kLinkDuplexFull ? "full" : "half");
+    SYSLOG("Link is up at %u Mbps, %s duplex, flow control %s", mediaState.speed,
+           mediaState.duplex == kLinkDuplexFull ? "full" : "half", flowControlNames[mediaState.flowControl]);
+    startLinkMonitor();
   } else {
-    setLinkStatus(kIONetworkLinkValid, 0);
+    if (!linkDownReported) {
+      setLinkStatus(kIONetworkLinkValid, 0);
+    }
     SYSLOG("Link is down");
   }
+  linkDownReported = false;
+}
+
+/**
+ Resolves the link and applies it in one step. Must be called on the work loop.
+ */
+void AzulNX2Ethernet::updatePHYMediaState() {
+  phy_media_state_t state;
+  UInt32 mediumIndex;
+  IOReturn status;
+  
+  IORecursiveLockLock(phyLock);
+  status = readPHYMediaState(&state, &mediumIndex);
+  IORecursiveLockUnlock(phyLock);
+  
+  if (!(IORETURN_ERR(status))) {
+    applyPHYMediaState(&state, mediumIndex);
+  }
+}
+
+/**
+ Programs the EMAC to honor and send pause frames as resolved for the current link.
+ */
+void AzulNX2Ethernet::updateFlowControl() {
+  UInt32 txMode = readShadowReg(kShadowRegEmacTxMode) & ~NX2_EMAC_TX_MODE_FLOW_EN;
+  UInt32 rxMode = readShadowReg(kShadowRegEmacRxMode) & ~NX2_EMAC_RX_MODE_FLOW_EN;
+  
+  if (mediaState.flowControl & kFlowControlTx) {
+    txMode |= NX2_EMAC_TX_MODE_FLOW_EN;
+  }
+  if (mediaState.flowControl & kFlowControlRx) {
+    rxMode |= NX2_EMAC_RX_MODE_FLOW_EN;
+  }
+  
+  writeShadowReg(kShadowRegEmacTxMode, txMode);
+  writeShadowReg(kShadowRegEmacRxMode, rxMode);
+}
+
+/**
+ Publishes the flow control policy, negotiated state, and pause frame counters.
+ */
+void AzulNX2Ethernet::publishFlowControl() {
+  OSDictionary *dict;
+  OSNumber     *num;
+  
+  const struct {
+    const char  *name;
+    UInt32      value;
+  } values[] = {
+    { "Policy",           flowControlPolicy },
+    { "Advertised",       getPauseAdvertisement(flowControlPolicy) },
+    { "Partner",          mediaState.partnerPause },
+    { "Resolved",         mediaState.flowControl },
+    { "XonReceived",      readReg32(NX2_EMAC_RX_STAT_XONPAUSEFRAMESRECEIVED) },
+    { "XoffReceived",     readReg32(NX2_EMAC_RX_STAT_XOFFPAUSEFRAMESRECEIVED) },
+    { "XoffStateEntered", readReg32(NX2_EMAC_RX_STAT_XOFFSTATEENTERED) },
+    { "XonSent",          readReg32(NX2_EMAC_TX_STAT_OUTXONSENT) },
+    { "XoffSent",         readReg32(NX2_EMAC_TX_STAT_OUTXOFFSENT) }
+  };
+  
+  dict = OSDictionary::withCapacity(sizeof (values) / sizeof (values[0]));
+  if (dict == NULL) {
+    return;
+  }
+  
+  for (UInt32 i = 0; i < sizeof (values) / sizeof (values[0]); i++) {
+    num = OSNumber::withNumber(values[i].value, 32);
+    if (num != NULL) {
+      dict->setObject(values[i].name, num);
+      num->release();
+    }
+  }
+  
+  setProperty("FlowControlState", dict);
+  dict->release();
 }
 
 void AzulNX2Ethernet::fetchMacAddress() {
@@ -424,6 +1196,8 @@ void AzulNX2Ethernet::fetchMacAddress() {
 
 void AzulNX2Ethernet::handlePHYInterrupt(status_block_t *stsBlock) {
   bool newLink = stsBlock->attnBits & STATUS_ATTN_BITS_LINK_STATE;
+  UInt32 emacStatus = readReg32(NX2_EMAC_STATUS);
+  traceEvent(kEventLinkChange, newLink, emacStatus);
   
   if (newLink) {
     writeReg32(NX2_PCICFG_STATUS_BIT_SET_CMD, STATUS_ATTN_BITS_LINK_STATE);
@@ -432,8 +1206,189 @@ void AzulNX2Ethernet::handlePHYInterrupt(status_block_t *stsBlock) {
   }
   writeReg32(NX2_EMAC_STATUS, NX2_EMAC_STATUS_LINK_CHANGE);
   
-  updatePHYMediaState();  
+  //
+  // With auto polling the EMAC link state is current, act on it rather than the copy in the status block.
+  // Link loss needs no resolution, report it straight away so failover is not held up behind the deferred update.
+  //
+  if (phyAutoPoll) {
+    newLink = emacStatus & NX2_EMAC_STATUS_LINK;
+  }
+  if (!newLink) {
+    reportLinkDown();
+  }
+  
+  //
+  // Resolving the link requires several MDIO transactions, defer it to the link work loop so RX and TX processing
+  // is not held up.
+  //
+  scheduleLinkUpdate();
   
-  writeReg32(NX2_HC_COMMAND, readReg32(NX2_HC_COMMAND) | NX2_HC_COMMAND_COAL_NOW_WO_INT);
+  writeReg32(NX2_HC_COMMAND, readShadowReg(kShadowRegHcCommand) | NX2_HC_COMMAND_COAL_NOW_WO_INT);
   readReg32(NX2_HC_COMMAND);
 }
+
+/**
+ Reports link loss to the interface ahead of the deferred update, which then confirms it without reporting it again.
+ */
+void AzulNX2Ethernet::reportLinkDown() {
+  if (!mediaState.linkUp) {
+    return;
+  }
+  
+  mediaState.linkUp = false;
+  linkDownReported  = true;
+  setLinkStatus(kIONetworkLinkValid, 0);
+  if (linkUpSeenTime != 0) {
+    recordLatency(kLatencyLinkDown, linkUpSeenTime);
+  }
+  stopLinkMonitor();
+}
+
+/**
+ Starts polling the EMAC link state. Only done with auto polling, as the EMAC does not track the link otherwise.
+ */
+void AzulNX2Ethernet::startLinkMonitor() {
+  if (linkMonitorTimer == NULL || linkMonitorInterval == 0 || !phyAutoPoll) {
+    return;
+  }
+  
+  linkUpSeenTime = mach_absolute_time();
+  linkMonitorTimer->setTimeoutUS(linkMonitorInterval);
+}
+
+void AzulNX2Ethernet::stopLinkMonitor() {
+  if (linkMonitorTimer != NULL) {
+    linkMonitorTimer->cancelTimeout();
+  }
+  linkUpSeenTime = 0;
+}
+
+void AzulNX2Ethernet::linkMonitorTimerOccurred(IOTimerEventSource *source) {
+  azul_nx2_access_bucket_t prevBucket;
+  UInt32 emacStatus;
+  
+  //
+  // Loopback changes the link during a self-test, the monitor is restarted once the link is resolved afterwards.
+  //
+  if (isBringupActive() || isSelfTestActive() || !mediaState.linkUp) {
+    linkUpSeenTime = 0;
+    return;
+  }
+  
+  prevBucket = setAccessBucket(kAccessBucketPhy);
+  emacStatus = readReg32(NX2_EMAC_STATUS);
+  if (emacStatus & NX2_EMAC_STATUS_LINK) {
+    linkUpSeenTime = mach_absolute_time();
+    linkMonitorTimer->setTimeoutUS(linkMonitorInterval);
+  } else {
+    traceEvent(kEventLinkChange, false, emacStatus);
+    reportLinkDown();
+    scheduleLinkUpdate();
+  }
+  setAccessBucket(prevBucket);
+}
+
+/**
+ Schedules a link update. Changes arriving while an update is pending are folded into it.
+ The delay is not restarted, so a continuously flapping link is still resolved periodically.
+ */
+void AzulNX2Ethernet::scheduleLinkUpdate() {
+  linkChangeCount++;
+  if (!linkChangePending) {
+    linkChangePending = true;
+    linkTimer->setTimeoutMS(LINK_CHANGE_DELAY_MS);
+  }
+}
+
+void AzulNX2Ethernet::cancelLinkUpdate() {
+  if (linkTimer != NULL) {
+    linkTimer->cancelTimeout();
+  }
+  
+  //
+  // Wait out any resolution in progress on the link work loop, its result is discarded once the generation changes.
+  //
+  if (phyLock != NULL) {
+    IORecursiveLockLock(phyLock);
+    linkUpdateGeneration++;
+    IORecursiveLockUnlock(phyLock);
+  }
+  linkChangePending = false;
+  linkChangeCount   = 0;
+}
+
+/**
+ Resolves the link on the link work loop. MDIO transactions are done under the PHY lock without holding the main gate,
+ and only the result is applied on the work loop.
+ */
+void AzulNX2Ethernet::linkTimerOccurred(IOTimerEventSource *source) {
+  azul_nx2_access_bucket_t prevBucket;
+  phy_media_state_t state;
+  UInt32 mediumIndex;
+  UInt32 generation;
+  bool resolved = false;
+  IOCommandGate *gate;
+  
+  IORecursiveLockLock(phyLock);
+  
+  //
+  // Link is resolved again once bring-up completes.
+  // Bring-up cancels link updates under the PHY lock, so no MDIO transaction can overlap a reset.
+  //
+  if (isBringupActive()) {
+    linkChangePending = false;
+    linkChangeCount   = 0;
+    IORecursiveLockUnlock(phyLock);
+    return;
+  }
+  
+  //
+  // Link changes caused by loopback are left pending, the self-test resolves the link once it completes.
+  //
+  if (isSelfTestActive()) {
+    IORecursiveLockUnlock(phyLock);
+    return;
+  }
+  
+  prevBucket = setAccessBucket(kAccessBucketPhy);
+  generation = linkUpdateGeneration;
+  if (linkChangePending) {
+    DBGLOG("Resolving link after %u link change(s)", linkChangeCount);
+    linkChangePending = false;
+    linkChangeCount   = 0;
+    resolved = readPHYMediaState(&state, &mediumIndex) == kIOReturnSuccess;
+  }
+  
+  //
+  // The timer continues to run for parallel detection on the 5706S.
+  //
+  if (phyType == kPhyTypeSerDes5706) {
+    if (selectedMediumIndex == kMediumTypeIndexAuto) {
+      pollSerDesParallelDetect();
+    }
+    if (!linkChangePending) {
+      linkTimer->setTimeoutMS(SERDES_POLL_INTERVAL_MS);
+    }
+  }
+  setAccessBucket(prevBucket);
+  IORecursiveLockUnlock(phyLock);
+  
+  gate = getCommandGate();
+  if (resolved && gate != NULL) {
+    gate->runAction(gatedApplyLinkUpdate, &state, &mediumIndex, (void*) (uintptr_t) generation);
+  }
+}
+
+IOReturn AzulNX2Ethernet::gatedApplyLinkUpdate(OSObject *owner, void *arg0, void *arg1, void *arg2, void *arg3) {
+  AzulNX2Ethernet *eth = (AzulNX2Ethernet*) owner;
+  
+  //
+  // Drop a result that was overtaken by bring-up, a self-test, or a cancelled update while waiting for the gate.
+  //
+  if (eth->isBringupActive() || eth->isSelfTestActive() || (uintptr_t) arg2 != eth->linkUpdateGeneration) {
+    return kIOReturnAborted;
+  }
+  
+  eth->applyPHYMediaState((const phy_media_state_t*) arg0, *(UInt32*) arg1);
+  return kIOReturnSuccess;
+}
@@ -104,6 +104,82 @@
 #define PHY_INTERRUPT_MASK                  0x1B
 #define PHY_INTERRUPT_MASK_LINK_INTS         0xFF00
 
+//
+// 1000BASE-X advertisement and partner ability layout, used in PHY_AUTO_NEG_ADVERT/PARTNER on SerDes PHYs.
+//
+#define PHY_1000X_FD                        BIT(5)
+#define PHY_1000X_HD                        BIT(6)
+#define PHY_1000X_PAUSE_CAP                 BIT(7)
+#define PHY_1000X_PAUSE_ASYM                BIT(8)
+
+//
+// 5706S SerDes registers.
+//
+#define PHY_5706S_EXP_ADDRESS               0x17
+#define PHY_5706S_EXP_DATA                  0x15
+#define PHY_5706S_EXP_REG1                  0x0F01
+#define PHY_5706S_EXP_REG1_RX_CONFIG        BIT(5)
+
+#define PHY_5706S_MISC_SHADOW               0x1C
+#define PHY_5706S_MISC_SHADOW_MODE_CTL      0x7C00
+#define PHY_5706S_MODE_CTL_SIGNAL_DETECT    BIT(4)
+#define PHY_5706S_MISC_SHADOW_AN_DEBUG      0x6800
+#define PHY_5706S_AN_DEBUG_NO_SYNC          BIT(1)
+#define PHY_5706S_AN_DEBUG_RUDI_INVALID     BIT(8)
+
+//
+// 5708S SerDes registers. Registers 0x10 to 0x1E are banked through PHY_5708S_BLOCK_ADDR.
+//
+#define PHY_5708S_MII_CONTROL_FORCE_2500     BIT(5)
+
+#define PHY_5708S_UP1                       0x0B
+#define PHY_5708S_UP1_2G5                   BIT(0)
+
+#define PHY_5708S_1000X_CONTROL1                0x10
+#define PHY_5708S_1000X_CONTROL1_FIBER_MODE     BIT(0)
+#define PHY_5708S_1000X_CONTROL1_AUTODET_EN     BIT(4)
+
+#define PHY_5708S_1000X_CONTROL2                0x11
+#define PHY_5708S_1000X_CONTROL2_PAR_DET_EN     BIT(0)
+
+#define PHY_5708S_1000X_STATUS1                 0x14
+#define PHY_5708S_1000X_STATUS1_LINK            BIT(1)
+#define PHY_5708S_1000X_STATUS1_FD              BIT(2)
+#define PHY_5708S_1000X_STATUS1_SPEED_MASK      (BIT(3) | BIT(4))
+#define PHY_5708S_1000X_STATUS1_SPEED_10        0
+#define PHY_5708S_1000X_STATUS1_SPEED_100       BIT(3)
+#define PHY_5708S_1000X_STATUS1_SPEED_1000      BIT(4)
+#define PHY_5708S_1000X_STATUS1_SPEED_2500      (BIT(3) | BIT(4))
+
+#define PHY_5708S_DIG3_0                        0x10
+#define PHY_5708S_DIG3_0_USE_IEEE               BIT(0)
+
+#define PHY_5708S_BLOCK_ADDR                    0x1F
+#define PHY_5708S_BLOCK_ADDR_DIG                0x0000
+#define PHY_5708S_BLOCK_ADDR_DIG3               0x0002
+
+//
+// 5709S SerDes registers. The IEEE registers are relocated to 0x10 to 0x1F of the combo block.
+//
+#define PHY_5709S_BLOCK_ADDR                    0x1F
+#define PHY_5709S_BLOCK_ADDR_SERDES_DIG         0x8300
+#define PHY_5709S_BLOCK_ADDR_COMBO_IEEE         0xFFE0
+#define PHY_5709S_IEEE_OFFSET                   0x10
+
+#define PHY_5709S_1000X_CONTROL1                0x10
+#define PHY_5709S_1000X_CONTROL1_FIBER_MODE     BIT(0)
+#define PHY_5709S_1000X_CONTROL1_AUTODET_EN     BIT(4)
+
+//
+// PHY types.
+//
+typedef enum {
+  kPhyTypeCopper = 0,
+  kPhyTypeSerDes5706,
+  kPhyTypeSerDes5708,
+  kPhyTypeSerDes5709
+} phy_type_t;
+
 //
 // Medium types.
 //
@@ -115,9 +191,17 @@ enum {
   kMediumTypeIndex100FD,
   kMediumTypeIndex1000HD,
   kMediumTypeIndex1000FD,
+  kMediumTypeIndex2500FD,
   kMediumTypeCount
 };
 
+//
+// 2.5GBASE-X has no subtype in the SDK, so it is published as 1000BASE-SX with a 2.5Gbps speed.
+// A name is required as the medium dictionary is keyed by type.
+//
+#define kMediumTypeEthernet2500BaseX    kIOMediumEthernet1000BaseSX
+#define kMediumName2500BaseX            "2500BaseX"
+
 //
 // Link duplex.
 //
@@ -137,13 +221,27 @@ enum link_speed {
   kLinkSpeed10 = 10,
   kLinkSpeed100 = 100,
   kLinkSpeed1000 = 1000,
+  kLinkSpeed2500 = 2500,
   kLinkSpeedNegotiate
 };
 
+//
+// 802.3x flow control directions.
+// RX honors pause frames from the link partner, TX sends pause frames when receive buffers fill.
+//
+enum {
+  kFlowControlNone  = 0,
+  kFlowControlRx    = BIT(0),
+  kFlowControlTx    = BIT(1),
+  kFlowControlBoth  = kFlowControlRx | kFlowControlTx
+};
+
 typedef struct {
   link_duplex   duplex;
   link_speed    speed;
   bool          linkUp;
+  UInt32        flowControl;
+  UInt16        partnerPause;
 } phy_media_state_t;
 
 #endif
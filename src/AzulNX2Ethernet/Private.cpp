@@ -119,26 +119,81 @@ void AzulNX2Ethernet::logPrint(const char *func, const char *format, ...) {
   IOLog("AzulNX2Ethernet::%s(): %s\n", func, tmp);
 }
 
+/**
+ Logs a message if the call site has a token available.
+ Tokens are refilled to the burst limit once per interval.
+ */
+void AzulNX2Ethernet::logPrintLimited(azul_nx2_log_limit_t *limit, const char *func, const char *format, ...) {
+  UInt64  now;
+  UInt64  tokenTime;
+  UInt64  refillTime;
+  UInt64  newRefillTime;
+  UInt32  suppressed;
+  char    tmp[1024];
+  
+  clock_get_uptime(&now);
+  nanoseconds_to_absolutetime((UInt64) LOG_LIMIT_INTERVAL_MS * 1000 * 1000 / LOG_LIMIT_BURST, &tokenTime);
+  
+  //
+  // refillTime is when the bucket is full again, each message taken pushes it out by one token.
+  // A message is allowed if that stays within a full bucket of now.
+  //
+  refillTime = __atomic_load_n(&limit->refillTime, __ATOMIC_RELAXED);
+  do {
+    newRefillTime = (refillTime > now ? refillTime : now) + tokenTime;
+    if (newRefillTime > now + tokenTime * LOG_LIMIT_BURST) {
+      __atomic_fetch_add(&limit->suppressed, 1, __ATOMIC_RELAXED);
+      return;
+    }
+  } while (!__atomic_compare_exchange_n(&limit->refillTime, &refillTime, newRefillTime, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+  suppressed = __atomic_exchange_n(&limit->suppressed, 0, __ATOMIC_RELAXED);
+  
+  tmp[0] = '\0';
+  va_list va;
+  va_start(va, format);
+  vsnprintf(tmp, sizeof (tmp), format, va);
+  va_end(va);
+  
+  if (suppressed > 0) {
+    IOLog("AzulNX2Ethernet::%s(): %s (%u similar messages suppressed)\n", func, tmp, suppressed);
+  } else {
+    IOLog("AzulNX2Ethernet::%s(): %s\n", func, tmp);
+  }
+}
+
 /**
  Reads the specified register using memory space.
  */
 UInt16 AzulNX2Ethernet::readReg16(UInt32 offset) {
-  return OSReadLittleInt16(baseAddr, offset);
+  UInt16 value = OSReadLittleInt16(baseAddr, offset);
+  countRegAccess(kAccessTypeMmioRead);
+  traceRegAccess(kRegTraceRead16, offset, value);
+  return value;
 }
 
 /**
  Reads the specified register using memory space.
  */
 UInt32 AzulNX2Ethernet::readReg32(UInt32 offset) {
-  return OSReadLittleInt32(baseAddr, offset);
+  UInt32 value = OSReadLittleInt32(baseAddr, offset);
+  countRegAccess(kAccessTypeMmioRead);
+  traceRegAccess(kRegTraceRead32, offset, value);
+  return value;
 }
 
 /**
  Reads the specified register using PCI config space.
  */
 UInt32 AzulNX2Ethernet::readRegIndr32(UInt32 offset) {
+  UInt32 value;
+  
   pciNub->configWrite32(NX2_PCICFG_REG_WINDOW_ADDRESS, offset);
-  return pciNub->configRead32(NX2_PCICFG_REG_WINDOW);
+  value = pciNub->configRead32(NX2_PCICFG_REG_WINDOW);
+  countRegAccess(kAccessTypeConfigWrite);
+  countRegAccess(kAccessTypeConfigRead);
+  traceRegAccess(kRegTraceReadIndr32, offset, value);
+  return value;
 }
 
 /**
@@ -148,26 +203,42 @@ UInt32 AzulNX2Ethernet::readShMem32(UInt32 offset) {
   return readRegIndr32(shMemBase + offset);
 }
 
+/**
+ Reads the specified context memory location.
+ */
+template <typename Chip>
 UInt32 AzulNX2Ethernet::readContext32(UInt32 cid, UInt32 offset) {
   UInt32 reg = 0;
   
-  if (NX2_CHIP_NUM == NX2_CHIP_NUM_5709) {
-    writeReg32(NX2_CTX_CTX_CTRL, (cid + offset) | NX2_CTX_CTX_CTRL_READ_REQ);
-    
-    for (int i = 0; i < 100; i++) {
-      reg = readReg32(NX2_CTX_CTX_CTRL);
-      if ((reg & NX2_CTX_CTX_CTRL_READ_REQ) == 0) {
-        return readReg32(NX2_CTX_CTX_DATA);
-      }
-      IODelay(5);
+  if (!Chip::hostContext) {
+    writeReg32(NX2_CTX_DATA_ADR, (cid + offset));
+    return readReg32(NX2_CTX_DATA);
+  }
+  
+  writeReg32(NX2_CTX_CTX_CTRL, (cid + offset) | NX2_CTX_CTX_CTRL_READ_REQ);
+  
+  for (int i = 0; i < 100; i++) {
+    reg = readReg32(NX2_CTX_CTX_CTRL);
+    if ((reg & NX2_CTX_CTX_CTRL_READ_REQ) == 0) {
+      return readReg32(NX2_CTX_CTX_DATA);
     }
+    IODelay(5);
   }
   
   DBGLOG("Context read timeout!");
   return 0;
 }
 
+template UInt32 AzulNX2Ethernet::readContext32<nx2_chip_5706_t>(UInt32 cid, UInt32 offset);
+template UInt32 AzulNX2Ethernet::readContext32<nx2_chip_5708_t>(UInt32 cid, UInt32 offset);
+template UInt32 AzulNX2Ethernet::readContext32<nx2_chip_5709_t>(UInt32 cid, UInt32 offset);
+
+/**
+ Writes the specified register using memory space.
+ */
 void AzulNX2Ethernet::writeReg16(UInt32 offset, UInt16 value) {
+  countRegAccess(kAccessTypeMmioWrite);
+  traceRegAccess(kRegTraceWrite16, offset, value);
   OSWriteLittleInt16(baseAddr, offset, value);
 }
 
@@ -175,6 +246,8 @@ void AzulNX2Ethernet::writeReg16(UInt32 offset, UInt16 value) {
  Writes the specified register using memory space.
  */
 void AzulNX2Ethernet::writeReg32(UInt32 offset, UInt32 value) {
+  countRegAccess(kAccessTypeMmioWrite);
+  traceRegAccess(kRegTraceWrite32, offset, value);
   OSWriteLittleInt32(baseAddr, offset, value);
 }
 
@@ -182,6 +255,9 @@ void AzulNX2Ethernet::writeReg32(UInt32 offset, UInt32 value) {
  Writes the specified register using PCI config space.
  */
 void AzulNX2Ethernet::writeRegIndr32(UInt32 offset, UInt32 value) {
+  countRegAccess(kAccessTypeConfigWrite);
+  countRegAccess(kAccessTypeConfigWrite);
+  traceRegAccess(kRegTraceWriteIndr32, offset, value);
   pciNub->configWrite32(NX2_PCICFG_REG_WINDOW_ADDRESS, offset);
   pciNub->configWrite32(NX2_PCICFG_REG_WINDOW, value);
 }
@@ -193,11 +269,15 @@ void AzulNX2Ethernet::writeShMem32(UInt32 offset, UInt32 value) {
   writeRegIndr32(shMemBase + offset, value);
 }
 
+/**
+ Writes the specified context memory location.
+ */
+template <typename Chip>
 void AzulNX2Ethernet::writeContext32(UInt32 cid, UInt32 offset, UInt32 value) {
   UInt32 reg = 0;
  // DBGLOG("Context write (cid = 0x%X, offset = 0x%X, value = 0x%X)", cid, offset, value);
   
-  if (NX2_CHIP_NUM == NX2_CHIP_NUM_5709) {
+  if (Chip::hostContext) {
     writeReg32(NX2_CTX_CTX_DATA, value);
     writeReg32(NX2_CTX_CTX_CTRL, (cid + offset) | NX2_CTX_CTX_CTRL_WRITE_REQ);
     
@@ -216,6 +296,468 @@ void AzulNX2Ethernet::writeContext32(UInt32 cid, UInt32 offset, UInt32 value) {
   }
 }
 
+template void AzulNX2Ethernet::writeContext32<nx2_chip_5706_t>(UInt32 cid, UInt32 offset, UInt32 value);
+template void AzulNX2Ethernet::writeContext32<nx2_chip_5708_t>(UInt32 cid, UInt32 offset, UInt32 value);
+template void AzulNX2Ethernet::writeContext32<nx2_chip_5709_t>(UInt32 cid, UInt32 offset, UInt32 value);
+
+static const char *accessBucketNames[kAccessBucketCount] = {
+  "Init",
+  "Interrupt",
+  "TX",
+  "RX",
+  "PHY",
+  "Sampler",
+  "SelfTest"
+};
+
+static const char *accessTypeNames[kAccessTypeCount] = {
+  "MmioRead",
+  "MmioWrite",
+  "ConfigRead",
+  "ConfigWrite"
+};
+
+/**
+ Publishes register access counts per code path.
+ */
+void AzulNX2Ethernet::publishAccessCounts() {
+  OSDictionary *counts;
+  OSDictionary *bucketCounts;
+  OSNumber     *num;
+  
+  counts = OSDictionary::withCapacity(kAccessBucketCount);
+  if (counts == NULL) {
+    return;
+  }
+  
+  for (UInt32 i = 0; i < kAccessBucketCount; i++) {
+    bucketCounts = OSDictionary::withCapacity(kAccessTypeCount);
+    if (bucketCounts == NULL) {
+      continue;
+    }
+    
+    for (UInt32 j = 0; j < kAccessTypeCount; j++) {
+      num = OSNumber::withNumber(accessCounts[kAccessContextWorkLoop][i][j] + accessCounts[kAccessContextLink][i][j] +
+                                 accessCounts[kAccessContextOutput][i][j], 64);
+      if (num != NULL) {
+        bucketCounts->setObject(accessTypeNames[j], num);
+        num->release();
+      }
+    }
+    counts->setObject(accessBucketNames[i], bucketCounts);
+    bucketCounts->release();
+  }
+  
+  setProperty("RegisterAccessCounts", counts);
+  counts->release();
+}
+
+void AzulNX2Ethernet::resetAccessCounts() {
+  bzero(accessCounts, sizeof (accessCounts));
+}
+
+/**
+ Creates a dictionary with the count, sum and non-empty buckets of a histogram.
+ Buckets are keyed by their lower bound.
+ */
+OSDictionary* AzulNX2Ethernet::copyHistogramDictionary(const azul_nx2_histogram_t *histogram) {
+  OSDictionary  *dict;
+  OSDictionary  *buckets;
+  OSNumber      *num;
+  char          key[24];
+  
+  dict = OSDictionary::withCapacity(3);
+  if (dict == NULL) {
+    return NULL;
+  }
+  buckets = OSDictionary::withCapacity(HISTOGRAM_BUCKETS);
+  if (buckets == NULL) {
+    dict->release();
+    return NULL;
+  }
+  
+  for (UInt32 i = 0; i < HISTOGRAM_BUCKETS; i++) {
+    if (histogram->buckets[i] == 0) {
+      continue;
+    }
+    
+    snprintf(key, sizeof (key), "%llu", i == 0 ? 0ULL : 1ULL << (i - 1));
+    num = OSNumber::withNumber(histogram->buckets[i], 64);
+    if (num != NULL) {
+      buckets->setObject(key, num);
+      num->release();
+    }
+  }
+  dict->setObject("Buckets", buckets);
+  buckets->release();
+  
+  num = OSNumber::withNumber(histogram->count, 64);
+  if (num != NULL) {
+    dict->setObject("Count", num);
+    num->release();
+  }
+  num = OSNumber::withNumber(histogram->sum, 64);
+  if (num != NULL) {
+    dict->setObject("Sum", num);
+    num->release();
+  }
+  
+  return dict;
+}
+
+static const char *latencyNames[kLatencyCount] = {
+  "RXDelivery",
+  "RXBatch",
+  "TXCompletion",
+  "DeviceToHost",
+  "MDIORead",
+  "MDIOWrite",
+  "LinkDown"
+};
+
+void AzulNX2Ethernet::publishLatencyHistograms() {
+  OSDictionary *latencies;
+  OSDictionary *histogram;
+  OSNumber     *num;
+  
+  latencies = OSDictionary::withCapacity(kLatencyCount);
+  if (latencies == NULL) {
+    return;
+  }
+  
+  for (UInt32 i = 0; i < kLatencyCount; i++) {
+    histogram = copyHistogramDictionary(&latencyHistograms[i]);
+    if (histogram != NULL) {
+      latencies->setObject(latencyNames[i], histogram);
+      histogram->release();
+    }
+  }
+  
+  num = OSNumber::withNumber(getDeviceClockDriftPpm(), 64);
+  if (num != NULL) {
+    latencies->setObject("DeviceClockDriftPPM", num);
+    num->release();
+  }
+  
+  num = OSNumber::withNumber(deviceClock.probesDiscarded, 64);
+  if (num != NULL) {
+    latencies->setObject("DeviceToHostDiscarded", num);
+    num->release();
+  }
+  
+  num = OSNumber::withNumber(mdioTimeouts, 32);
+  if (num != NULL) {
+    latencies->setObject("MDIOTimeouts", num);
+    num->release();
+  }
+  
+  setProperty("LatencyHistograms", latencies);
+  latencies->release();
+}
+
+void AzulNX2Ethernet::resetLatencyHistograms() {
+  bzero(latencyHistograms, sizeof (latencyHistograms));
+  deviceClock.probesDiscarded = 0;
+  mdioTimeouts = 0;
+}
+
+/**
+ Samples the device free-running timer against host time, and updates the measured device clock rate.
+ */
+void AzulNX2Ethernet::sampleDeviceClock() {
+  UInt64  hostBefore;
+  UInt64  hostAfter;
+  UInt64  hostNs;
+  UInt32  raw;
+  
+  hostBefore  = mach_absolute_time();
+  raw         = readReg32(NX2_TIMER_25MHZ_FREE_RUN);
+  hostAfter   = mach_absolute_time();
+  absolutetime_to_nanoseconds(hostBefore + ((hostAfter - hostBefore) / 2), &hostNs);
+  
+  //
+  // Extend the 32-bit timer to 64 bits.
+  //
+  if (deviceClock.samples != 0) {
+    deviceClock.ticks += (UInt32) (raw - deviceClock.lastRaw);
+  }
+  deviceClock.lastRaw = raw;
+  deviceClock.samples++;
+  
+  if (deviceClock.samples == 1) {
+    deviceClock.anchorHostNs  = hostNs;
+    deviceClock.anchorTicks   = deviceClock.ticks;
+    return;
+  }
+  
+  //
+  // Use the current window for the rate until the first full window completes.
+  //
+  deviceClock.anchorSamples++;
+  if (deviceClock.rateTicks == 0 || deviceClock.anchorSamples >= DEVICE_CLOCK_WINDOW) {
+    if (deviceClock.ticks != deviceClock.anchorTicks) {
+      deviceClock.rateHostNs  = hostNs - deviceClock.anchorHostNs;
+      deviceClock.rateTicks   = deviceClock.ticks - deviceClock.anchorTicks;
+    }
+  }
+  if (deviceClock.anchorSamples >= DEVICE_CLOCK_WINDOW) {
+    deviceClock.anchorHostNs  = hostNs;
+    deviceClock.anchorTicks   = deviceClock.ticks;
+    deviceClock.anchorSamples = 0;
+  }
+}
+
+UInt64 AzulNX2Ethernet::deviceTicksToNs(UInt64 ticks) {
+  if (deviceClock.rateTicks == 0) {
+    return ticks * DEVICE_CLOCK_NS_PER_TICK;
+  }
+  return (ticks * deviceClock.rateHostNs) / deviceClock.rateTicks;
+}
+
+SInt64 AzulNX2Ethernet::getDeviceClockDriftPpm() {
+  SInt64 nominalNs;
+  
+  if (deviceClock.rateTicks == 0) {
+    return 0;
+  }
+  
+  nominalNs = (SInt64) (deviceClock.rateTicks * DEVICE_CLOCK_NS_PER_TICK);
+  return (((SInt64) deviceClock.rateHostNs - nominalNs) * 1000000) / nominalNs;
+}
+
+/**
+ Forces a status block update and interrupt, noting the device time it was requested at.
+ */
+void AzulNX2Ethernet::startDeviceLatencyProbe() {
+  //
+  // Outstanding TX would almost certainly raise an update before the probe's own.
+  //
+  if (!deviceLatencyProbe || deviceClock.probePending || txRing.cons != txRing.prod) {
+    return;
+  }
+  
+  deviceClock.probeStatusIndex  = statusBlock->index;
+  deviceClock.probeRaw          = readReg32(NX2_TIMER_25MHZ_FREE_RUN);
+  deviceClock.probePending      = true;
+  writeReg32(NX2_HC_COMMAND, readShadowReg(kShadowRegHcCommand) | NX2_HC_COMMAND_COAL_NOW);
+}
+
+/**
+ Completes the probe on the first interrupt pass seeing a new status index.
+ The update is the probe's own only if it is the next one and carried no other work.
+ */
+void AzulNX2Ethernet::completeDeviceLatencyProbe(UInt32 endRaw, UInt16 statusIndex, bool idle) {
+  deviceClock.probePending = false;
+  if (!idle || (UInt16) (statusIndex - deviceClock.probeStatusIndex) != 1) {
+    deviceClock.probesDiscarded++;
+    return;
+  }
+  recordHistogram(&latencyHistograms[kLatencyDeviceToHost], deviceTicksToNs(endRaw - deviceClock.probeRaw));
+}
+
+static const char *workNames[kWorkCount] = {
+  "RXPackets",
+  "TXReclaimed",
+  "StatusDelta",
+  "LinkTime",
+  "TXTime",
+  "RXTime"
+};
+
+void AzulNX2Ethernet::publishInterruptWork() {
+  OSDictionary *work;
+  OSDictionary *histogram;
+  OSNumber     *num;
+  
+  work = OSDictionary::withCapacity(kWorkCount + 2);
+  if (work == NULL) {
+    return;
+  }
+  
+  for (UInt32 i = 0; i < kWorkCount; i++) {
+    histogram = copyHistogramDictionary(&interruptWork.histograms[i]);
+    if (histogram != NULL) {
+      work->setObject(workNames[i], histogram);
+      histogram->release();
+    }
+  }
+  
+  num = OSNumber::withNumber(interruptWork.passes, 64);
+  if (num != NULL) {
+    work->setObject("Passes", num);
+    num->release();
+  }
+  num = OSNumber::withNumber(interruptWork.idlePasses, 64);
+  if (num != NULL) {
+    work->setObject("IdlePasses", num);
+    num->release();
+  }
+  
+  setProperty("InterruptWork", work);
+  work->release();
+}
+
+void AzulNX2Ethernet::resetInterruptWork() {
+  bzero(&interruptWork, sizeof (interruptWork));
+}
+
+/**
+ Allocates the register trace ring if tracing is enabled.
+ */
+bool AzulNX2Ethernet::initRegisterTrace() {
+  OSBoolean *traceProp = OSDynamicCast(OSBoolean, getProperty("RegisterTrace"));
+  if (traceProp == NULL || !traceProp->isTrue()) {
+    return true;
+  }
+  
+  regTraceIndex = 0;
+  regTrace = (azul_nx2_reg_trace_entry_t*) IOMalloc(sizeof (azul_nx2_reg_trace_entry_t) * REG_TRACE_COUNT);
+  if (regTrace == NULL) {
+    return false;
+  }
+  bzero(regTrace, sizeof (azul_nx2_reg_trace_entry_t) * REG_TRACE_COUNT);
+  
+  DBGLOG("Register tracing enabled (%u entries)", REG_TRACE_COUNT);
+  return true;
+}
+
+void AzulNX2Ethernet::freeRegisterTrace() {
+  if (regTrace != NULL) {
+    IOFree(regTrace, sizeof (azul_nx2_reg_trace_entry_t) * REG_TRACE_COUNT);
+    regTrace = NULL;
+  }
+}
+
+/**
+ Publishes a snapshot of a trace ring, oldest entry first.
+ Entries must begin with an absolute timestamp, which is converted to nanoseconds relative to the oldest entry.
+ */
+void AzulNX2Ethernet::publishTraceRing(const char *name, const void *ring, size_t entrySize, UInt32 ringCount, UInt32 index) {
+  UInt8                       *snapshot;
+  UInt64                      *timestamp;
+  UInt32                      count;
+  UInt32                      first;
+  UInt64                      baseTime;
+  OSData                      *data;
+  
+  snapshot = (UInt8*) IOMalloc(entrySize * ringCount);
+  if (snapshot == NULL) {
+    return;
+  }
+  
+  //
+  // Ring has wrapped if more entries than its size were recorded.
+  //
+  count = index;
+  if (count > ringCount) {
+    first = count & (ringCount - 1);
+    count = ringCount;
+  } else {
+    first = 0;
+  }
+  
+  for (UInt32 i = 0; i < count; i++) {
+    memcpy(&snapshot[i * entrySize], &((const UInt8*) ring)[((first + i) & (ringCount - 1)) * entrySize], entrySize);
+  }
+  
+  baseTime = count > 0 ? *((UInt64*) snapshot) : 0;
+  for (UInt32 i = 0; i < count; i++) {
+    timestamp = (UInt64*) &snapshot[i * entrySize];
+    absolutetime_to_nanoseconds(*timestamp - baseTime, timestamp);
+  }
+  
+  data = OSData::withBytes(snapshot, (unsigned int) (entrySize * count));
+  if (data != NULL) {
+    setProperty(name, data);
+    data->release();
+  }
+  IOFree(snapshot, entrySize * ringCount);
+  
+  DBGLOG("Published %u %s entries", count, name);
+}
+
+void AzulNX2Ethernet::publishRegisterTrace() {
+  if (regTrace != NULL) {
+    publishTraceRing("RegisterTraceData", regTrace, sizeof (azul_nx2_reg_trace_entry_t), REG_TRACE_COUNT, (UInt32) regTraceIndex);
+  }
+}
+
+/**
+ Allocates the event trace ring. Event tracing is always enabled.
+ */
+bool AzulNX2Ethernet::initEventTrace() {
+  eventTraceIndex = 0;
+  eventTrace = (azul_nx2_event_trace_entry_t*) IOMalloc(sizeof (azul_nx2_event_trace_entry_t) * EVENT_TRACE_COUNT);
+  if (eventTrace == NULL) {
+    return false;
+  }
+  bzero(eventTrace, sizeof (azul_nx2_event_trace_entry_t) * EVENT_TRACE_COUNT);
+  return true;
+}
+
+void AzulNX2Ethernet::freeEventTrace() {
+  if (eventTrace != NULL) {
+    IOFree(eventTrace, sizeof (azul_nx2_event_trace_entry_t) * EVENT_TRACE_COUNT);
+    eventTrace = NULL;
+  }
+}
+
+void AzulNX2Ethernet::publishEventTrace() {
+  if (eventTrace != NULL) {
+    publishTraceRing("EventTraceData", eventTrace, sizeof (azul_nx2_event_trace_entry_t), EVENT_TRACE_COUNT, (UInt32) eventTraceIndex);
+  }
+}
+
+//
+// Shadowed register offsets, and the bits of each that are expected to read back as written.
+// Command bits in NX2_HC_COMMAND are self-clearing and are never stored in the shadow.
+//
+static const struct {
+  UInt32        offset;
+  UInt32        verifyMask;
+} shadowRegInfo[kShadowRegCount] = {
+  { NX2_HC_COMMAND,         NX2_HC_COMMAND_ENABLE | NX2_HC_COMMAND_SKIP_ABORT | NX2_HC_COMMAND_MAIN_PWR_INT },
+  { NX2_EMAC_MODE,          0xFFFFFFFF },
+  { NX2_EMAC_TX_MODE,       0xFFFFFFFF },
+  { NX2_EMAC_RX_MODE,       0xFFFFFFFF },
+  { NX2_EMAC_MDIO_MODE,     NX2_EMAC_MDIO_MODE_AUTO_POLL },
+  { NX2_MISC_NEW_CORE_CTL,  NX2_MISC_NEW_CORE_CTL_DMA_ENABLE }
+};
+
+/**
+ Loads shadowed registers from hardware.
+ */
+void AzulNX2Ethernet::loadShadowRegs() {
+  for (UInt32 i = 0; i < kShadowRegCount; i++) {
+    shadowRegs[i] = readReg32(shadowRegInfo[i].offset);
+  }
+}
+
+/**
+ Gets the last value written to a shadowed register.
+ */
+UInt32 AzulNX2Ethernet::readShadowReg(azul_nx2_shadow_reg_t reg) {
+  UInt32 value;
+  
+  if (shadowRegsVerify) {
+    value = readReg32(shadowRegInfo[reg].offset);
+    if ((value ^ shadowRegs[reg]) & shadowRegInfo[reg].verifyMask) {
+      SYSLOG("Shadow of register 0x%X is stale (shadow 0x%X, hardware 0x%X)", shadowRegInfo[reg].offset, shadowRegs[reg], value);
+      shadowRegs[reg] = value;
+    }
+  }
+  
+  return shadowRegs[reg];
+}
+
+/**
+ Writes a shadowed register.
+ */
+void AzulNX2Ethernet::writeShadowReg(azul_nx2_shadow_reg_t reg, UInt32 value) {
+  shadowRegs[reg] = value;
+  writeReg32(shadowRegInfo[reg].offset, value);
+}
+
 bool AzulNX2Ethernet::initEventSources(IOService *provider) {
   IOWorkLoop *mWorkLoop;
   
@@ -239,6 +781,80 @@ bool AzulNX2Ethernet::initEventSources(IOService *provider) {
   }
   interruptSource->enable();
   
+  //
+  // Create event source for controller bring-up.
+  //
+  bringupTimer = IOTimerEventSource::timerEventSource(this,
+    OSMemberFunctionCast(IOTimerEventSource::Action, this, &AzulNX2Ethernet::bringupTimerOccurred));
+  if (bringupTimer == NULL || mWorkLoop->addEventSource(bringupTimer) != kIOReturnSuccess) {
+    SYSLOG("Failed to initialize bring-up timer source");
+    return false;
+  }
+  bringupTimer->enable();
+  
+  //
+  // Create event source for background sampling.
+  //
+  sampleTimer = IOTimerEventSource::timerEventSource(this,
+    OSMemberFunctionCast(IOTimerEventSource::Action, this, &AzulNX2Ethernet::sampleTimerOccurred));
+  if (sampleTimer == NULL || mWorkLoop->addEventSource(sampleTimer) != kIOReturnSuccess) {
+    SYSLOG("Failed to initialize sampling timer source");
+    return false;
+  }
+  sampleTimer->enable();
+  
+  //
+  // Create event source for flow-through queue sampling bursts.
+  //
+  ftqTimer = IOTimerEventSource::timerEventSource(this,
+    OSMemberFunctionCast(IOTimerEventSource::Action, this, &AzulNX2Ethernet::ftqTimerOccurred));
+  if (ftqTimer == NULL || mWorkLoop->addEventSource(ftqTimer) != kIOReturnSuccess) {
+    SYSLOG("Failed to initialize FTQ sampling timer source");
+    return false;
+  }
+  ftqTimer->enable();
+  
+  //
+  // Create event source for deferred link updates.
+  // Link resolution polls the PHY over MDIO, so it runs on its own work loop to keep the main gate free.
+  // The PHY lock serializes MDIO between the two work loops.
+  //
+  phyLock = IORecursiveLockAlloc();
+  linkWorkLoop = IOWorkLoop::workLoop();
+  if (phyLock == NULL || linkWorkLoop == NULL) {
+    SYSLOG("Failed to initialize link work loop");
+    return false;
+  }
+  linkTimer = IOTimerEventSource::timerEventSource(this,
+    OSMemberFunctionCast(IOTimerEventSource::Action, this, &AzulNX2Ethernet::linkTimerOccurred));
+  if (linkTimer == NULL || linkWorkLoop->addEventSource(linkTimer) != kIOReturnSuccess) {
+    SYSLOG("Failed to initialize link timer source");
+    return false;
+  }
+  linkTimer->enable();
+  
+  //
+  // Create event source for the link monitor.
+  //
+  linkMonitorTimer = IOTimerEventSource::timerEventSource(this,
+    OSMemberFunctionCast(IOTimerEventSource::Action, this, &AzulNX2Ethernet::linkMonitorTimerOccurred));
+  if (linkMonitorTimer == NULL || mWorkLoop->addEventSource(linkMonitorTimer) != kIOReturnSuccess) {
+    SYSLOG("Failed to initialize link monitor timer source");
+    return false;
+  }
+  linkMonitorTimer->enable();
+  
+  //
+  // Create event source for the loopback self-test.
+  //
+  selfTestTimer = IOTimerEventSource::timerEventSource(this,
+    OSMemberFunctionCast(IOTimerEventSource::Action, this, &AzulNX2Ethernet::selfTestTimerOccurred));
+  if (selfTestTimer == NULL || mWorkLoop->addEventSource(selfTestTimer) != kIOReturnSuccess) {
+    SYSLOG("Failed to initialize self-test timer source");
+    return false;
+  }
+  selfTestTimer->enable();
+  
   return true;
 }
 
@@ -267,14 +883,10 @@ const char* AzulNX2Ethernet::getDeviceModel() const {
 }
 
 void AzulNX2Ethernet::enableInterrupts(bool coalNow) {
-  writeReg32(NX2_PCICFG_INT_ACK_CMD,
-             NX2_PCICFG_INT_ACK_CMD_INDEX_VALID |
-             NX2_PCICFG_INT_ACK_CMD_MASK_INT |
-             lastStatusIndex);
-  writeReg32(NX2_PCICFG_INT_ACK_CMD, NX2_PCICFG_INT_ACK_CMD_INDEX_VALID | lastStatusIndex);
+  nx2InterruptAck(&ringRegs, lastStatusIndex);
   
   if (coalNow) {
-    writeReg32(NX2_HC_COMMAND, readReg32(NX2_HC_COMMAND) | NX2_HC_COMMAND_COAL_NOW);
+    writeReg32(NX2_HC_COMMAND, readShadowReg(kShadowRegHcCommand) | NX2_HC_COMMAND_COAL_NOW);
   }
 }
 
@@ -283,27 +895,44 @@ void AzulNX2Ethernet::disableInterrupts() {
   readReg32(NX2_PCICFG_INT_ACK_CMD);
 }
 
-bool AzulNX2Ethernet::allocDmaBuffer(azul_nx2_dma_buf_t *dmaBuf, size_t size, UInt32 alignment) {
+bool AzulNX2Ethernet::allocDmaBuffer(azul_nx2_dma_buf_t *dmaBuf, size_t size, UInt32 alignment, bool cacheable, bool userShared) {
   IOBufferMemoryDescriptor  *bufDesc;
   IODMACommand              *dmaCmd;
   IODMACommand::Segment64   seg64;
   UInt64                    offset = 0;
   UInt32                    numSegs = 1;
+  IOOptionBits              options;
   
   mach_vm_address_t         physMask;
   UInt8                     dmaBits;
   
   //
-  // The BCM5708 cannot use more than 40 bit addresses.
+  // DMA address limits are determined by the chip family.
   //
-  physMask  = NX2_CHIP_NUM == NX2_CHIP_NUM_5708 ? DMA_BITS_40 : DMA_BITS_64;
+  dmaBits   = chipOps->dmaBits;
+  physMask  = nx2DmaMask(dmaBits);
   physMask &= ~(alignment - 1);
-  dmaBits   = NX2_CHIP_NUM == NX2_CHIP_NUM_5708 ? 40 : 64;
+  
+  //
+  // Cacheable memory is only used on cache coherent platforms.
+  //
+  options = kIODirectionInOut | kIOMemoryPhysicallyContiguous;
+  if (!cacheable || !DMA_COHERENT_PLATFORM) {
+    options  |= kIOMapInhibitCache;
+    cacheable = false;
+  }
+  
+  //
+  // Buffers mapped into a user process must be allocated as shared.
+  //
+  if (userShared) {
+    options |= kIOMemoryKernelUserShared;
+  }
   
   //
   // Create DMA buffer with required specifications and get physical address.
   //
-  bufDesc = IOBufferMemoryDescriptor::inTaskWithPhysicalMask(kernel_task, kIODirectionInOut | kIOMemoryPhysicallyContiguous | kIOMapInhibitCache, size, physMask);
+  bufDesc = IOBufferMemoryDescriptor::inTaskWithPhysicalMask(kernel_task, options, size, physMask);
   if (bufDesc == NULL) {
     SYSLOG("Failed to allocate DMA buffer memory of %u bytes", size);
     return false;
@@ -334,58 +963,241 @@ bool AzulNX2Ethernet::allocDmaBuffer(azul_nx2_dma_buf_t *dmaBuf, size_t size, UI
   dmaBuf->physAddr = seg64.fIOVMAddr;
   dmaBuf->buffer = bufDesc->getBytesNoCopy();
   dmaBuf->size = size;
+  dmaBuf->cacheable = cacheable;
   
   memset(dmaBuf->buffer, 0, dmaBuf->size);
-  DBGLOG("Mapped buffer of %u bytes to 0x%llX", dmaBuf->size, dmaBuf->physAddr);
+  DBGLOG("Mapped %s buffer of %u bytes to 0x%llX", cacheable ? "cacheable" : "uncached", dmaBuf->size, dmaBuf->physAddr);
   return true;
 }
 
 void AzulNX2Ethernet::freeDmaBuffer(azul_nx2_dma_buf_t *dmaBuf) {
-  dmaBuf->dmaCmd->release();
-  dmaBuf->bufDesc->complete();
-  dmaBuf->bufDesc->release();
+  //
+  // Buffers carved out of an arena do not own any memory.
+  //
+  if (dmaBuf->bufDesc != NULL) {
+    dmaBuf->dmaCmd->release();
+    dmaBuf->bufDesc->complete();
+    dmaBuf->bufDesc->release();
+  }
   
   memset(dmaBuf, 0, sizeof (*dmaBuf));
 }
 
-bool AzulNX2Ethernet::firmwareSync(UInt32 msgData) {
-  UInt32 reg = 0;
+/**
+ Allocates a single DMA buffer and carves it into the specified entries, each with its required alignment.
+ The layout is published in the DmaArenaLayout property.
+ */
+bool AzulNX2Ethernet::allocDmaArena(azul_nx2_dma_buf_t *arena, azul_nx2_dma_arena_entry_t *entries, UInt32 count, bool cacheable) {
+  size_t        offset;
+  size_t        entryOffset;
+  size_t        size = 0;
+  UInt32        alignment = PAGESIZE_16;
+  OSDictionary  *layout;
+  OSDictionary  *entryDict;
+  OSNumber      *num;
   
   //
-  // Increment the running sequence and send the message to the bootcode.
+  // Determine offset of each entry.
+  // The arena itself is aligned to the largest entry alignment.
   //
-  fwSyncSeq++;
-  msgData |= fwSyncSeq;
-  writeShMem32(NX2_DRV_MB, msgData);
+  for (UInt32 i = 0; i < count; i++) {
+    size  = (size + entries[i].alignment - 1) & ~((size_t) entries[i].alignment - 1);
+    size += entries[i].size;
+    
+    if (entries[i].alignment > alignment) {
+      alignment = entries[i].alignment;
+    }
+  }
   
-  //
-  // Wait for bootcode to acknowledge.
-  //
-  for (int i = 0; i < FW_ACK_TIME_OUT_MS; i++) {
-    reg = readShMem32(NX2_FW_MB);
-    if ((reg & NX2_FW_MSG_ACK) == (msgData & NX2_DRV_MSG_SEQ)) {
-      return true;
+  if (!allocDmaBuffer(arena, size, alignment, cacheable)) {
+    return false;
+  }
+  
+  layout = OSDictionary::withCapacity(count);
+  offset = 0;
+  for (UInt32 i = 0; i < count; i++) {
+    azul_nx2_dma_buf_t *dmaBuf = entries[i].dmaBuf;
+    
+    entryOffset = (offset + entries[i].alignment - 1) & ~((size_t) entries[i].alignment - 1);
+    offset      = entryOffset + entries[i].size;
+    
+    dmaBuf->bufDesc   = NULL;
+    dmaBuf->dmaCmd    = NULL;
+    dmaBuf->physAddr  = arena->physAddr + entryOffset;
+    dmaBuf->buffer    = ((UInt8*) arena->buffer) + entryOffset;
+    dmaBuf->size      = entries[i].size;
+    dmaBuf->cacheable = arena->cacheable;
+    DBGLOG("DMA arena: %s at offset 0x%X, %u bytes (phys 0x%llX)", entries[i].name, entryOffset, entries[i].size, dmaBuf->physAddr);
+    
+    if (layout == NULL) {
+      continue;
+    }
+    entryDict = OSDictionary::withCapacity(2);
+    if (entryDict == NULL) {
+      continue;
+    }
+    num = OSNumber::withNumber(entryOffset, 32);
+    if (num != NULL) {
+      entryDict->setObject("Offset", num);
+      num->release();
+    }
+    num = OSNumber::withNumber(entries[i].size, 32);
+    if (num != NULL) {
+      entryDict->setObject("Size", num);
+      num->release();
+    }
+    layout->setObject(entries[i].name, entryDict);
+    entryDict->release();
+  }
+  
+  if (layout != NULL) {
+    setProperty("DmaArenaLayout", layout);
+    layout->release();
+  }
+  
+  DBGLOG("DMA arena of %u bytes holds %u structures", size, count);
+  return true;
+}
+
+/**
+ Measures BD fill and status block polling cost for uncached and cacheable DMA memory.
+ Must run with the host coalescing block enabled and interrupts off, before the rings are started.
+ The status block address is pointed at each test buffer in turn and restored afterwards.
+ Results are published in the DescriptorBenchmark property.
+ */
+void AzulNX2Ethernet::benchmarkDmaBuffers() {
+  azul_nx2_dma_buf_t  benchBuffer;
+  tx_bd_t             *bdChain;
+  volatile UInt16     *statusIndex;
+  UInt16              statusValue;
+  UInt32              pollReads;
+  UInt32              updates;
+  UInt64              start, end, fillNs, pollNs, updateNs;
+  OSDictionary        *results;
+  OSNumber            *num;
+  
+  results = OSDictionary::withCapacity(6);
+  if (results == NULL) {
+    return;
+  }
+  
+  for (int mode = 0; mode < 2; mode++) {
+    bool cacheable = mode != 0;
+    if (!allocDmaBuffer(&benchBuffer, TX_PAGE_SIZE, PAGESIZE_4K, cacheable)) {
+      continue;
     }
     
-    IODelay(50);
+    //
+    // Fill every usable BD in the page as single BD packets, with a barrier per packet as sendTxPacket() does.
+    //
+    bdChain = (tx_bd_t*) benchBuffer.buffer;
+    clock_get_uptime(&start);
+    for (int i = 0; i < DMA_BENCH_ITERATIONS; i++) {
+      for (UInt32 j = 0; j < TX_USABLE_BD_COUNT; j++) {
+        bdChain[j].addrHi  = i;
+        bdChain[j].addrLo  = j;
+        bdChain[j].length  = MAX_PACKET_SIZE;
+        bdChain[j].flags   = TX_BD_FLAGS_START | TX_BD_FLAGS_END;
+        bdChain[j].vlanTag = 0;
+        DMA_WRITE_BARRIER();
+      }
+    }
+    clock_get_uptime(&end);
+    absolutetime_to_nanoseconds(end - start, &fillNs);
+    
+    //
+    // Poll the status block index while the controller updates it, as interruptOccurred() would.
+    // Each update is requested with a coalesce-now command that does not raise an interrupt.
+    //
+    bzero(benchBuffer.buffer, STATUS_BLOCK_SIZE);
+    statusIndex = &((status_block_t*) benchBuffer.buffer)->index;
+    writeReg32(NX2_HC_STATUS_ADDR_H, ADDR_HI(benchBuffer.physAddr));
+    writeReg32(NX2_HC_STATUS_ADDR_L, ADDR_LO(benchBuffer.physAddr));
+    
+    pollReads = 0;
+    updates   = 0;
+    clock_get_uptime(&start);
+    for (int i = 0; i < DMA_BENCH_ITERATIONS; i++) {
+      statusValue = *statusIndex;
+      writeReg32(NX2_HC_COMMAND, readShadowReg(kShadowRegHcCommand) | NX2_HC_COMMAND_COAL_NOW_WO_INT);
+      for (UInt32 j = 0; j < DMA_BENCH_POLL_LIMIT; j++) {
+        pollReads++;
+        if (*statusIndex != statusValue) {
+          updates++;
+          break;
+        }
+      }
+    }
+    clock_get_uptime(&end);
+    absolutetime_to_nanoseconds(end - start, &updateNs);
+    
+    writeReg32(NX2_HC_STATUS_ADDR_H, ADDR_HI(statusBuffer.physAddr));
+    writeReg32(NX2_HC_STATUS_ADDR_L, ADDR_LO(statusBuffer.physAddr));
+    freeDmaBuffer(&benchBuffer);
+    
+    fillNs    = fillNs / (DMA_BENCH_ITERATIONS * TX_USABLE_BD_COUNT);
+    pollNs    = updateNs / pollReads;
+    updateNs  = updates > 0 ? updateNs / updates : 0;
+    SYSLOG("%s DMA memory: BD fill %llu ns/packet, status poll %llu ns/read, %llu ns/update (%u of %u updates seen)",
+           cacheable ? "Cacheable" : "Uncached", fillNs, pollNs, updateNs, updates, DMA_BENCH_ITERATIONS);
+    
+    num = OSNumber::withNumber(fillNs, 64);
+    if (num != NULL) {
+      results->setObject(cacheable ? "CacheableBDFillNs" : "UncachedBDFillNs", num);
+      num->release();
+    }
+    num = OSNumber::withNumber(pollNs, 64);
+    if (num != NULL) {
+      results->setObject(cacheable ? "CacheableStatusPollNs" : "UncachedStatusPollNs", num);
+      num->release();
+    }
+    num = OSNumber::withNumber(updateNs, 64);
+    if (num != NULL) {
+      results->setObject(cacheable ? "CacheableStatusUpdateNs" : "UncachedStatusUpdateNs", num);
+      num->release();
+    }
   }
   
+  setProperty("DescriptorBenchmark", results);
+  results->release();
+}
+
+/**
+ Sends a message to the bootcode. Acknowledgement is checked with checkFirmwareSync().
+ */
+void AzulNX2Ethernet::postFirmwareSync(UInt32 msgData) {
   //
-  // Notify bootcode if we time out.
+  // Increment the running sequence and send the message to the bootcode.
   //
-  if (((reg & NX2_FW_MSG_ACK) != (msgData & NX2_DRV_MSG_SEQ)) &&
-      ((msgData & NX2_DRV_MSG_DATA) != NX2_DRV_MSG_DATA_WAIT0)) {
+  fwSyncSeq++;
+  fwSyncMsg = msgData | fwSyncSeq;
+  writeShMem32(NX2_DRV_MB, fwSyncMsg);
+}
+
+/**
+ Checks if the bootcode has acknowledged the last posted message.
+ */
+bool AzulNX2Ethernet::checkFirmwareSync() {
+  UInt32 reg = readShMem32(NX2_FW_MB);
+  return (reg & NX2_FW_MSG_ACK) == (fwSyncMsg & NX2_DRV_MSG_SEQ);
+}
+
+/**
+ Notifies the bootcode that the last posted message was not acknowledged in time.
+ */
+void AzulNX2Ethernet::timeoutFirmwareSync() {
+  UInt32 msgData = fwSyncMsg;
+  
+  if ((msgData & NX2_DRV_MSG_DATA) != NX2_DRV_MSG_DATA_WAIT0) {
     msgData &= ~NX2_DRV_MSG_CODE;
     msgData |= NX2_DRV_MSG_CODE_FW_TIMEOUT;
-    SYSLOG("Timed out waiting for firmware to respond 0%X 0%X", reg, msgData);
+    SYSLOG("Timed out waiting for firmware to respond 0%X 0%X", readShMem32(NX2_FW_MB), msgData);
     
     writeShMem32(NX2_DRV_MB, msgData);
-    return false;
   }
-  
-  return false;
 }
 
+template <typename Chip>
 bool AzulNX2Ethernet::initContext() {
   UInt32 reg = 0;
   UInt64 ctxAddr = 0;
@@ -395,7 +1207,7 @@ bool AzulNX2Ethernet::initContext() {
   //
   // 5709/5716 use host memory for the context. 5706/5708 have onboard memory.
   //
-  if (NX2_CHIP_NUM == NX2_CHIP_NUM_5709) {
+  if (Chip::hostContext) {
     DBGLOG("Initializing 5709/5716 on-host context memory");
     
     writeReg32(NX2_CTX_COMMAND,
@@ -459,7 +1271,7 @@ bool AzulNX2Ethernet::initContext() {
       writeReg32(NX2_CTX_PAGE_TBL, virtualCidAddr);
       
       for (UInt32 i = 0; i < PHY_CTX_SIZE; i += 4) {
-        writeContext32(0x00, i, 0);
+        writeContext32<Chip>(0x00, i, 0);
       }
       
       writeReg32(NX2_CTX_VIRT_ADDR, virtualCidAddr);
@@ -470,13 +1282,65 @@ bool AzulNX2Ethernet::initContext() {
   return true;
 }
 
+template bool AzulNX2Ethernet::initContext<nx2_chip_5706_t>();
+template bool AzulNX2Ethernet::initContext<nx2_chip_5708_t>();
+template bool AzulNX2Ethernet::initContext<nx2_chip_5709_t>();
+
+//
+// Chip operations for each supported family.
+// Tables are built within selectChipOps() as the templated members are private.
+//
+#define NX2_CHIP_OPS(chip) {                                    \
+  chip::hostContext, chip::dmaBits,                             \
+  chip::miscEnable, chip::resetWaitMs,                          \
+  &AzulNX2Ethernet::readContext32<chip>,                        \
+  &AzulNX2Ethernet::writeContext32<chip>,                       \
+  &AzulNX2Ethernet::initContext<chip>,                          \
+  &AzulNX2Ethernet::initTxRing<chip>,                           \
+  &AzulNX2Ethernet::resetControllerPrepare<chip>,               \
+  &AzulNX2Ethernet::resetControllerCore<chip>,                  \
+  &AzulNX2Ethernet::resetControllerCheck<chip>,                 \
+  &AzulNX2Ethernet::resetControllerFinish<chip>,                \
+  &AzulNX2Ethernet::initControllerChipLate<chip>,               \
+  &AzulNX2Ethernet::initCpus<chip>                              \
+}
+
+/**
+ Selects the chip operations for the detected chip family.
+ */
+bool AzulNX2Ethernet::selectChipOps() {
+  static const nx2_chip_ops_t chipOps5706 = NX2_CHIP_OPS(nx2_chip_5706_t);
+  static const nx2_chip_ops_t chipOps5708 = NX2_CHIP_OPS(nx2_chip_5708_t);
+  static const nx2_chip_ops_t chipOps5709 = NX2_CHIP_OPS(nx2_chip_5709_t);
+  
+  switch (NX2_CHIP_NUM) {
+    case NX2_CHIP_NUM_5706:
+      chipOps = &chipOps5706;
+      break;
+      
+    case NX2_CHIP_NUM_5708:
+      chipOps = &chipOps5708;
+      break;
+      
+    case NX2_CHIP_NUM_5709:
+      chipOps = &chipOps5709;
+      break;
+      
+    default:
+      return false;
+  }
+  
+  return true;
+}
+
 
 
+template <typename Chip>
 void AzulNX2Ethernet::initCpus() {
   //
   // 5706/5708 and 5709/5716 use different firmware versions.
   //
-  if (NX2_CHIP_NUM == NX2_CHIP_NUM_5709) {
+  if (Chip::is5709) {
     firmwareMips = (nx2_mips_fw_file_t*) bnx2_mips_09_6_2_1b_fw;
     
     if (NX2_CHIP_REV == NX2_CHIP_REV_Ax) {
@@ -505,6 +1369,10 @@ void AzulNX2Ethernet::initCpus() {
   initCpuCp();
 }
 
+template void AzulNX2Ethernet::initCpus<nx2_chip_5706_t>();
+template void AzulNX2Ethernet::initCpus<nx2_chip_5708_t>();
+template void AzulNX2Ethernet::initCpus<nx2_chip_5709_t>();
+
 UInt32 AzulNX2Ethernet::processRv2pFixup(UInt32 rv2pProc, UInt32 index, UInt32 fixup, UInt32 rv2pCode) {
   switch (index) {
     case 0:
@@ -673,6 +1541,7 @@ void AzulNX2Ethernet::initCpuRxp() {
   
   loadCpuFirmware(&rxpCpuReg, &firmwareMips->rxp);
   startCpu(&rxpCpuReg);
+  initCpuSampler(kCpuRxp, &rxpCpuReg, &firmwareMips->rxp);
   DBGLOG("RX processor initialized and started");
 }
 
@@ -694,6 +1563,7 @@ void AzulNX2Ethernet::initCpuTxp() {
   
   loadCpuFirmware(&txpCpuReg, &firmwareMips->txp);
   startCpu(&txpCpuReg);
+  initCpuSampler(kCpuTxp, &txpCpuReg, &firmwareMips->txp);
   DBGLOG("TX processor initialized and started");
 }
 
@@ -715,6 +1585,7 @@ void AzulNX2Ethernet::initCpuTpat() {
   
   loadCpuFirmware(&tpatCpuReg, &firmwareMips->tpat);
   startCpu(&tpatCpuReg);
+  initCpuSampler(kCpuTpat, &tpatCpuReg, &firmwareMips->tpat);
   DBGLOG("TX patch-up processor initialized and started");
 }
 
@@ -736,6 +1607,7 @@ void AzulNX2Ethernet::initCpuCom() {
   
   loadCpuFirmware(&comCpuReg, &firmwareMips->com);
   startCpu(&comCpuReg);
+  initCpuSampler(kCpuCom, &comCpuReg, &firmwareMips->com);
   DBGLOG("Completion processor initialized and started");
 }
 
@@ -757,5 +1629,349 @@ void AzulNX2Ethernet::initCpuCp() {
   
   loadCpuFirmware(&cpCpuReg, &firmwareMips->cp);
   startCpu(&cpCpuReg);
+  initCpuSampler(kCpuCp, &cpCpuReg, &firmwareMips->cp);
   DBGLOG("Command processor initialized and started");
 }
+
+static const char *cpuNames[kCpuCount] = {
+  "RXP",
+  "TXP",
+  "TPAT",
+  "COM",
+  "CP"
+};
+
+/**
+ Resets sampling state for a processor once its firmware is loaded.
+ */
+void AzulNX2Ethernet::initCpuSampler(azul_nx2_cpu_t cpu, const cpu_reg_t *cpuReg, const nx2_mips_fw_file_entry_t *mipsEntry) {
+  azul_nx2_cpu_sampler_t *sampler = &cpuSamplers[cpu];
+  
+  bzero(sampler, sizeof (*sampler));
+  sampler->reg        = *cpuReg;
+  sampler->textStart  = OSSwapBigToHostInt32(mipsEntry->text.address);
+  sampler->textLength = OSSwapBigToHostInt32(mipsEntry->text.length);
+}
+
+void AzulNX2Ethernet::startSampling() {
+  if (sampleTimer != NULL && sampleInterval != 0) {
+    sampleTimer->setTimeoutMS(sampleInterval);
+  }
+}
+
+void AzulNX2Ethernet::stopSampling() {
+  if (sampleTimer != NULL) {
+    sampleTimer->cancelTimeout();
+  }
+  if (ftqTimer != NULL) {
+    ftqTimer->cancelTimeout();
+  }
+  ftqBurstRemaining         = 0;
+  deviceClock.probePending  = false;
+}
+
+/**
+ Takes one sample of each on-chip processor.
+ */
+void AzulNX2Ethernet::sampleCpus() {
+  azul_nx2_cpu_sampler_t  *sampler;
+  UInt32                  pc;
+  UInt32                  bucket;
+  bool                    halted;
+  bool                    looping;
+  
+  for (UInt32 i = 0; i < kCpuCount; i++) {
+    sampler = &cpuSamplers[i];
+    if (sampler->textLength == 0) {
+      continue;
+    }
+    
+    pc                  = readRegIndr32(sampler->reg.pc);
+    sampler->state      = readRegIndr32(sampler->reg.state);
+    sampler->eventMask  = readRegIndr32(sampler->reg.evmask);
+    sampler->samples++;
+    
+    //
+    // Bin the program counter across the firmware text section.
+    //
+    if (pc >= sampler->textStart && pc - sampler->textStart < sampler->textLength) {
+      bucket = (UInt32) (((UInt64) (pc - sampler->textStart) * CPU_PC_BUCKETS) / sampler->textLength);
+      sampler->pcBuckets[bucket]++;
+    } else {
+      sampler->pcOutsideText++;
+    }
+    
+    if (pc == sampler->pc) {
+      sampler->samePcCount++;
+    } else {
+      sampler->samePcCount = 0;
+    }
+    sampler->pc = pc;
+    
+    //
+    // Report processors that have halted or stopped making progress.
+    //
+    halted  = (sampler->state & CPU_STATE_HALTED_MASK) != 0;
+    looping = !halted && sampler->samePcCount >= CPU_LOOP_SAMPLES;
+    if (halted) {
+      sampler->haltedSamples++;
+    }
+    
+    if (halted && !sampler->halted) {
+      SYSLOG("%s processor halted (PC 0x%X, state 0x%X)", cpuNames[i], pc, sampler->state);
+    }
+    if (looping && !sampler->looping) {
+      SYSLOG("%s processor appears stuck (PC 0x%X, state 0x%X)", cpuNames[i], pc, sampler->state);
+    }
+    sampler->halted   = halted;
+    sampler->looping  = looping;
+  }
+}
+
+void AzulNX2Ethernet::sampleTimerOccurred(IOTimerEventSource *source) {
+  azul_nx2_access_bucket_t prevBucket;
+  
+  //
+  // Processors are reloaded during bring-up, resume sampling once it completes.
+  //
+  if (isBringupActive()) {
+    return;
+  }
+  
+  prevBucket = setAccessBucket(kAccessBucketSampler);
+  sampleCpus();
+  sampleDeviceClock();
+  if (isEnabled) {
+    startDeviceLatencyProbe();
+    startFtqBurst();
+  }
+  setAccessBucket(prevBucket);
+  startSampling();
+}
+
+void AzulNX2Ethernet::publishCpuSamples() {
+  OSDictionary            *cpus;
+  OSDictionary            *cpu;
+  OSDictionary            *pcBuckets;
+  OSNumber                *num;
+  azul_nx2_cpu_sampler_t  *sampler;
+  char                    key[16];
+  
+  cpus = OSDictionary::withCapacity(kCpuCount);
+  if (cpus == NULL) {
+    return;
+  }
+  
+  for (UInt32 i = 0; i < kCpuCount; i++) {
+    sampler = &cpuSamplers[i];
+    cpu = OSDictionary::withCapacity(10);
+    if (cpu == NULL) {
+      continue;
+    }
+    
+    const struct {
+      const char  *name;
+      UInt64      value;
+      UInt32      bits;
+    } values[] = {
+      { "PC",             sampler->pc,            32 },
+      { "State",          sampler->state,         32 },
+      { "EventMask",      sampler->eventMask,     32 },
+      { "Samples",        sampler->samples,       64 },
+      { "HaltedSamples",  sampler->haltedSamples, 64 },
+      { "PCOutsideText",  sampler->pcOutsideText, 64 }
+    };
+    for (UInt32 j = 0; j < sizeof (values) / sizeof (values[0]); j++) {
+      num = OSNumber::withNumber(values[j].value, values[j].bits);
+      if (num != NULL) {
+        cpu->setObject(values[j].name, num);
+        num->release();
+      }
+    }
+    cpu->setObject("Halted", sampler->halted ? kOSBooleanTrue : kOSBooleanFalse);
+    cpu->setObject("Looping", sampler->looping ? kOSBooleanTrue : kOSBooleanFalse);
+    
+    //
+    // PC histogram buckets are keyed by their starting address.
+    //
+    pcBuckets = OSDictionary::withCapacity(CPU_PC_BUCKETS);
+    if (pcBuckets != NULL) {
+      for (UInt32 j = 0; j < CPU_PC_BUCKETS; j++) {
+        if (sampler->pcBuckets[j] == 0) {
+          continue;
+        }
+        
+        snprintf(key, sizeof (key), "0x%X", sampler->textStart + (UInt32) (((UInt64) sampler->textLength * j) / CPU_PC_BUCKETS));
+        num = OSNumber::withNumber(sampler->pcBuckets[j], 64);
+        if (num != NULL) {
+          pcBuckets->setObject(key, num);
+          num->release();
+        }
+      }
+      cpu->setObject("PCHistogram", pcBuckets);
+      pcBuckets->release();
+    }
+    
+    cpus->setObject(cpuNames[i], cpu);
+    cpu->release();
+  }
+  
+  setProperty("ProcessorSamples", cpus);
+  cpus->release();
+}
+
+static const struct {
+  const char  *name;
+  UInt32      ctlReg;
+} ftqInfo[kFtqCount] = {
+  { "RXLookup",       NX2_RLUP_FTQ_CTL },
+  { "RV2PProcessor",  NX2_RV2P_PFTQ_CTL },
+  { "RV2PTimer",      NX2_RV2P_TFTQ_CTL },
+  { "RV2PMailbox",    NX2_RV2P_MFTQ_CTL },
+  { "RV2PCSR",        NX2_RV2PCSR_FTQ_CTL },
+  { "RXDMA",          NX2_RDMA_FTQ_CTL },
+  { "TXScheduler",    NX2_TSCH_FTQ_CTL },
+  { "TXBDReader",     NX2_TBDR_FTQ_CTL },
+  { "CompletionScheduler", NX2_CSCH_CH_FTQ_CTL }
+};
+
+/**
+ Takes one sample of each flow-through queue depth, recording it in the time series.
+ */
+void AzulNX2Ethernet::sampleFtqs() {
+  azul_nx2_ftq_sampler_t      *sampler;
+  azul_nx2_ftq_series_entry_t *entry;
+  UInt32                      reg;
+  UInt32                      depth;
+  
+  entry = &ftqSeries[ftqSeriesIndex++ & (FTQ_SERIES_COUNT - 1)];
+  entry->timestamp = mach_absolute_time();
+  
+  for (UInt32 i = 0; i < kFtqCount; i++) {
+    sampler = &ftqSamplers[i];
+    
+    reg   = readReg32(ftqInfo[i].ctlReg);
+    depth = (reg & NX2_RLUP_FTQ_CTL_CUR_DEPTH) >> FTQ_CTL_CUR_DEPTH_SHIFT;
+    entry->depths[i] = depth;
+    
+    sampler->maxDepth   = (reg & NX2_RLUP_FTQ_CTL_MAX_DEPTH) >> FTQ_CTL_MAX_DEPTH_SHIFT;
+    sampler->depthSum  += depth;
+    sampler->samples++;
+    if (depth > sampler->peakDepth) {
+      sampler->peakDepth = depth;
+    }
+    if (sampler->maxDepth != 0 && depth >= sampler->maxDepth) {
+      sampler->fullSamples++;
+    }
+    recordHistogram(&sampler->depths, depth);
+  }
+}
+
+/**
+ Starts a burst of flow-through queue samples, unless one is already running.
+ */
+void AzulNX2Ethernet::startFtqBurst() {
+  if (ftqTimer == NULL || ftqSampleInterval == 0 || ftqBurstRemaining != 0) {
+    return;
+  }
+  
+  ftqBurstRemaining = FTQ_BURST_SAMPLES;
+  ftqTimer->setTimeoutUS(ftqSampleInterval);
+}
+
+void AzulNX2Ethernet::ftqTimerOccurred(IOTimerEventSource *source) {
+  azul_nx2_access_bucket_t prevBucket;
+  
+  if (!isEnabled || isBringupActive() || ftqBurstRemaining == 0) {
+    ftqBurstRemaining = 0;
+    return;
+  }
+  
+  prevBucket = setAccessBucket(kAccessBucketSampler);
+  sampleFtqs();
+  setAccessBucket(prevBucket);
+  
+  if (--ftqBurstRemaining > 0) {
+    ftqTimer->setTimeoutUS(ftqSampleInterval);
+  }
+}
+
+void AzulNX2Ethernet::publishFtqSamples() {
+  OSDictionary            *ftqs;
+  OSDictionary            *ftq;
+  OSDictionary            *histogram;
+  OSNumber                *num;
+  azul_nx2_ftq_sampler_t  *sampler;
+  UInt64                  fill;
+  UInt64                  worstFill = 0;
+  SInt32                  worst = -1;
+  
+  ftqs = OSDictionary::withCapacity(kFtqCount + 1);
+  if (ftqs == NULL) {
+    return;
+  }
+  
+  for (UInt32 i = 0; i < kFtqCount; i++) {
+    sampler = &ftqSamplers[i];
+    ftq = OSDictionary::withCapacity(5);
+    if (ftq == NULL) {
+      continue;
+    }
+    
+    const struct {
+      const char  *name;
+      UInt64      value;
+    } values[] = {
+      { "MaxDepth",     sampler->maxDepth },
+      { "PeakDepth",    sampler->peakDepth },
+      { "Samples",      sampler->samples },
+      { "FullSamples",  sampler->fullSamples }
+    };
+    for (UInt32 j = 0; j < sizeof (values) / sizeof (values[0]); j++) {
+      num = OSNumber::withNumber(values[j].value, 64);
+      if (num != NULL) {
+        ftq->setObject(values[j].name, num);
+        num->release();
+      }
+    }
+    
+    histogram = copyHistogramDictionary(&sampler->depths);
+    if (histogram != NULL) {
+      ftq->setObject("Depths", histogram);
+      histogram->release();
+    }
+    
+    ftqs->setObject(ftqInfo[i].name, ftq);
+    ftq->release();
+    
+    //
+    // Average fill is tracked in parts per thousand of the maximum depth.
+    //
+    if (sampler->samples != 0 && sampler->maxDepth != 0) {
+      fill = (sampler->depthSum * 1000) / (sampler->samples * sampler->maxDepth);
+      if (fill > worstFill) {
+        worstFill = fill;
+        worst     = i;
+      }
+    }
+  }
+  
+  if (worst >= 0) {
+    OSString *bottleneck = OSString::withCString(ftqInfo[worst].name);
+    if (bottleneck != NULL) {
+      ftqs->setObject("Bottleneck", bottleneck);
+      bottleneck->release();
+    }
+  }
+  
+  setProperty("FtqSamples", ftqs);
+  ftqs->release();
+  
+  publishTraceRing("FtqSeriesData", ftqSeries, sizeof (azul_nx2_ftq_series_entry_t), FTQ_SERIES_COUNT, ftqSeriesIndex);
+}
+
+void AzulNX2Ethernet::resetFtqSamples() {
+  bzero(ftqSamplers, sizeof (ftqSamplers));
+  bzero(ftqSeries, sizeof (ftqSeries));
+  ftqSeriesIndex = 0;
+}
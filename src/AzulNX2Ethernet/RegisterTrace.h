@@ -0,0 +1,56 @@
+/*
+ *
+ * Copyright (c) 2021 Goldfish64
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __REGISTER_TRACE_H__
+#define __REGISTER_TRACE_H__
+
+//
+// OS-independent format of the register access trace, shared with the host trace analysis tool.
+// The platform including this header must provide the UInt types.
+//
+// Tracing is enabled with the RegisterTrace property. Each access is recorded into a fixed ring;
+// the most recent REG_TRACE_COUNT accesses are kept. The trace is published as the RegisterTraceData
+// property in oldest-first order, with timestamps converted to nanoseconds relative to the oldest entry.
+// It is published once bring-up completes or fails, and on demand by setting the DumpRegisterTrace property.
+//
+#define REG_TRACE_COUNT       4096
+
+typedef enum {
+  kRegTraceRead16 = 0,
+  kRegTraceRead32,
+  kRegTraceReadIndr32,
+  kRegTraceReadPhy16,
+  kRegTraceWrite16,
+  kRegTraceWrite32,
+  kRegTraceWriteIndr32,
+  kRegTraceWritePhy16
+} azul_nx2_reg_trace_type_t;
+
+typedef struct {
+  UInt64                    timestamp;
+  UInt32                    type : 8;
+  UInt32                    offset : 24;
+  UInt32                    value;
+} azul_nx2_reg_trace_entry_t;
+
+#endif
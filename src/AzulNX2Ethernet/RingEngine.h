@@ -0,0 +1,358 @@
+/*
+ *
+ * Copyright (c) 2021 Goldfish64
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __RING_ENGINE_H__
+#define __RING_ENGINE_H__
+
+//
+// OS-independent TX/RX ring engine.
+//
+// The platform including this header must provide the UInt types, BIT(), nx2_packet_t, DMA_WRITE_BARRIER()
+// and the Registers.h definitions. Segments passed in must have location and length members.
+// Register access goes through a Regs object with writeReg16() and writeReg32(), so the kext and the host
+// build ring the same doorbells. DMA mapping and packet buffers are left to the platform.
+//
+// Hardware contract relied on by the engine and its callers, for anything modelling the device side:
+//   - TX: the driver writes prod to NX2_L2MQ_TX_HOST_BIDX and prodBufferSize to NX2_L2MQ_TX_HOST_BSEQ.
+//     The device consumes BDs up to BIDX and DMAs the updated index into the status block txConsumer0.
+//   - RX: the driver writes prod to NX2_L2MQ_RX_HOST_BDIDX and prodBufferSize to NX2_L2MQ_RX_HOST_BSEQ.
+//     The device fills posted BDs and DMAs the updated index into the status block rxConsumer0.
+//   - Indexes are free-running and skip the final BD of each page, which links back to the chain start.
+//     A consumer index landing on that BD is advanced past it by the driver (see nx2TxRingReadCons/nx2RxRingReadCons).
+//   - The status block index increments on every update; the driver acks it through
+//     NX2_PCICFG_INT_ACK_CMD with INDEX_VALID set, which re-arms the interrupt.
+//
+#include "HwBuffers.h"
+
+//
+// TX and RX ring state is split by owner so the output thread and the work loop
+// do not write to the same cache lines. Packet arrays are kept on separate lines from the indexes.
+//
+#define CACHE_LINE_SIZE       64
+#define CACHE_LINE_ALIGNED    __attribute__((aligned(CACHE_LINE_SIZE)))
+
+typedef struct {
+  //
+  // Producer fields, owned by the output thread.
+  //
+  tx_bd_t                   *chain;
+  UInt16                    prod;
+  UInt32                    prodBufferSize;
+  UInt32                    prodCount;
+  
+  //
+  // Consumer fields, owned by the work loop.
+  //
+  UInt16                    cons CACHE_LINE_ALIGNED;
+  UInt32                    consCount;
+  
+  nx2_packet_t              packets[TX_USABLE_BD_COUNT] CACHE_LINE_ALIGNED;
+} azul_nx2_tx_ring_t;
+
+typedef struct {
+  //
+  // Producer fields, used when refilling descriptors.
+  //
+  rx_bd_t                   *chain;
+  UInt16                    prod;
+  UInt32                    prodBufferSize;
+  
+  //
+  // Consumer fields, used when harvesting received packets.
+  //
+  UInt16                    cons CACHE_LINE_ALIGNED;
+  
+  nx2_packet_t              packets[RX_USABLE_BD_COUNT] CACHE_LINE_ALIGNED;
+} azul_nx2_rx_ring_t;
+
+static_assert(offsetof(azul_nx2_tx_ring_t, prodCount) + sizeof (UInt32) <= CACHE_LINE_SIZE, "TX producer must fit in one cache line");
+static_assert(offsetof(azul_nx2_tx_ring_t, cons) == CACHE_LINE_SIZE, "TX consumer must start its own cache line");
+static_assert(offsetof(azul_nx2_tx_ring_t, packets) == 2 * CACHE_LINE_SIZE, "TX packets must follow the consumer line");
+static_assert(offsetof(azul_nx2_rx_ring_t, prodBufferSize) + sizeof (UInt32) <= CACHE_LINE_SIZE, "RX producer must fit in one cache line");
+static_assert(offsetof(azul_nx2_rx_ring_t, cons) == CACHE_LINE_SIZE, "RX consumer must start its own cache line");
+static_assert(offsetof(azul_nx2_rx_ring_t, packets) == 2 * CACHE_LINE_SIZE, "RX packets must follow the consumer line");
+
+//
+// Initializes the TX ring. The final BD is a pointer back to the start of the chain.
+//
+static inline void nx2TxRingInit(azul_nx2_tx_ring_t *ring, tx_bd_t *chain, UInt64 chainPhysAddr) {
+  tx_bd_t *bdLast;
+  
+  ring->chain           = chain;
+  ring->prod            = 0;
+  ring->cons            = 0;
+  ring->prodBufferSize  = 0;
+  ring->prodCount       = 0;
+  ring->consCount       = 0;
+  
+  //
+  // Packets posted before a reset must already have been freed by the caller.
+  //
+  memset(ring->packets, 0, sizeof (ring->packets));
+  
+  bdLast          = &chain[TX_USABLE_BD_COUNT];
+  bdLast->addrHi  = ADDR_HI(chainPhysAddr);
+  bdLast->addrLo  = ADDR_LO(chainPhysAddr);
+}
+
+static inline UInt16 nx2TxRingFreeCount(const azul_nx2_tx_ring_t *ring) {
+  return (TX_USABLE_BD_COUNT - 1) - (ring->prodCount - ring->consCount);
+}
+
+//
+// Checks if a packet of segmentCount BDs can be posted. One BD is always left free.
+//
+static inline bool nx2TxRingHasRoom(const azul_nx2_tx_ring_t *ring, UInt32 segmentCount) {
+  return segmentCount < nx2TxRingFreeCount(ring);
+}
+
+//
+// Makes posted BDs visible to the controller and rings the TX doorbell.
+//
+template <typename Regs>
+static inline void nx2TxRingDoorbell(Regs *regs, const azul_nx2_tx_ring_t *ring) {
+  DMA_WRITE_BARRIER();
+  regs->writeReg16(MB_GET_CID_ADDR(TX_CID) + NX2_L2MQ_TX_HOST_BIDX, ring->prod);
+  regs->writeReg32(MB_GET_CID_ADDR(TX_CID) + NX2_L2MQ_TX_HOST_BSEQ, ring->prodBufferSize);
+}
+
+//
+// Returns the TX consumer index from the status block, advanced past the final BD of the page.
+//
+static inline UInt16 nx2TxRingReadCons(const status_block_t *statusBlock) {
+  UInt16 cons = __atomic_load_n(&statusBlock->txConsumer0, __ATOMIC_ACQUIRE);
+  if ((cons & TX_USABLE_BD_COUNT) == TX_USABLE_BD_COUNT) {
+    cons++;
+  }
+  return cons;
+}
+
+//
+// Fills BDs for a packet. The caller must ensure enough BDs are free.
+// The packet is stored with the final BD for freeing on completion, and the index of that BD is returned.
+//
+template <typename Segment>
+static inline UInt16 nx2TxRingPost(azul_nx2_tx_ring_t *ring, const Segment *segments, UInt32 segmentCount,
+                                 UInt16 bdFlags, UInt16 bdVlanTag, nx2_packet_t packet) {
+  UInt16 txIndex = 0;
+  
+  bdFlags |= TX_BD_FLAGS_START;
+  for (UInt32 i = 0; i < segmentCount; i++) {
+    //
+    // Hardware maintains a separate index from the driver.
+    // The hardware index continues to increment until it rolls over.
+    //
+    txIndex = TX_BD_INDEX(ring->prod);
+    
+    //
+    // Add end flag if final segment.
+    //
+    if (i == segmentCount - 1) {
+      bdFlags |= TX_BD_FLAGS_END;
+    }
+    
+    ring->chain[txIndex].addrHi   = ADDR_HI(segments[i].location);
+    ring->chain[txIndex].addrLo   = ADDR_LO(segments[i].location);
+    ring->chain[txIndex].length   = (UInt32) segments[i].length;
+    ring->chain[txIndex].flags    = bdFlags;
+    ring->chain[txIndex].vlanTag  = bdVlanTag;
+    
+    //
+    // Next BD will normally be +1, but the final BD is reserved to be a pointer to the start of the chain.
+    //
+    ring->prodBufferSize += (UInt32) segments[i].length;
+    ring->prod            = TX_NEXT_BD(ring->prod);
+    
+    //
+    // Only the first BD carries the start flag.
+    //
+    bdFlags &= ~TX_BD_FLAGS_START;
+  }
+  
+  ring->packets[txIndex]  = packet;
+  ring->prodCount        += segmentCount;
+  return txIndex;
+}
+
+//
+// Reclaims completed BDs up to the new hardware consumer index, calling freePacket with each completed packet and its BD index.
+//
+template <typename FreePacket>
+static inline UInt32 nx2TxRingReclaim(azul_nx2_tx_ring_t *ring, UInt16 consNew, FreePacket freePacket) {
+  UInt16 txIndex;
+  UInt32 count = 0;
+  
+  while (ring->cons != consNew) {
+    txIndex = TX_BD_INDEX(ring->cons);
+    
+    if (ring->packets[txIndex] != NULL) {
+      freePacket(ring->packets[txIndex], txIndex);
+      ring->packets[txIndex] = NULL;
+    }
+    
+    count++;
+    ring->cons = TX_NEXT_BD(ring->cons);
+  }
+  
+  ring->consCount += count;
+  return count;
+}
+
+//
+// Reclaims completed BDs as above, calling complete with every BD index.
+// For callers that post single BD packets and track them outside of the ring.
+//
+template <typename Complete>
+static inline UInt32 nx2TxRingReclaimEach(azul_nx2_tx_ring_t *ring, UInt16 consNew, Complete complete) {
+  UInt32 count = 0;
+  
+  while (ring->cons != consNew) {
+    complete(TX_BD_INDEX(ring->cons));
+    
+    count++;
+    ring->cons = TX_NEXT_BD(ring->cons);
+  }
+  
+  ring->consCount += count;
+  return count;
+}
+
+//
+// Initializes the RX ring. The final BD is a pointer back to the start of the chain.
+//
+static inline void nx2RxRingInit(azul_nx2_rx_ring_t *ring, rx_bd_t *chain, UInt64 chainPhysAddr) {
+  rx_bd_t *bdLast;
+  
+  ring->chain           = chain;
+  ring->prod            = 0;
+  ring->cons            = 0;
+  ring->prodBufferSize  = 0;
+  
+  bdLast          = &chain[RX_USABLE_BD_COUNT];
+  bdLast->addrHi  = ADDR_HI(chainPhysAddr);
+  bdLast->addrLo  = ADDR_LO(chainPhysAddr);
+}
+
+//
+// Fills the RX BD at the specified index and advances the producer.
+//
+static inline void nx2RxRingPost(azul_nx2_rx_ring_t *ring, UInt16 rxIndex, UInt64 location, UInt32 length) {
+  ring->chain[rxIndex].addrHi = ADDR_HI(location);
+  ring->chain[rxIndex].addrLo = ADDR_LO(location);
+  ring->chain[rxIndex].flags  = RX_BD_FLAGS_START | RX_BD_FLAGS_END;
+  ring->chain[rxIndex].length = length;
+  
+  ring->prodBufferSize += length;
+  ring->prod            = RX_NEXT_BD(ring->prod);
+}
+
+//
+// Returns the BD index of the next received packet and advances the consumer.
+//
+static inline UInt16 nx2RxRingConsume(azul_nx2_rx_ring_t *ring) {
+  UInt16 rxIndex = RX_BD_INDEX(ring->cons);
+  ring->cons = RX_NEXT_BD(ring->cons);
+  return rxIndex;
+}
+
+//
+// Harvests received packets up to the new hardware consumer index, refilling each BD before moving on to the next.
+//   - frame(rxIndex) returns the rx_l2_header_t the controller wrote in front of the packet.
+//   - input(rxIndex, l2Header, packetLength, valid) is given the packet, with packetLength excluding the CRC.
+//     Packets with errors or a bad length are not valid. Returns true if the packet's buffer was taken.
+//   - refill(rxIndex, reuse) posts a BD in place of the one consumed, with the same buffer if reuse is set.
+// Returns the number of BDs harvested. The doorbell is left to the caller.
+//
+template <typename Frame, typename Input, typename Refill>
+static inline UInt32 nx2RxRingHarvest(azul_nx2_rx_ring_t *ring, UInt16 consNew, Frame frame, Input input, Refill refill) {
+  UInt16          rxIndex;
+  rx_l2_header_t  *l2Header;
+  UInt16          packetLength;
+  bool            valid;
+  UInt32          count = 0;
+  
+  while (ring->cons != consNew) {
+    rxIndex       = nx2RxRingConsume(ring);
+    l2Header      = frame(rxIndex);
+    packetLength  = l2Header->packetLength - kIOEthernetCRCSize;
+    valid         = packetLength <= MAX_PACKET_SIZE && l2Header->errors == 0;
+    
+    refill(rxIndex, !input(rxIndex, l2Header, packetLength, valid));
+    count++;
+  }
+  return count;
+}
+
+//
+// Makes posted BDs visible to the controller and rings the RX doorbell.
+//
+template <typename Regs>
+static inline void nx2RxRingDoorbell(Regs *regs, const azul_nx2_rx_ring_t *ring) {
+  DMA_WRITE_BARRIER();
+  regs->writeReg16(MB_GET_CID_ADDR(RX_CID) + NX2_L2MQ_RX_HOST_BDIDX, ring->prod);
+  regs->writeReg32(MB_GET_CID_ADDR(RX_CID) + NX2_L2MQ_RX_HOST_BSEQ, ring->prodBufferSize);
+}
+
+//
+// Returns the RX consumer index from the status block, advanced past the final BD of the page.
+//
+static inline UInt16 nx2RxRingReadCons(const status_block_t *statusBlock) {
+  UInt16 cons = __atomic_load_n(&statusBlock->rxConsumer0, __ATOMIC_ACQUIRE);
+  if ((cons & RX_USABLE_BD_COUNT) == RX_USABLE_BD_COUNT) {
+    cons++;
+  }
+  return cons;
+}
+
+//
+// Interrupt pass. The interrupt is masked on entry, each ring whose consumer index has moved is serviced
+// with tx(txConsNew) and rx(rxConsNew), and the caller then acks the status index it saw to unmask it.
+//
+template <typename Regs>
+static inline void nx2InterruptMask(Regs *regs) {
+  regs->writeReg32(NX2_PCICFG_INT_ACK_CMD, NX2_PCICFG_INT_ACK_CMD_USE_INT_HC_PARAM | NX2_PCICFG_INT_ACK_CMD_MASK_INT);
+}
+
+template <typename Tx, typename Rx>
+static inline void nx2InterruptService(const status_block_t *statusBlock, const azul_nx2_tx_ring_t *txRing,
+                                       const azul_nx2_rx_ring_t *rxRing, Tx tx, Rx rx) {
+  UInt16 txConsNew = nx2TxRingReadCons(statusBlock);
+  UInt16 rxConsNew;
+  
+  if (txRing->cons != txConsNew) {
+    tx(txConsNew);
+  }
+  
+  rxConsNew = nx2RxRingReadCons(statusBlock);
+  if (rxRing->cons != rxConsNew) {
+    rx(rxConsNew);
+  }
+}
+
+template <typename Regs>
+static inline void nx2InterruptAck(Regs *regs, UInt16 statusIndex) {
+  regs->writeReg32(NX2_PCICFG_INT_ACK_CMD, NX2_PCICFG_INT_ACK_CMD_INDEX_VALID | NX2_PCICFG_INT_ACK_CMD_MASK_INT | statusIndex);
+  regs->writeReg32(NX2_PCICFG_INT_ACK_CMD, NX2_PCICFG_INT_ACK_CMD_INDEX_VALID | statusIndex);
+}
+
+#endif
@@ -0,0 +1,442 @@
+/*
+ *
+ * Copyright (c) 2021 Goldfish64
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "AzulNX2Ethernet.h"
+
+//
+// Default frame size mix, 7:4:1 of minimum, 576-byte and maximum frames.
+//
+static const UInt16 selfTestDefaultSizes[] = {
+  SELF_TEST_MIN_FRAME, SELF_TEST_MIN_FRAME, SELF_TEST_MIN_FRAME, SELF_TEST_MIN_FRAME,
+  SELF_TEST_MIN_FRAME, SELF_TEST_MIN_FRAME, SELF_TEST_MIN_FRAME,
+  576 - kIOEthernetCRCSize, 576 - kIOEthernetCRCSize, 576 - kIOEthernetCRCSize, 576 - kIOEthernetCRCSize,
+  SELF_TEST_MAX_FRAME
+};
+
+/**
+ Validates the self-test configuration and starts the test on the work loop.
+ */
+IOReturn AzulNX2Ethernet::beginSelfTest(OSDictionary *config) {
+  OSString  *modeString;
+  OSNumber  *num;
+  OSArray   *sizes;
+  UInt32    size;
+  
+  if (!isEnabled || isBringupActive() || selfTestTimer == NULL) {
+    return kIOReturnNotReady;
+  }
+  if (isSelfTestActive() || isBypassActive()) {
+    return kIOReturnBusy;
+  }
+  
+  bzero(&selfTest, sizeof (selfTest));
+  selfTest.mode           = kSelfTestModeMac;
+  selfTest.frameCount     = SELF_TEST_FRAME_COUNT;
+  selfTest.burstLength    = SELF_TEST_BURST_LENGTH;
+  selfTest.frameSizeCount = sizeof (selfTestDefaultSizes) / sizeof (selfTestDefaultSizes[0]);
+  memcpy(selfTest.frameSizes, selfTestDefaultSizes, sizeof (selfTestDefaultSizes));
+  
+  if (config != NULL) {
+    modeString = OSDynamicCast(OSString, config->getObject("Mode"));
+    if (modeString != NULL) {
+      if (modeString->isEqualTo("PHY")) {
+        selfTest.mode = kSelfTestModePhy;
+      } else if (!modeString->isEqualTo("MAC")) {
+        return kIOReturnBadArgument;
+      }
+    }
+    
+    num = OSDynamicCast(OSNumber, config->getObject("FrameCount"));
+    if (num != NULL) {
+      selfTest.frameCount = num->unsigned32BitValue();
+    }
+    num = OSDynamicCast(OSNumber, config->getObject("BurstLength"));
+    if (num != NULL) {
+      selfTest.burstLength = num->unsigned32BitValue();
+    }
+    
+    sizes = OSDynamicCast(OSArray, config->getObject("FrameSizes"));
+    if (sizes != NULL) {
+      if (sizes->getCount() == 0 || sizes->getCount() > SELF_TEST_MAX_SIZES) {
+        return kIOReturnBadArgument;
+      }
+      
+      for (UInt32 i = 0; i < sizes->getCount(); i++) {
+        num = OSDynamicCast(OSNumber, sizes->getObject(i));
+        if (num == NULL) {
+          return kIOReturnBadArgument;
+        }
+        
+        size = num->unsigned32BitValue();
+        if (size < SELF_TEST_MIN_FRAME || size > SELF_TEST_MAX_FRAME) {
+          return kIOReturnBadArgument;
+        }
+        selfTest.frameSizes[i] = size;
+      }
+      selfTest.frameSizeCount = sizes->getCount();
+    }
+  }
+  
+  if (selfTest.frameCount == 0 || selfTest.burstLength == 0) {
+    return kIOReturnBadArgument;
+  }
+  
+  SYSLOG("Starting %s loopback self-test of %u frames, burst length %u",
+         selfTest.mode == kSelfTestModePhy ? "PHY" : "MAC", selfTest.frameCount, selfTest.burstLength);
+  selfTest.state = kSelfTestStateStarting;
+  selfTestTimer->setTimeoutUS(1);
+  return kIOReturnSuccess;
+}
+
+/**
+ Abandons any running self-test, used when the controller is about to be reset.
+ The EMAC is restored by the reset, but the PHY keeps its loopback setting.
+ */
+void AzulNX2Ethernet::cancelSelfTest() {
+  if (selfTestTimer != NULL) {
+    selfTestTimer->cancelTimeout();
+  }
+  
+  if ((selfTest.state == kSelfTestStateRunning || selfTest.state == kSelfTestStateDraining) &&
+      selfTest.mode == kSelfTestModePhy) {
+    writePhyReg16(PHY_MII_CONTROL, selfTest.savedPhyControl);
+  }
+  selfTest.state = kSelfTestStateIdle;
+}
+
+bool AzulNX2Ethernet::startSelfTestLoopback() {
+  UInt32 mode = readShadowReg(kShadowRegEmacMode);
+  
+  mode &= ~(NX2_EMAC_MODE_PORT | NX2_EMAC_MODE_HALF_DUPLEX |
+            NX2_EMAC_MODE_MAC_LOOP | NX2_EMAC_MODE_FORCE_LINK |
+            NX2_EMAC_MODE_25G);
+  mode |= NX2_EMAC_MODE_PORT_GMII;
+  
+  if (selfTest.mode == kSelfTestModePhy) {
+    if (IORETURN_ERR(readPhyReg16(PHY_MII_CONTROL, &selfTest.savedPhyControl))) {
+      return false;
+    }
+    if (IORETURN_ERR(enablePHYLoopback())) {
+      writePhyReg16(PHY_MII_CONTROL, selfTest.savedPhyControl);
+      return false;
+    }
+  } else {
+    //
+    // MAC loopback never reaches the PHY, so the EMAC link is forced up.
+    //
+    mode |= NX2_EMAC_MODE_MAC_LOOP | NX2_EMAC_MODE_FORCE_LINK;
+  }
+  
+  writeShadowReg(kShadowRegEmacMode, mode);
+  return true;
+}
+
+void AzulNX2Ethernet::stopSelfTestLoopback() {
+  UInt16 control = selfTest.savedPhyControl;
+  
+  //
+  // Restore the PHY, restarting autonegotiation if it was in use.
+  //
+  if (selfTest.mode == kSelfTestModePhy) {
+    if (control & PHY_MII_CONTROL_AUTO_NEG_ENABLE) {
+      control |= PHY_MII_CONTROL_AUTO_NEG_RESTART;
+    }
+    writePhyReg16(PHY_MII_CONTROL, control);
+  }
+  
+  //
+  // Any link changes seen during the test were left pending, resolving the link also restores the EMAC port mode.
+  //
+  cancelLinkUpdate();
+  updatePHYMediaState();
+  if (phyType == kPhyTypeSerDes5706) {
+    linkTimer->setTimeoutMS(SERDES_POLL_INTERVAL_MS);
+  }
+}
+
+/**
+ Posts up to one burst of test frames through the normal TX path.
+ */
+void AzulNX2Ethernet::sendSelfTestFrames() {
+  azul_nx2_access_bucket_t    prevBucket;
+  azul_nx2_self_test_frame_t  *frame;
+  mbuf_t                      packet;
+  UInt8                       *data;
+  UInt32                      seq;
+  UInt16                      size;
+  UInt32                      status;
+  UInt32                      sent = 0;
+  
+  prevBucket = setAccessBucket(kAccessBucketTx);
+  while (selfTest.nextSeq < selfTest.frameCount && sent < selfTest.burstLength) {
+    seq   = selfTest.nextSeq;
+    size  = selfTest.frameSizes[seq % selfTest.frameSizeCount];
+    
+    packet = allocatePacket(size);
+    if (packet == NULL) {
+      selfTest.txStalls++;
+      break;
+    }
+    
+    //
+    // Frames are addressed to this port so they pass the RX MAC filter.
+    //
+    data  = (UInt8*) mbuf_data(packet);
+    frame = (azul_nx2_self_test_frame_t*) data;
+    memcpy(frame->destAddress, ethAddress.bytes, kIOEthernetAddressSize);
+    memcpy(frame->srcAddress, ethAddress.bytes, kIOEthernetAddressSize);
+    frame->etherType  = OSSwapHostToBigInt16(SELF_TEST_ETHERTYPE);
+    frame->magic      = OSSwapHostToBigInt32(SELF_TEST_MAGIC);
+    frame->sequence   = OSSwapHostToBigInt32(seq);
+    for (UInt32 i = sizeof (azul_nx2_self_test_frame_t); i < size; i++) {
+      data[i] = (UInt8) (seq + i);
+    }
+    
+    status = sendTxPacket(packet);
+    if (status == kIOReturnOutputStall) {
+      freePacket(packet);
+      selfTest.txStalls++;
+      break;
+    }
+    
+    //
+    // Dropped frames have already been freed, the sequence number is skipped.
+    //
+    selfTest.nextSeq++;
+    if (status == kIOReturnOutputDropped) {
+      selfTest.txDropped++;
+      continue;
+    }
+    
+    if (selfTest.startTime == 0) {
+      selfTest.startTime = mach_absolute_time();
+    }
+    selfTest.txFrames++;
+    selfTest.txBytes += size;
+    sent++;
+  }
+  setAccessBucket(prevBucket);
+  
+  if (sent > 0) {
+    selfTest.lastProgressTime = mach_absolute_time();
+  }
+  if (selfTest.nextSeq == selfTest.frameCount) {
+    selfTest.lastProgressTime = mach_absolute_time();
+    selfTest.state            = kSelfTestStateDraining;
+  }
+}
+
+/**
+ Checks a looped back frame. Frames not recognizable as test frames are counted as foreign.
+ */
+void AzulNX2Ethernet::checkSelfTestFrame(const rx_l2_header_t *l2Header, UInt16 packetLength) {
+  const UInt8                       *data;
+  const azul_nx2_self_test_frame_t  *frame;
+  UInt32                            seq;
+  bool                              corrupt;
+  
+  if (packetLength > MAX_PACKET_SIZE || l2Header->errors != 0) {
+    selfTest.rxErrors++;
+    return;
+  }
+  
+  data  = (const UInt8*) l2Header + sizeof (rx_l2_header_t) + RX_HEADER_PAD;
+  frame = (const azul_nx2_self_test_frame_t*) data;
+  if (packetLength < sizeof (azul_nx2_self_test_frame_t) ||
+      frame->etherType != OSSwapHostToBigInt16(SELF_TEST_ETHERTYPE) ||
+      memcmp(frame->destAddress, ethAddress.bytes, kIOEthernetAddressSize) != 0) {
+    selfTest.rxForeign++;
+    return;
+  }
+  
+  selfTest.lastRxTime       = mach_absolute_time();
+  selfTest.lastProgressTime = selfTest.lastRxTime;
+  
+  seq     = OSSwapBigToHostInt32(frame->sequence);
+  corrupt = frame->magic != OSSwapHostToBigInt32(SELF_TEST_MAGIC) || seq >= selfTest.frameCount ||
+            packetLength != selfTest.frameSizes[seq % selfTest.frameSizeCount];
+  for (UInt32 i = sizeof (azul_nx2_self_test_frame_t); !corrupt && i < packetLength; i++) {
+    corrupt = data[i] != (UInt8) (seq + i);
+  }
+  
+  if (corrupt) {
+    selfTest.rxCorrupt++;
+    return;
+  }
+  
+  if (seq != selfTest.expectedSeq) {
+    selfTest.rxOutOfOrder++;
+  }
+  selfTest.expectedSeq = seq + 1;
+  selfTest.rxFrames++;
+  selfTest.rxBytes += packetLength;
+}
+
+/**
+ Returns the port to normal operation and publishes the results.
+ Rates are computed from the first frame sent to the last frame received.
+ */
+void AzulNX2Ethernet::completeSelfTest() {
+  OSDictionary  *dict;
+  OSNumber      *num;
+  OSString      *modeString;
+  UInt64        elapsedNs = 0;
+  UInt64        received;
+  UInt64        dropped;
+  UInt64        pps       = 0;
+  UInt64        mbps      = 0;
+  UInt64        lineMbps  = 0;
+  
+  stopSelfTestLoopback();
+  
+  if (selfTest.startTime != 0 && selfTest.lastRxTime > selfTest.startTime) {
+    absolutetime_to_nanoseconds(selfTest.lastRxTime - selfTest.startTime, &elapsedNs);
+  }
+  if (elapsedNs != 0) {
+    //
+    // Line rate adds the CRC, preamble and inter-frame gap to each frame.
+    //
+    pps       = (selfTest.rxFrames * 1000000000ULL) / elapsedNs;
+    mbps      = (selfTest.rxBytes * 8000ULL) / elapsedNs;
+    lineMbps  = ((selfTest.rxBytes + selfTest.rxFrames * (kIOEthernetCRCSize + 20)) * 8000ULL) / elapsedNs;
+  }
+  
+  received  = selfTest.rxFrames + selfTest.rxCorrupt + selfTest.rxErrors;
+  dropped   = selfTest.txFrames > received ? selfTest.txFrames - received : 0;
+  
+  const struct {
+    const char  *name;
+    UInt64      value;
+  } values[] = {
+    { "TxFrames",                 selfTest.txFrames },
+    { "TxBytes",                  selfTest.txBytes },
+    { "TxStalls",                 selfTest.txStalls },
+    { "TxDropped",                selfTest.txDropped },
+    { "RxFrames",                 selfTest.rxFrames },
+    { "RxBytes",                  selfTest.rxBytes },
+    { "RxErrors",                 selfTest.rxErrors },
+    { "RxCorrupt",                selfTest.rxCorrupt },
+    { "RxOutOfOrder",             selfTest.rxOutOfOrder },
+    { "RxForeign",                selfTest.rxForeign },
+    { "Dropped",                  dropped },
+    { "ElapsedNs",                elapsedNs },
+    { "PacketsPerSecond",         pps },
+    { "MegabitsPerSecond",        mbps },
+    { "LineRateMegabitsPerSecond", lineMbps },
+    { "TimedOut",                 selfTest.timedOut }
+  };
+  
+  SYSLOG("Self-test %s: %llu/%llu frames, %llu dropped, %llu corrupt, %llu pps, %llu Mb/s",
+         selfTest.timedOut ? "timed out" : "completed", selfTest.rxFrames, selfTest.txFrames,
+         dropped, selfTest.rxCorrupt, pps, mbps);
+  
+  dict = OSDictionary::withCapacity(sizeof (values) / sizeof (values[0]) + 1);
+  if (dict != NULL) {
+    modeString = OSString::withCString(selfTest.mode == kSelfTestModePhy ? "PHY" : "MAC");
+    if (modeString != NULL) {
+      dict->setObject("Mode", modeString);
+      modeString->release();
+    }
+    for (UInt32 i = 0; i < sizeof (values) / sizeof (values[0]); i++) {
+      num = OSNumber::withNumber(values[i].value, 64);
+      if (num != NULL) {
+        dict->setObject(values[i].name, num);
+        num->release();
+      }
+    }
+    
+    setProperty("SelfTestResults", dict);
+    dict->release();
+  }
+  
+  selfTest.state = kSelfTestStateIdle;
+  txQueue->start();
+  txQueue->service(IOBasicOutputQueue::kServiceAsync);
+}
+
+/**
+ Advances the self-test state machine, run from the self-test timer.
+ */
+void AzulNX2Ethernet::updateSelfTest() {
+  UInt64 now;
+  UInt64 idleNs;
+  
+  switch (selfTest.state) {
+    case kSelfTestStateStarting:
+      //
+      // Hold off the network stack for the duration of the test.
+      //
+      txQueue->stop();
+      if (!startSelfTestLoopback()) {
+        SYSLOG("Failed to enable loopback for self-test");
+        selfTest.state = kSelfTestStateIdle;
+        txQueue->start();
+        return;
+      }
+      
+      //
+      // Frames are sent from the next tick, giving the loopback path time to settle.
+      //
+      selfTest.lastProgressTime = mach_absolute_time();
+      selfTest.state            = kSelfTestStateRunning;
+      break;
+    
+    case kSelfTestStateRunning:
+      //
+      // Sending normally continues from TX completions, the timer restarts it after a stall.
+      //
+      sendSelfTestFrames();
+      break;
+    
+    case kSelfTestStateDraining:
+      break;
+    
+    default:
+      return;
+  }
+  
+  clock_get_uptime(&now);
+  absolutetime_to_nanoseconds(now - selfTest.lastProgressTime, &idleNs);
+  
+  if (selfTest.state == kSelfTestStateDraining) {
+    if (selfTest.rxFrames + selfTest.rxCorrupt + selfTest.rxErrors >= selfTest.txFrames ||
+        idleNs >= SELF_TEST_DRAIN_MS * 1000000ULL) {
+      completeSelfTest();
+      return;
+    }
+  } else if (idleNs >= SELF_TEST_STALL_MS * 1000000ULL) {
+    selfTest.timedOut = true;
+    completeSelfTest();
+    return;
+  }
+  
+  selfTestTimer->setTimeoutMS(SELF_TEST_POLL_MS);
+}
+
+void AzulNX2Ethernet::selfTestTimerOccurred(IOTimerEventSource *source) {
+  azul_nx2_access_bucket_t prevBucket;
+  
+  prevBucket = setAccessBucket(kAccessBucketSelfTest);
+  updateSelfTest();
+  setAccessBucket(prevBucket);
+}
@@ -58,29 +58,14 @@ void AzulNX2Ethernet::initTxRxRegs() {
   writeReg32(NX2_HC_RX_QUICK_CONS_TRIP, (RX_QUICK_CONS_TRIP << 16) | RX_QUICK_CONS_TRIP);
 }
 
+template <typename Chip>
 bool AzulNX2Ethernet::initTxRing() {
-  tx_bd_t *txBdLast;
-  
-  //
-  // Reset transmit indexes and allocation stats.
-  //
-  txProd            = 0;
-  txCons            = 0;
-  txProdBufferSize  = 0;
-  txFreeDescriptors = TX_USABLE_BD_COUNT - 1;
-  
   //
   // Initialize transmit chain.
   // The NetXtreme II supports multiple pages each having multiple buffer descriptor entries.
   // This driver uses a single page for all BD entries.
   //
-  // The final buffer descriptor is a pointer to the start of the chain.
-  //
-  txChain = (tx_bd_t*) txBuffer.buffer;
-  
-  txBdLast         = &txChain[TX_USABLE_BD_COUNT];
-  txBdLast->addrHi = ADDR_HI(txBuffer.physAddr);
-  txBdLast->addrLo = ADDR_LO(txBuffer.physAddr);
+  nx2TxRingInit(&txRing, (tx_bd_t*) txBuffer.buffer, txBuffer.physAddr);
   
   //
   // Initialize context block for L2 transmit chain.
@@ -88,35 +73,40 @@ bool AzulNX2Ethernet::initTxRing() {
   // Context block is set to handle L2 transmit connections.
   // Address points to first BD in the transmit chain.
   //
-  if (NX2_CHIP_NUM == NX2_CHIP_NUM_5709) {
-    writeContext32(GET_CID_ADDR(TX_CID), NX2_L2CTX_TX_TYPE_XI, NX2_L2CTX_TX_TYPE_TYPE_L2_XI | NX2_L2CTX_TX_TYPE_SIZE_L2_XI);
-    writeContext32(GET_CID_ADDR(TX_CID), NX2_L2CTX_TX_CMD_TYPE_XI, NX2_L2CTX_TX_CMD_TYPE_TYPE_L2_XI | (8 << 16));
+  if (Chip::hostContext) {
+    writeContext32<Chip>(GET_CID_ADDR(TX_CID), NX2_L2CTX_TX_TYPE_XI, NX2_L2CTX_TX_TYPE_TYPE_L2_XI | NX2_L2CTX_TX_TYPE_SIZE_L2_XI);
+    writeContext32<Chip>(GET_CID_ADDR(TX_CID), NX2_L2CTX_TX_CMD_TYPE_XI, NX2_L2CTX_TX_CMD_TYPE_TYPE_L2_XI | (8 << 16));
     
-    writeContext32(GET_CID_ADDR(TX_CID), NX2_L2CTX_TX_TBDR_BHADDR_HI_XI, ADDR_HI(txBuffer.physAddr));
-    writeContext32(GET_CID_ADDR(TX_CID), NX2_L2CTX_TX_TBDR_BHADDR_LO_XI, ADDR_LO(txBuffer.physAddr));
+    writeContext32<Chip>(GET_CID_ADDR(TX_CID), NX2_L2CTX_TX_TBDR_BHADDR_HI_XI, ADDR_HI(txBuffer.physAddr));
+    writeContext32<Chip>(GET_CID_ADDR(TX_CID), NX2_L2CTX_TX_TBDR_BHADDR_LO_XI, ADDR_LO(txBuffer.physAddr));
   } else {
-    writeContext32(GET_CID_ADDR(TX_CID), NX2_L2CTX_TX_TYPE, NX2_L2CTX_TX_TYPE_TYPE_L2 | NX2_L2CTX_TX_TYPE_SIZE_L2);
-    writeContext32(GET_CID_ADDR(TX_CID), NX2_L2CTX_TX_CMD_TYPE, NX2_L2CTX_TX_CMD_TYPE_TYPE_L2 | (8 << 16));
+    writeContext32<Chip>(GET_CID_ADDR(TX_CID), NX2_L2CTX_TX_TYPE, NX2_L2CTX_TX_TYPE_TYPE_L2 | NX2_L2CTX_TX_TYPE_SIZE_L2);
+    writeContext32<Chip>(GET_CID_ADDR(TX_CID), NX2_L2CTX_TX_CMD_TYPE, NX2_L2CTX_TX_CMD_TYPE_TYPE_L2 | (8 << 16));
     
-    writeContext32(GET_CID_ADDR(TX_CID), NX2_L2CTX_TX_TBDR_BHADDR_HI, ADDR_HI(txBuffer.physAddr));
-    writeContext32(GET_CID_ADDR(TX_CID), NX2_L2CTX_TX_TBDR_BHADDR_LO, ADDR_LO(txBuffer.physAddr));
+    writeContext32<Chip>(GET_CID_ADDR(TX_CID), NX2_L2CTX_TX_TBDR_BHADDR_HI, ADDR_HI(txBuffer.physAddr));
+    writeContext32<Chip>(GET_CID_ADDR(TX_CID), NX2_L2CTX_TX_TBDR_BHADDR_LO, ADDR_LO(txBuffer.physAddr));
   }
   
   DBGLOG("TX buffer configured at phys 0x%X size 0x%X (%u usable BDs)", txBuffer.physAddr, TX_PAGE_SIZE, TX_USABLE_BD_COUNT - 1);
   return true;
 }
 
-void AzulNX2Ethernet::freeTxRing() {
-  // TODO:
-}
+template bool AzulNX2Ethernet::initTxRing<nx2_chip_5706_t>();
+template bool AzulNX2Ethernet::initTxRing<nx2_chip_5708_t>();
+template bool AzulNX2Ethernet::initTxRing<nx2_chip_5709_t>();
 
-UInt16 AzulNX2Ethernet::readTxCons() { // TODO: make inline
-  UInt16 cons = statusBlock->txConsumer0;
-  if ((cons & TX_USABLE_BD_COUNT) == TX_USABLE_BD_COUNT) {
-    cons++;
+void AzulNX2Ethernet::freeTxRing() {
+  //
+  // Free any packets the controller did not complete. Bypass frames are posted without a packet.
+  //
+  for (int i = 0; i < TX_USABLE_BD_COUNT; i++) {
+    if (txRing.packets[i] == NULL) {
+      continue;
+    }
+    
+    freePacket(txRing.packets[i]);
+    txRing.packets[i] = NULL;
   }
-  
-  return cons;
 }
 
 UInt32 AzulNX2Ethernet::sendTxPacket(mbuf_t packet) {
@@ -126,9 +116,9 @@ UInt32 AzulNX2Ethernet::sendTxPacket(mbuf_t packet) {
   UInt16              bdFlags = 0;
   UInt16              bdVlanTag = 0;
   
-  UInt16              txIndex = 0;
+  UInt16              txIndex;
   
-  if (txFreeDescriptors == 0) {
+  if (!nx2TxRingHasRoom(&txRing, 1)) {
     DBGLOG("No free TX BDs are currently available!");
     return kIOReturnOutputStall;
   }
@@ -139,14 +129,13 @@ UInt32 AzulNX2Ethernet::sendTxPacket(mbuf_t packet) {
   segmentCount = txCursor->getPhysicalSegmentsWithCoalesce(packet, segments, TX_MAX_SEG_COUNT);
   if (segmentCount == 0) {
     freePacket(packet);
-    DBGLOG("Failed to get outgoing packet segments");
+    WARNLOG("Failed to get outgoing packet segments");
     return kIOReturnOutputDropped;
   }
   
-  if (segmentCount < txFreeDescriptors) {
+  if (nx2TxRingHasRoom(&txRing, segmentCount)) {
     //
     // Add applicable checksum offload and VLAN tag flags.
-    // First segment also gets a start flag.
     //
     getChecksumDemand(packet, kChecksumFamilyTCPIP, &bdChecksumFlags);
     if (bdChecksumFlags & kChecksumIP) {
@@ -159,112 +148,75 @@ UInt32 AzulNX2Ethernet::sendTxPacket(mbuf_t packet) {
     if (getVlanTagDemand(packet, (UInt32 *)&bdVlanTag)) {
       bdFlags |= TX_BD_FLAGS_VLAN_TAG;
     }
-    bdFlags |= TX_BD_FLAGS_START;
     
     //
     // Fill BDs with packet segments.
     //
-    for (int i = 0; i < segmentCount; i++) {
-      //
-      // Hardware maintains a separate index from the driver.
-      // The hardware index continues to increment until it rolls over.
-      //
-      txIndex = TX_BD_INDEX(txProd);
-      
-      //
-      // Add end flag if final segment.
-      //
-      if (i == segmentCount - 1) {
-        bdFlags |= TX_BD_FLAGS_END;
-      }
-      
-      txChain[txIndex].addrHi   = ADDR_HI(segments[i].location);
-      txChain[txIndex].addrLo   = ADDR_LO(segments[i].location);
-      txChain[txIndex].length   = (UInt32) segments[i].length;
-      txChain[txIndex].flags    = bdFlags;
-      txChain[txIndex].vlanTag  = bdVlanTag;
-      
-      //
-      // Next BD will normally be +1, but the final BD is reserved to be a pointer to the start of the chain.
-      //
-      txProdBufferSize += txChain[txIndex].length;
-      txProd            = TX_NEXT_BD(txProd);
-    }
+    txIndex = nx2TxRingPost(&txRing, segments, segmentCount, bdFlags, bdVlanTag, packet);
     
     //
-    // Packet is stored for freeing on completion later on.
-    // This is always the final BD used for the packet.
+    // Stamped before the doorbell, as the controller may complete the packet before the write returns.
     //
-    txPackets[txIndex] = packet;
-    txFreeDescriptors -= segmentCount;
+    txDoorbellTimes[txIndex] = mach_absolute_time();
     
     //
     // Notify hardware of new TX BDs.
+    // BD stores must be visible before the doorbell when descriptor memory is cacheable.
     //
-    writeReg16(MB_GET_CID_ADDR(TX_CID) +
-               NX2_L2MQ_TX_HOST_BIDX, txProd);
-    writeReg32(MB_GET_CID_ADDR(TX_CID) +
-               NX2_L2MQ_TX_HOST_BSEQ, txProdBufferSize);
+    nx2TxRingDoorbell(&ringRegs, &txRing);
     
-    //DBGLOG("Sent packet of %u bytes, current TX BD %u (actual %u)", mbuf_pkthdr_len(packet), txProd, TX_BD_INDEX(txProd));
+    //DBGLOG("Sent packet of %u bytes, current TX BD %u (actual %u)", mbuf_pkthdr_len(packet), txRing.prod, TX_BD_INDEX(txRing.prod));
     return kIOReturnOutputSuccess;
   }
   
+  traceEvent(kEventTxStall, nx2TxRingFreeCount(&txRing), segmentCount);
   DBGLOG("Not enough free TX BDs are currently available!");
   return kIOReturnOutputStall;
 }
 
-void AzulNX2Ethernet::handleTxInterrupt(UInt16 txConsNew) {
-  UInt16 txIndex;
+UInt32 AzulNX2Ethernet::handleTxInterrupt(UInt16 txConsNew) {
+  UInt32 reclaimed;
+  
+  if (isBypassActive()) {
+    return handleBypassTxInterrupt(txConsNew);
+  }
   
   //
   // Free any newly completed packets.
   //
-  while (txCons != txConsNew) {
-    txIndex = TX_BD_INDEX(txCons);
-    
-    if (txPackets[txIndex] != NULL) {
-      freePacket(txPackets[txIndex]);
-      txPackets[txIndex] = NULL;
-    }
-    
-    txFreeDescriptors++;
-    txCons = TX_NEXT_BD(txCons);
-  }
+  reclaimed = nx2TxRingReclaim(&txRing, txConsNew, [this](mbuf_t packet, UInt16 txIndex) {
+    recordLatency(kLatencyTxCompletion, txDoorbellTimes[txIndex]);
+    freePacket(packet);
+  });
   
-  txQueue->service(IOBasicOutputQueue::kServiceAsync);
+  if (selfTest.state == kSelfTestStateRunning) {
+    sendSelfTestFrames();
+  } else {
+    txQueue->service(IOBasicOutputQueue::kServiceAsync);
+  }
+  return reclaimed;
 }
 
 bool AzulNX2Ethernet::initRxRing() {
-  rx_bd_t           *rxBdLast;
-  
-  //
-  // Reset transmit indexes and allocation stats.
-  //
-  rxProd            = 0;
-  rxCons            = 0;
-  rxProdBufferSize  = 0;
-  rxFreeDescriptors = 0;
-  
   //
   // Initialize receive chain.
   // The NetXtreme II supports multiple pages each having multiple buffer descriptor entries.
   // This driver uses a single page for all BD entries.
   //
-  // The final buffer descriptor is a pointer to the start of the chain.
-  //
-  rxChain = (rx_bd_t*) rxBuffer.buffer;
-  
-  rxBdLast         = &rxChain[RX_USABLE_BD_COUNT];
-  rxBdLast->addrHi = ADDR_HI(rxBuffer.physAddr);
-  rxBdLast->addrLo = ADDR_LO(rxBuffer.physAddr);
+  nx2RxRingInit(&rxRing, (rx_bd_t*) rxBuffer.buffer, rxBuffer.physAddr);
   
   //
   // Allocate packets in RX chain, skipping already allocated packets.
+  // In bypass mode the chain is filled from the process's buffers instead, packets are kept for when it returns.
   //
-  for (UInt16 i = 0; i < RX_USABLE_BD_COUNT; i++) {
-    if (!initRxDescriptor(i, false)) {
-      return false;
+  if (isBypassActive()) {
+    bypass.rings.rxPosted = 0;
+    nx2UserFillRx(bypass.shared, &bypass.rings, &rxRing);
+  } else {
+    for (UInt16 i = 0; i < RX_USABLE_BD_COUNT; i++) {
+      if (!initRxDescriptor(i, false)) {
+        return false;
+      }
     }
   }
   
@@ -280,8 +232,7 @@ bool AzulNX2Ethernet::initRxRing() {
   writeContext32(GET_CID_ADDR(RX_CID), NX2_L2CTX_RX_NX_BDHADDR_HI, ADDR_HI(rxBuffer.physAddr));
   writeContext32(GET_CID_ADDR(RX_CID), NX2_L2CTX_RX_NX_BDHADDR_LO, ADDR_LO(rxBuffer.physAddr));
   
-  writeReg16(MB_GET_CID_ADDR(RX_CID) + NX2_L2MQ_RX_HOST_BDIDX, rxProd);
-  writeReg32(MB_GET_CID_ADDR(RX_CID) + NX2_L2MQ_RX_HOST_BSEQ, rxProdBufferSize);
+  nx2RxRingDoorbell(&ringRegs, &rxRing);
   
   DBGLOG("RX buffer configured at phys 0x%X size 0x%X (%u usable BDs)", rxBuffer.physAddr, RX_PAGE_SIZE, RX_USABLE_BD_COUNT - 1);
   return true;
@@ -294,25 +245,19 @@ bool AzulNX2Ethernet::initRxDescriptor(UInt16 index, bool forceAllocate) {
   //
   // Allocate and configure packet.
   //
-  if (rxPackets[index] == NULL || forceAllocate) {
-    rxPackets[index] = allocatePacket(MAX_PACKET_SIZE);
-    if (rxPackets[index] == NULL) {
+  if (rxRing.packets[index] == NULL || forceAllocate) {
+    rxRing.packets[index] = allocatePacket(MAX_PACKET_SIZE);
+    if (rxRing.packets[index] == NULL) {
       return false;
     }
   }
   
-  segmentCount = rxCursor->getPhysicalSegmentsWithCoalesce(rxPackets[index], &segment, RX_MAX_SEG_COUNT);
+  segmentCount = rxCursor->getPhysicalSegmentsWithCoalesce(rxRing.packets[index], &segment, RX_MAX_SEG_COUNT);
   if (segmentCount != RX_MAX_SEG_COUNT) {
     return false;
   }
   
-  rxChain[index].addrHi   = ADDR_HI(segment.location);
-  rxChain[index].addrLo   = ADDR_LO(segment.location);
-  rxChain[index].flags    = RX_BD_FLAGS_START | RX_BD_FLAGS_END;
-  rxChain[index].length   = (UInt32)segment.length;
-  
-  rxProdBufferSize   += rxChain[index].length;
-  rxProd              = RX_NEXT_BD(rxProd);
+  nx2RxRingPost(&rxRing, index, segment.location, (UInt32) segment.length);
   return true;
 }
 
@@ -321,54 +266,46 @@ void AzulNX2Ethernet::freeRxRing() {
   // Free any allocated packets.
   //
   for (int i = 0; i < RX_USABLE_BD_COUNT; i++) {
-    if (rxPackets[i] == NULL) {
+    if (rxRing.packets[i] == NULL) {
       continue;
     }
     
-    freePacket(rxPackets[i]);
+    freePacket(rxRing.packets[i]);
   }
 }
 
-UInt16 AzulNX2Ethernet::readRxCons() { // TODO: make inline
-  UInt16 cons = statusBlock->rxConsumer0;
-  if ((cons & RX_USABLE_BD_COUNT) == RX_USABLE_BD_COUNT) {
-    cons++;
-  }
+UInt32 AzulNX2Ethernet::handleRxInterrupt(UInt16 rxConsNew) {
+  UInt32                rxPackets;
+  UInt64                batchStartTime = mach_absolute_time();
   
-  return cons;
-}
-
-void AzulNX2Ethernet::handleRxInterrupt(UInt16 rxConsNew) {
-  UInt16                rxIndex;
-  mbuf_t                inputPacket;
-
-  rx_l2_header_t        *l2Header;
-  UInt16                packetLength;
-  
-  UInt32                checksumValidMask = 0;
+  if (isBypassActive()) {
+    return handleBypassRxInterrupt(rxConsNew);
+  }
   
   //
   // Process any newly received packets.
-  //
-  while (rxCons != rxConsNew) {
-    rxIndex = RX_BD_INDEX(rxCons);
-    rxCons  = RX_NEXT_BD(rxCons);
+    // Incoming packets have a header structure in front of the actual packet, plus two bytes.
+    //
+  rxPackets = nx2RxRingHarvest(&rxRing, rxConsNew, [this](UInt16 rxIndex) {
+    return (rx_l2_header_t*) mbuf_data(rxRing.packets[rxIndex]);
+  }, [this](UInt16 rxIndex, rx_l2_header_t *l2Header, UInt16 packetLength, bool valid) {
+    mbuf_t  inputPacket = rxRing.packets[rxIndex];
+    UInt32  checksumValidMask = 0;
     
     //
-    // Incoming packets have a header structure in front of the actual packet, plus two bytes.
+    // Looped back frames are checked and the buffer is reused, nothing reaches the OS during a self-test.
     //
-    inputPacket = rxPackets[rxIndex];
-    l2Header = (rx_l2_header_t*) mbuf_data(inputPacket);
-    packetLength = l2Header->packetLength - kIOEthernetCRCSize;
+    if (selfTest.state == kSelfTestStateRunning || selfTest.state == kSelfTestStateDraining) {
+      checkSelfTestFrame(l2Header, packetLength);
+      return false;
+    }
     
     //
-    // Don't send garbage to the OS.
+    // Don't send garbage to the OS. The buffer is reposted as is.
     //
-    if (packetLength > MAX_PACKET_SIZE || l2Header->errors != 0) {
-      DBGLOG("RX error start len %u sts %u err %u idx %u", packetLength, l2Header->status, l2Header->errors, rxIndex);
-      freePacket(inputPacket);
-      initRxDescriptor(rxIndex, true);
-      continue;
+    if (!valid) {
+      traceEvent(kEventRxError, rxIndex, ((UInt32) l2Header->errors << 16) | l2Header->status);
+      return false;
     }
     
     if (l2Header->status & L2_FHDR_STATUS_IP_DATAGRAM) {
@@ -387,35 +324,42 @@ void AzulNX2Ethernet::handleRxInterrupt(UInt16 rxConsNew) {
     mbuf_adj(inputPacket, sizeof (rx_l2_header_t) + RX_HEADER_PAD);
     mbuf_adj(inputPacket, -kIOEthernetCRCSize);
     
-    //
-    // Submit packet and prepare the descriptor for the next use.
-    //
     setChecksumResult(inputPacket, kChecksumFamilyTCPIP, (kChecksumIP | kChecksumTCP | kChecksumUDP), checksumValidMask);
     ethInterface->inputPacket(inputPacket, packetLength, IOEthernetInterface::kInputOptionQueuePacket);
+    return true;
+  }, [this](UInt16 rxIndex, bool reuse) {
+    //
+    // Prepare the descriptor for the next use, with a new packet if the last one went to the OS.
+    //
+    initRxDescriptor(rxIndex, !reuse);
+  });
     
-    initRxDescriptor(rxIndex, true);
-  }
-  
-  writeReg16(MB_GET_CID_ADDR(RX_CID) + NX2_L2MQ_RX_HOST_BDIDX, rxProd);
-  writeReg32(MB_GET_CID_ADDR(RX_CID) + NX2_L2MQ_RX_HOST_BSEQ, rxProdBufferSize);
+  nx2RxRingDoorbell(&ringRegs, &rxRing);
   
   //
   // When using a queued input method (kInputOptionQueuePacket in inputPacket),
   // the queue must be flushed at the end of the interrupt handler.
   //
   ethInterface->flushInputQueue();
+  
+  recordLatency(kLatencyRxBatch, batchStartTime);
+  recordLatency(kLatencyRxDelivery, interruptTime);
+  return rxPackets;
 }
 
 void AzulNX2Ethernet::setRxMode(bool promiscuous) {
+  UInt32 rxMode   = NX2_EMAC_RX_MODE_SORT_MODE;
   UInt32 sortMode = 1 | NX2_RPM_SORT_USER0_BC_EN;
   
   //
-  // RX mode defaults to normal traffic sorting only.
+  // RX mode defaults to normal traffic sorting only, keeping pause frame handling as negotiated.
   //
-  rxMode = NX2_EMAC_RX_MODE_SORT_MODE;
+  if (mediaState.flowControl & kFlowControlRx) {
+    rxMode |= NX2_EMAC_RX_MODE_FLOW_EN;
+  }
   
   if (promiscuous) {
-    rxMode |= NX2_EMAC_RX_MODE_PROMISCUOUS;
+    rxMode    |= NX2_EMAC_RX_MODE_PROMISCUOUS;
     sortMode  |= NX2_RPM_SORT_USER0_PROM_EN;
     
     DBGLOG("Promiscuous mode will be enabled");
@@ -423,9 +367,10 @@ void AzulNX2Ethernet::setRxMode(bool promiscuous) {
   
   //
   // Set RX and sort mode.
+  // Sort mode must be cleared, loaded, then enabled as separate writes.
   //
   DBGLOG("Setting RX mode 0x%X, sort mode 0x%X", rxMode, sortMode);
-  writeReg32(NX2_EMAC_RX_MODE, rxMode);
+  writeShadowReg(kShadowRegEmacRxMode, rxMode);
   
   writeReg32(NX2_RPM_SORT_USER0, 0);
   writeReg32(NX2_RPM_SORT_USER0, sortMode);
@@ -0,0 +1,167 @@
+/*
+ *
+ * Copyright (c) 2021 Goldfish64
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "UserClient.h"
+
+#undef super
+#define super IOUserClient
+
+OSDefineMetaClassAndStructors(AzulNX2UserClient, IOUserClient);
+
+const IOExternalMethodDispatch AzulNX2UserClient::methods[kNX2UserMethodCount] = {
+  { (IOExternalMethodAction) &AzulNX2UserClient::methodAttach, 0, 0, 0, 0 },
+  { (IOExternalMethodAction) &AzulNX2UserClient::methodDetach, 0, 0, 0, 0 },
+  { (IOExternalMethodAction) &AzulNX2UserClient::methodKick,   0, 0, 2, 0 }
+};
+
+bool AzulNX2UserClient::initWithTask(task_t owningTask, void *securityToken, UInt32 type, OSDictionary *properties) {
+  if (!super::initWithTask(owningTask, securityToken, type, properties)) {
+    return false;
+  }
+  
+  //
+  // Bypass mode takes the port away from the network stack, so it is restricted to administrators.
+  //
+  if (clientHasPrivilege(securityToken, kIOClientPrivilegeAdministrator) != kIOReturnSuccess) {
+    return false;
+  }
+  
+  this->owningTask  = owningTask;
+  ethController     = NULL;
+  return true;
+}
+
+bool AzulNX2UserClient::start(IOService *provider) {
+  ethController = OSDynamicCast(AzulNX2Ethernet, provider);
+  if (ethController == NULL) {
+    return false;
+  }
+  
+  return super::start(provider);
+}
+
+IOReturn AzulNX2UserClient::clientClose() {
+  //
+  // Return the port to the network stack if this client still holds it, including when the process has exited.
+  //
+  if (ethController != NULL) {
+    runGated(&AzulNX2UserClient::gatedDetach);
+  }
+  
+  terminate();
+  return kIOReturnSuccess;
+}
+
+IOReturn AzulNX2UserClient::clientMemoryForType(UInt32 type, IOOptionBits *options, IOMemoryDescriptor **memory) {
+  IOReturn status;
+  
+  if (type != kNX2UserMemoryShared && type != kNX2UserMemoryBuffers) {
+    return kIOReturnBadArgument;
+  }
+  
+  //
+  // The descriptor is returned retained, and released by IOUserClient once mapped.
+  //
+  status = runGated(&AzulNX2UserClient::gatedCopyMemory, (void*) (uintptr_t) type, memory);
+  if (IORETURN_ERR(status)) {
+    return status;
+  }
+  
+  *options = 0;
+  return kIOReturnSuccess;
+}
+
+IOReturn AzulNX2UserClient::externalMethod(uint32_t selector, IOExternalMethodArguments *arguments,
+                                           IOExternalMethodDispatch *dispatch, OSObject *target, void *reference) {
+  if (selector >= kNX2UserMethodCount) {
+    return kIOReturnUnsupported;
+  }
+  
+  dispatch  = (IOExternalMethodDispatch*) &methods[selector];
+  target    = this;
+  return super::externalMethod(selector, arguments, dispatch, target, reference);
+}
+
+IOReturn AzulNX2UserClient::methodAttach(AzulNX2UserClient *target, void *reference, IOExternalMethodArguments *arguments) {
+  return target->runGated(&AzulNX2UserClient::gatedAttach);
+}
+
+IOReturn AzulNX2UserClient::methodDetach(AzulNX2UserClient *target, void *reference, IOExternalMethodArguments *arguments) {
+  return target->runGated(&AzulNX2UserClient::gatedDetach);
+}
+
+IOReturn AzulNX2UserClient::methodKick(AzulNX2UserClient *target, void *reference, IOExternalMethodArguments *arguments) {
+  IOReturn  status;
+  UInt32    txPosted = 0;
+  UInt32    rxPosted = 0;
+  
+  status = target->runGated(&AzulNX2UserClient::gatedKick, &txPosted, &rxPosted);
+  arguments->scalarOutput[0] = txPosted;
+  arguments->scalarOutput[1] = rxPosted;
+  return status;
+}
+
+//
+// Gated actions run on the controller's work loop, with the user client passed as arg0.
+//
+IOReturn AzulNX2UserClient::gatedAttach(OSObject *owner, void *arg0, void *arg1, void *arg2, void *arg3) {
+  AzulNX2UserClient *client = (AzulNX2UserClient*) arg0;
+  return client->ethController->attachBypass(client);
+}
+
+IOReturn AzulNX2UserClient::gatedDetach(OSObject *owner, void *arg0, void *arg1, void *arg2, void *arg3) {
+  AzulNX2UserClient *client = (AzulNX2UserClient*) arg0;
+  return client->ethController->detachBypass(client);
+}
+
+IOReturn AzulNX2UserClient::gatedKick(OSObject *owner, void *arg0, void *arg1, void *arg2, void *arg3) {
+  AzulNX2UserClient *client = (AzulNX2UserClient*) arg0;
+  return client->ethController->kickBypass(client, (UInt32*) arg1, (UInt32*) arg2);
+}
+
+IOReturn AzulNX2UserClient::gatedCopyMemory(OSObject *owner, void *arg0, void *arg1, void *arg2, void *arg3) {
+  AzulNX2UserClient   *client = (AzulNX2UserClient*) arg0;
+  AzulNX2Ethernet     *eth    = client->ethController;
+  IOMemoryDescriptor  **memory = (IOMemoryDescriptor**) arg2;
+  
+  if (!eth->allocBypassBuffers()) {
+    return kIOReturnNoMemory;
+  }
+  
+  if ((uintptr_t) arg1 == kNX2UserMemoryShared) {
+    *memory = eth->bypass.sharedDesc;
+  } else {
+    *memory = eth->bypass.buffers.bufDesc;
+  }
+  (*memory)->retain();
+  return kIOReturnSuccess;
+}
+
+IOReturn AzulNX2UserClient::runGated(IOCommandGate::Action action, void *arg1, void *arg2, void *arg3) {
+  IOCommandGate *gate = ethController->getCommandGate();
+  if (gate == NULL) {
+    return kIOReturnNotReady;
+  }
+  
+  return gate->runAction(action, this, arg1, arg2, arg3);
+}
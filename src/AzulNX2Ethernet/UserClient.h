@@ -0,0 +1,74 @@
+/*
+ *
+ * Copyright (c) 2021 Goldfish64
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __USER_CLIENT_H__
+#define __USER_CLIENT_H__
+
+#include <IOKit/IOCommandGate.h>
+#include <IOKit/IOUserClient.h>
+#include "AzulNX2Ethernet.h"
+
+//
+// User client for bypass mode, opened with type NX2_USER_CLIENT_TYPE by an administrator process.
+// Methods and memory types are described in UserQueue.h:
+//   - kNX2UserMethodAttach: no arguments.
+//   - kNX2UserMethodDetach: no arguments. Also performed when the client is closed or the process exits.
+//   - kNX2UserMethodKick:   outputs the number of TX frames and RX buffers posted.
+//
+class AzulNX2UserClient : public IOUserClient {
+  OSDeclareDefaultStructors(AzulNX2UserClient);
+
+private:
+  AzulNX2Ethernet             *ethController;
+  task_t                      owningTask;
+  
+  static const IOExternalMethodDispatch methods[kNX2UserMethodCount];
+  
+  static IOReturn methodAttach(AzulNX2UserClient *target, void *reference, IOExternalMethodArguments *arguments);
+  static IOReturn methodDetach(AzulNX2UserClient *target, void *reference, IOExternalMethodArguments *arguments);
+  static IOReturn methodKick(AzulNX2UserClient *target, void *reference, IOExternalMethodArguments *arguments);
+  
+  static IOReturn gatedAttach(OSObject *owner, void *arg0, void *arg1, void *arg2, void *arg3);
+  static IOReturn gatedDetach(OSObject *owner, void *arg0, void *arg1, void *arg2, void *arg3);
+  static IOReturn gatedKick(OSObject *owner, void *arg0, void *arg1, void *arg2, void *arg3);
+  static IOReturn gatedCopyMemory(OSObject *owner, void *arg0, void *arg1, void *arg2, void *arg3);
+  
+  IOReturn runGated(IOCommandGate::Action action, void *arg1 = NULL, void *arg2 = NULL, void *arg3 = NULL);
+
+public:
+  //
+  // IOService methods.
+  //
+  virtual bool start(IOService *provider);
+  
+  //
+  // IOUserClient methods.
+  //
+  virtual bool initWithTask(task_t owningTask, void *securityToken, UInt32 type, OSDictionary *properties);
+  virtual IOReturn clientClose();
+  virtual IOReturn clientMemoryForType(UInt32 type, IOOptionBits *options, IOMemoryDescriptor **memory);
+  virtual IOReturn externalMethod(uint32_t selector, IOExternalMethodArguments *arguments,
+                                  IOExternalMethodDispatch *dispatch, OSObject *target, void *reference);
+};
+
+#endif
@@ -0,0 +1,340 @@
+/*
+ *
+ * Copyright (c) 2021 Goldfish64
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __USER_QUEUE_H__
+#define __USER_QUEUE_H__
+
+//
+// OS-independent protocol shared between the driver and a process using the port in bypass mode.
+// The platform including this header must provide the UInt types. The driver end at the bottom
+// additionally needs RingEngine.h, and is shared by Bypass.cpp and the host build's mock.
+//
+// The process opens the user client with type NX2_USER_CLIENT_TYPE and maps two regions through it:
+//   - kNX2UserMemoryShared: an nx2_user_shared_t holding the four queues below.
+//   - kNX2UserMemoryBuffers: bufferCount packet buffers of bufferSize bytes each, referenced by index.
+//
+// Each queue has a single producer and a single consumer. Indexes are free-running; an entry is
+// at descs[index & (NX2_USER_QUEUE_SIZE - 1)]. Entries are written before the producer index is
+// released, and read after the producer index is acquired. The consumer index is likewise released
+// once entries are no longer needed.
+//   - rxFill:      process to driver, empty buffers available for receive.
+//   - rxComplete:  driver to process, received frames. Data starts at rxDataOffset within the buffer,
+//                  length excludes the CRC, and flags holds the L2 frame status.
+//   - txSubmit:    process to driver, frames to send. Data starts at the beginning of the buffer.
+//   - txComplete:  driver to process, buffers sent or rejected (NX2_USER_DESC_FLAG_ERROR).
+//
+// The driver does not trust anything the process writes. rxFill entries with an invalid buffer index are
+// skipped, and txSubmit entries with an invalid buffer index or length are rejected.
+//
+// All buffers belong to the process until kNX2UserMethodAttach is called; rxFill should be populated
+// before then. Posting to the hardware happens when the process calls kNX2UserMethodKick, and receive
+// buffers are also refilled from rxFill as frames arrive. After kNX2UserMethodDetach all queues are
+// empty and every buffer belongs to the process again.
+//
+#define NX2_USER_CLIENT_TYPE        0x4E583255
+#define NX2_USER_QUEUE_VERSION      1
+#define NX2_USER_QUEUE_SIZE         512
+#define NX2_USER_BUFFER_COUNT       512
+#define NX2_USER_BUFFER_SIZE        2048
+
+#define NX2_USER_CACHE_LINE_ALIGNED __attribute__((aligned(64)))
+
+#define NX2_USER_DESC_FLAG_ERROR    0x8000
+
+//
+// Frames submitted for TX must hold at least an Ethernet header, and at most a VLAN tagged frame without CRC.
+//
+#define NX2_USER_TX_MIN_LENGTH      14
+#define NX2_USER_TX_MAX_LENGTH      1518
+
+typedef enum {
+  kNX2UserMethodAttach = 0,
+  kNX2UserMethodDetach,
+  kNX2UserMethodKick,
+  kNX2UserMethodCount
+} nx2_user_method_t;
+
+typedef enum {
+  kNX2UserMemoryShared = 0,
+  kNX2UserMemoryBuffers
+} nx2_user_memory_t;
+
+typedef struct {
+  UInt32                    buffer;
+  UInt16                    length;
+  UInt16                    flags;
+} nx2_user_desc_t;
+
+typedef struct {
+  UInt32                    prod NX2_USER_CACHE_LINE_ALIGNED;
+  UInt32                    cons NX2_USER_CACHE_LINE_ALIGNED;
+  nx2_user_desc_t           descs[NX2_USER_QUEUE_SIZE] NX2_USER_CACHE_LINE_ALIGNED;
+} nx2_user_queue_t;
+
+typedef struct {
+  UInt32                    version;
+  UInt32                    bufferCount;
+  UInt32                    bufferSize;
+  UInt32                    rxDataOffset;
+  
+  nx2_user_queue_t          rxFill;
+  nx2_user_queue_t          rxComplete;
+  nx2_user_queue_t          txSubmit;
+  nx2_user_queue_t          txComplete;
+} nx2_user_shared_t;
+
+static_assert((NX2_USER_QUEUE_SIZE & (NX2_USER_QUEUE_SIZE - 1)) == 0, "Queue size must be a power of two");
+static_assert(NX2_USER_BUFFER_COUNT <= NX2_USER_QUEUE_SIZE, "Every buffer must fit in any one queue");
+
+//
+// Returns the entries available to a consumer at cons. The producer index is not trusted,
+// a queue claiming more than NX2_USER_QUEUE_SIZE entries is treated as empty.
+//
+static inline UInt32 nx2UserQueueAvailable(const nx2_user_queue_t *queue, UInt32 cons) {
+  UInt32 count = __atomic_load_n(&queue->prod, __ATOMIC_ACQUIRE) - cons;
+  return count > NX2_USER_QUEUE_SIZE ? 0 : count;
+}
+
+//
+// Returns the free entries for a producer at prod. The consumer index is not trusted either.
+//
+static inline UInt32 nx2UserQueueSpace(const nx2_user_queue_t *queue, UInt32 prod) {
+  UInt32 count = prod - __atomic_load_n(&queue->cons, __ATOMIC_ACQUIRE);
+  return count > NX2_USER_QUEUE_SIZE ? 0 : NX2_USER_QUEUE_SIZE - count;
+}
+
+static inline nx2_user_desc_t *nx2UserQueueDesc(nx2_user_queue_t *queue, UInt32 index) {
+  return &queue->descs[index & (NX2_USER_QUEUE_SIZE - 1)];
+}
+
+//
+// Copies out the entry at index. Entries are copied out once, the other side may change them at any time.
+//
+static inline nx2_user_desc_t nx2UserQueueRead(const nx2_user_queue_t *queue, UInt32 index) {
+  return queue->descs[index & (NX2_USER_QUEUE_SIZE - 1)];
+}
+
+//
+// Writes an entry at prod and advances it, if there is space. The entry is published by releasing prod.
+//
+static inline bool nx2UserQueuePush(nx2_user_queue_t *queue, UInt32 *prod, UInt32 buffer, UInt16 length, UInt16 flags) {
+  nx2_user_desc_t *desc;
+  
+  if (nx2UserQueueSpace(queue, *prod) == 0) {
+    return false;
+  }
+  
+  desc          = nx2UserQueueDesc(queue, *prod);
+  desc->buffer  = buffer;
+  desc->length  = length;
+  desc->flags   = flags;
+  (*prod)++;
+  return true;
+}
+
+static inline void nx2UserQueueReleaseProd(nx2_user_queue_t *queue, UInt32 prod) {
+  __atomic_store_n(&queue->prod, prod, __ATOMIC_RELEASE);
+}
+
+static inline void nx2UserQueueReleaseCons(nx2_user_queue_t *queue, UInt32 cons) {
+  __atomic_store_n(&queue->cons, cons, __ATOMIC_RELEASE);
+}
+
+//
+// Buffer indexes and lengths taken from the process are checked before the hardware is given them.
+//
+static inline bool nx2UserBufferValid(UInt32 buffer) {
+  return buffer < NX2_USER_BUFFER_COUNT;
+}
+
+static inline bool nx2UserTxLengthValid(UInt32 length) {
+  return length >= NX2_USER_TX_MIN_LENGTH && length <= NX2_USER_TX_MAX_LENGTH;
+}
+
+#ifdef __RING_ENGINE_H__
+//
+// Driver end of the queues, translating entries to and from the hardware rings.
+// Only built where RingEngine.h is included first; processes need none of it.
+//
+// Queue indexes owned by the driver are kept here and only copied out, so the process cannot move them.
+// The buffer behind each posted BD is tracked by BD index, as every frame occupies a single BD.
+// txComplete can only be full if the process submitted a buffer more than once, the completion is then dropped.
+// Doorbells are left to the caller.
+//
+typedef struct {
+  UInt8                     *buffers;
+  UInt64                    buffersPhysAddr;
+  
+  UInt32                    rxFillCons;
+  UInt32                    rxCompleteProd;
+  UInt32                    txSubmitCons;
+  UInt32                    txCompleteProd;
+  
+  UInt32                    rxPosted;
+  UInt16                    rxBuffers[RX_MAX_BD_COUNT];
+  UInt16                    txBuffers[TX_MAX_BD_COUNT];
+  
+  UInt64                    rxFrames;
+  UInt64                    rxDropped;
+  UInt64                    rxRejected;
+  UInt64                    txFrames;
+  UInt64                    txRejected;
+} nx2_user_rings_t;
+
+typedef struct {
+  UInt64                    location;
+  UInt32                    length;
+} nx2_user_segment_t;
+
+static inline UInt64 nx2UserBufferPhysAddr(const nx2_user_rings_t *rings, UInt32 buffer) {
+  return rings->buffersPhysAddr + (UInt64) buffer * NX2_USER_BUFFER_SIZE;
+}
+
+static inline void nx2UserPostRxBuffer(nx2_user_rings_t *rings, azul_nx2_rx_ring_t *rxRing, UInt32 buffer) {
+  UInt16 rxIndex = RX_BD_INDEX(rxRing->prod);
+  
+  rings->rxBuffers[rxIndex] = buffer;
+  rings->rxPosted++;
+  nx2RxRingPost(rxRing, rxIndex, nx2UserBufferPhysAddr(rings, buffer), NX2_USER_BUFFER_SIZE);
+}
+
+//
+// Moves buffers from the rxFill queue into free RX BDs, skipping invalid ones. Returns the number posted.
+//
+static inline UInt32 nx2UserFillRx(nx2_user_shared_t *shared, nx2_user_rings_t *rings, azul_nx2_rx_ring_t *rxRing) {
+  nx2_user_desc_t   desc;
+  UInt32            available;
+  UInt32            posted = 0;
+  
+  available = nx2UserQueueAvailable(&shared->rxFill, rings->rxFillCons);
+  while (available > 0 && rings->rxPosted < RX_USABLE_BD_COUNT) {
+    desc = nx2UserQueueRead(&shared->rxFill, rings->rxFillCons);
+    rings->rxFillCons++;
+    available--;
+    
+    if (!nx2UserBufferValid(desc.buffer)) {
+      rings->rxRejected++;
+      continue;
+    }
+    
+    nx2UserPostRxBuffer(rings, rxRing, desc.buffer);
+    posted++;
+  }
+  
+  nx2UserQueueReleaseCons(&shared->rxFill, rings->rxFillCons);
+  return posted;
+}
+
+//
+// Moves frames from the txSubmit queue into TX BDs while the ring has room, calling posted(txIndex, buffer)
+// for each. Invalid entries are returned on txComplete with NX2_USER_DESC_FLAG_ERROR set.
+// Returns the number posted.
+//
+template <typename Posted>
+static inline UInt32 nx2UserPostTx(nx2_user_shared_t *shared, nx2_user_rings_t *rings, azul_nx2_tx_ring_t *txRing, Posted posted) {
+  nx2_user_desc_t     desc;
+  nx2_user_segment_t  segment;
+  UInt32              available;
+  UInt16              txIndex;
+  UInt32              count = 0;
+  
+  available = nx2UserQueueAvailable(&shared->txSubmit, rings->txSubmitCons);
+  while (available > 0 && nx2TxRingHasRoom(txRing, 1)) {
+    desc = nx2UserQueueRead(&shared->txSubmit, rings->txSubmitCons);
+    rings->txSubmitCons++;
+    available--;
+    
+    if (!nx2UserBufferValid(desc.buffer) || !nx2UserTxLengthValid(desc.length)) {
+      rings->txRejected++;
+      nx2UserQueuePush(&shared->txComplete, &rings->txCompleteProd, desc.buffer, 0, NX2_USER_DESC_FLAG_ERROR);
+      continue;
+    }
+    
+    segment.location  = nx2UserBufferPhysAddr(rings, desc.buffer);
+    segment.length    = desc.length;
+    txIndex = nx2TxRingPost(txRing, &segment, 1, 0, 0, NULL);
+    rings->txBuffers[txIndex] = desc.buffer;
+    posted(txIndex, desc.buffer);
+    count++;
+  }
+  
+  nx2UserQueueReleaseCons(&shared->txSubmit, rings->txSubmitCons);
+  nx2UserQueueReleaseProd(&shared->txComplete, rings->txCompleteProd);
+  rings->txFrames += count;
+  return count;
+}
+
+//
+// Returns sent frames up to the new hardware consumer index on txComplete, calling completed(txIndex) for each.
+//
+template <typename Completed>
+static inline UInt32 nx2UserReclaimTx(nx2_user_shared_t *shared, nx2_user_rings_t *rings, azul_nx2_tx_ring_t *txRing,
+                                      UInt16 txConsNew, Completed completed) {
+  UInt32 count;
+  
+  count = nx2TxRingReclaimEach(txRing, txConsNew, [&](UInt16 txIndex) {
+    completed(txIndex);
+    nx2UserQueuePush(&shared->txComplete, &rings->txCompleteProd, rings->txBuffers[txIndex], 0, 0);
+  });
+  
+  nx2UserQueueReleaseProd(&shared->txComplete, rings->txCompleteProd);
+  return count;
+}
+
+//
+// Passes received frames up to the new hardware consumer index to rxComplete, then refills from rxFill.
+// Bad frames, or frames the process has no room for, are dropped with dropped(rxIndex, l2Header)
+// and their buffer goes straight back to the hardware. Returns the number of BDs harvested.
+//
+template <typename Dropped>
+static inline UInt32 nx2UserHarvestRx(nx2_user_shared_t *shared, nx2_user_rings_t *rings, azul_nx2_rx_ring_t *rxRing,
+                                      UInt16 rxConsNew, Dropped dropped) {
+  UInt32 count;
+  
+  count = nx2RxRingHarvest(rxRing, rxConsNew, [&](UInt16 rxIndex) {
+    return (rx_l2_header_t*) (rings->buffers + (size_t) rings->rxBuffers[rxIndex] * NX2_USER_BUFFER_SIZE);
+  }, [&](UInt16 rxIndex, rx_l2_header_t *l2Header, UInt16 packetLength, bool valid) {
+    rings->rxPosted--;
+    
+    if (!valid || nx2UserQueueSpace(&shared->rxComplete, rings->rxCompleteProd) == 0) {
+      dropped(rxIndex, l2Header);
+      rings->rxDropped++;
+      return false;
+    }
+    
+    nx2UserQueuePush(&shared->rxComplete, &rings->rxCompleteProd, rings->rxBuffers[rxIndex], packetLength, l2Header->status);
+    rings->rxFrames++;
+    return true;
+  }, [&](UInt16 rxIndex, bool reuse) {
+    if (reuse) {
+      nx2UserPostRxBuffer(rings, rxRing, rings->rxBuffers[rxIndex]);
+    }
+  });
+  nx2UserQueueReleaseProd(&shared->rxComplete, rings->rxCompleteProd);
+  
+  nx2UserFillRx(shared, rings, rxRing);
+  return count;
+}
+#endif
+
+#endif